@@ -12,6 +12,8 @@
 #include <iostream.h> 
 #include <stddef.h> 
 #include <stdlib.h> 
+#include <new>
+#include "nrutil.h"
 
 
 
@@ -19,8 +21,46 @@
 #define FREE_ARG char* 
 
 
+thread_local long nr_nalloc=0;  // heap allocations made so far by the calling thread (NRCOUNT)
 
-void nrerror(char error_text[]) 
+
+#if NRCOUNT
+
+// The allocations of the routines below and of operator new (the std
+// containers included) are counted, each thread in its own counter.
+// operator new[] and the other forms of operator delete go through the
+// two replaced here.
+
+void *operator new(size_t size)
+{
+  void *p;
+
+  nr_nalloc++;
+  p=malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+#endif
+
+
+static void *nr_malloc(size_t size)
+/* malloc, counted in nr_nalloc with NRCOUNT */
+{
+#if NRCOUNT
+  nr_nalloc++;
+#endif
+  return malloc(size);
+}
+
+
+
+void nrerror(const char error_text[]) 
 
 /* Numerical Recipes standard error handler */ 
 {
@@ -37,7 +77,7 @@ float *vector(long nl, long nh)
 /* allocate a float vector with subscript range v[nl..nh] */ 
 { 
   float *v; 
-  v=(float *)malloc((size_t) ((nh-nl+1+NR_END)*sizeof(float))); 
+  v=(float *)nr_malloc((size_t) ((nh-nl+1+NR_END)*sizeof(float))); 
   if (!v) cout<<"allocation failure in vector()"; 
   return v-nl+NR_END; 
 } 
@@ -45,7 +85,7 @@ float *vector(long nl, long nh)
 int *ivector(long nl, long nh) 
 /* allocate an int vector with subscript range v[nl..nh] */ 
 { 
-  int *v; v=(int *)malloc((size_t) ((nh-nl+1+NR_END)*sizeof(int))); 
+  int *v; v=(int *)nr_malloc((size_t) ((nh-nl+1+NR_END)*sizeof(int))); 
   if (!v) nrerror("allocation failure in ivector()"); 
   return v-nl+NR_END; 
 }
@@ -54,7 +94,7 @@ unsigned char *cvector(long nl, long nh)
 /* allocate an unsigned char vector with subscript range v[nl..nh] */ 
 {
   unsigned char *v; 
-  v=(unsigned char *)malloc((size_t) ((nh-nl+1+NR_END)*sizeof(unsigned char))); 
+  v=(unsigned char *)nr_malloc((size_t) ((nh-nl+1+NR_END)*sizeof(unsigned char))); 
   if (!v) nrerror("allocation failure in cvector()"); 
   return v-nl+NR_END; 
 } 
@@ -63,7 +103,7 @@ unsigned long *lvector(long nl, long nh)
 /* allocate an unsigned long vector with subscript range v[nl..nh] */ 
 { 
   unsigned long *v; 
-  v=(unsigned long *)malloc((size_t) ((nh-nl+1+NR_END)*sizeof(long))); 
+  v=(unsigned long *)nr_malloc((size_t) ((nh-nl+1+NR_END)*sizeof(long))); 
   if (!v) nrerror("allocation failure in lvector()"); 
   return v-nl+NR_END; 
 } 
@@ -74,7 +114,7 @@ double *dvector(long nl, long nh)
 
   double *v;
 
-  v=(double *)malloc((size_t) ((nh-nl+1+NR_END)*sizeof(double))); 
+  v=(double *)nr_malloc((size_t) ((nh-nl+1+NR_END)*sizeof(double))); 
   if (!v) nrerror("allocation failure in dvector()"); 
   return v-nl+NR_END; 
 } 
@@ -86,14 +126,14 @@ float **matrix(long nrl, long nrh, long ncl, long nch)
   float **m; 
 
   /* allocate pointers to rows */ 
-  m=(float **) malloc((size_t)((nrow+NR_END)*sizeof(float*)));
+  m=(float **) nr_malloc((size_t)((nrow+NR_END)*sizeof(float*)));
 
   if (!m) nrerror("allocation failure 1 in matrix()"); 
   m += NR_END; 
   m -= nrl; 
   
   /* allocate rows and set pointers to them */ 
-  m[nrl]=(float *) malloc((size_t)((nrow*ncol+NR_END)*sizeof(float))); 
+  m[nrl]=(float *) nr_malloc((size_t)((nrow*ncol+NR_END)*sizeof(float))); 
   if (!m[nrl]) nrerror("allocation failure 2 in matrix()"); 
   m[nrl] += NR_END; 
   m[nrl] -= ncl; 
@@ -112,13 +152,13 @@ double **dmatrix(long nrl, long nrh, long ncl, long nch)
   double **m; 
   
   /* allocate pointers to rows */ 
-  m=(double **) malloc((size_t)((nrow+NR_END)*sizeof(double*))); 
+  m=(double **) nr_malloc((size_t)((nrow+NR_END)*sizeof(double*))); 
   if (!m) nrerror("allocation failure 1 in matrix()"); 
   m += NR_END; 
   m -= nrl; 
   
   /* allocate rows and set pointers to them */ 
-  m[nrl]=(double *) malloc((size_t)((nrow*ncol+NR_END)*sizeof(double))); 
+  m[nrl]=(double *) nr_malloc((size_t)((nrow*ncol+NR_END)*sizeof(double))); 
   if (!m[nrl]) nrerror("allocation failure 2 in matrix()"); 
   m[nrl] += NR_END; 
   m[nrl] -= ncl; 
@@ -136,13 +176,13 @@ int **imatrix(long nrl, long nrh, long ncl, long nch)
   int **m; 
   
   /* allocate pointers to rows */ 
-  m=(int **) malloc((size_t)((nrow+NR_END)*sizeof(int*))); 
+  m=(int **) nr_malloc((size_t)((nrow+NR_END)*sizeof(int*))); 
   if (!m) nrerror("allocation failure 1 in matrix()"); 
   m += NR_END; 
   m -= nrl; 
   
   /* allocate rows and set pointers to them */ 
-  m[nrl]=(int *) malloc((size_t)((nrow*ncol+NR_END)*sizeof(int))); 
+  m[nrl]=(int *) nr_malloc((size_t)((nrow*ncol+NR_END)*sizeof(int))); 
   if (!m[nrl]) nrerror("allocation failure 2 in matrix()"); 
   m[nrl] += NR_END; 
   m[nrl] -= ncl;
@@ -160,7 +200,7 @@ float **submatrix(float **a, long oldrl, long oldrh, long oldcl, long oldch, lon
   float **m; 
 
   /* allocate array of pointers to rows */ 
-  m=(float **) malloc((size_t) ((nrow+NR_END)*sizeof(float*))); 
+  m=(float **) nr_malloc((size_t) ((nrow+NR_END)*sizeof(float*))); 
   if (!m) nrerror("allocation failure in submatrix()"); 
   m += NR_END; 
   m -= newrl; 
@@ -182,7 +222,7 @@ should be called with the address &a[0][0] as the first argument. */
   float **m; 
  
   /* allocate pointers to rows */ 
-  m=(float **) malloc((size_t) ((nrow+NR_END)*sizeof(float*))); 
+  m=(float **) nr_malloc((size_t) ((nrow+NR_END)*sizeof(float*))); 
   if (!m) nrerror("allocation failure in convert_matrix()"); 
   m += NR_END; 
   m -= nrl; 
@@ -202,19 +242,19 @@ float ***f3tensor(long nrl, long nrh, long ncl, long nch, long ndl, long ndh)
   float ***t; 
 
   /* allocate pointers to pointers to rows */ 
-  t=(float ***) malloc((size_t)((nrow+NR_END)*sizeof(float**))); 
+  t=(float ***) nr_malloc((size_t)((nrow+NR_END)*sizeof(float**))); 
   if (!t) nrerror("allocation failure 1 in f3tensor()"); 
   t += NR_END; 
   t -= nrl; 
 
   /* allocate pointers to rows and set pointers to them */ 
-  t[nrl]=(float **) malloc((size_t)((nrow*ncol+NR_END)*sizeof(float*))); 
+  t[nrl]=(float **) nr_malloc((size_t)((nrow*ncol+NR_END)*sizeof(float*))); 
   if (!t[nrl]) nrerror("allocation failure 2 in f3tensor()"); 
   t[nrl] += NR_END; 
   t[nrl] -= ncl;
 
   /* allocate rows and set pointers to them */ 
-  t[nrl][ncl]=(float *) malloc((size_t)((nrow*ncol*ndep+NR_END)*sizeof(float))); 
+  t[nrl][ncl]=(float *) nr_malloc((size_t)((nrow*ncol*ndep+NR_END)*sizeof(float))); 
   if (!t[nrl][ncl]) nrerror("allocation failure 3 in f3tensor()");
   t[nrl][ncl] += NR_END; 
   t[nrl][ncl] -= ndl; 
@@ -48,9 +48,15 @@ static int iminarg1,iminarg2;
 
 #define SIGN(a,b) ((b) >= 0.0 ? fabs(a) : -fabs(a)) 
 
+#ifndef NRCOUNT
+#define NRCOUNT 0  /* 1: count the heap allocations in nr_nalloc (replaces operator new) */
+#endif
+
+extern thread_local long nr_nalloc;  /* heap allocations made so far by the calling thread, with NRCOUNT */
+
 #if defined(__STDC__) || defined(ANSI) || defined(NRANSI) /* ANSI */ 
 
-void nrerror(char error_text[]); 
+void nrerror(const char error_text[]); 
 float *vector(long nl, long nh); 
 int *ivector(long nl, long nh); 
 unsigned char *cvector(long nl, long nh); 
@@ -132,6 +132,26 @@
 
 #define G 1.0       // pigment concentration (1-15 mg m-3 as in ANDE93)
 
+#define LIGHT_PROFILE 1  // light profile through the MLD: 1 three layer model (ANDE93)
+                         //                                2 two waveband approximation
+                         //                                3 single waveband approximation
+#define LIGHT_RESPONSE 1 // photosynthesis-irradiance function: 1 Steele's (ISAT, ISATEH)
+                         //                                     2 Michaelis-Menten's (IHD, IHEH)
+                         // (calcification is always Michaelis-Menten's, with IHCA)
+#define LIGHT_INTEGRATION 1 // light limitation averaged through the MLD with: 1 midpoint rule (30 intervals)
+                            //                                                 2 analytic integration
+                            // (2 is not available for the two waveband profile)
+
+#define LIGHT_TABLE 0    // 1 to interpolate the light limitation terms from a precomputed table
+#define LTFILE "./light.tab" // cache file of the light table
+#define LTNI 101         // number of points in the table for: surface irradiance 
+#define LTNC 65          //                                    square root of chlorophyll
+#define LTND 81          //                                    MLD
+#define LTIMAX 400.0     // max surface irradiance in the table (W m-2)
+#define LTCMAX 36.0      // max chlorophyll in the table (mg Chl m-3), k2 of ANDE93 turns negative above ~38
+#define LTDMIN 1.0       // min MLD in the table (m)
+#define LTDMAX 81.0      // max MLD in the table (m)
+
 
 // ============= MIXED LAYER DEPTH =================
 
@@ -287,6 +307,49 @@
 
 
 
+// ============= light limitation ====================
+
+struct light {       // light limitation terms, as given by get_light_limitation
+  double psi;        // light limiting all phytoplankton
+  double psieh;      // light limiting Emiliania huxleyi
+  double psica;      // light limiting calcification
+  double li;         // light at 5 m (W m-2)
+};
+
+
+// ============= carbonate system ====================
+
+struct carbonate {   // carbonate system species, as given by get_carbonate_system
+  double pco2;       // pCO2 in seawater (atm)
+  double co3;        // [CO3=] (umol kg-1)
+  double ocal;       // omega calcite
+  double oara;       // omega aragonite
+  double ph;         // pH
+  double hco3;       // [HCO3-] (umol kg-1)
+  double co2;        // [CO2(aq)] (umol kg-1)
+  double ah;         // [H+] from the alkalinity iteration (mol kg-1), also used as first guess
+  int niter;         // number of iterations needed for [H+]
+  int hfail;         // 1 if [H+] did not converge in HITMAX iterations (the last one is used)
+};
+
+struct carbconst {   // carbonate system constants, as given by get_carbonate_constants
+  double kc1, kc2;   // dissociation constants of carbonic acid
+  double kb;         // dissociation constant of boric acid
+  double kp2, kp3;   // dissociation constants of phosphoric acid
+  double kw;         // dissociation constant of water
+  double fh;         // total activity coefficient of H+
+  double bo;         // total borate (mol kg-1)
+  double kh;         // CO2 solubility (mol kg-1 atm-1)
+  double kcal;       // calcite solubility product over [Ca++] (mol kg-1)
+  double karag;      // aragonite solubility product over [Ca++] (mol kg-1)
+};
+
+#define HSOLVER 1    // [H+] solver: 0 is the original iteration (always at least 100 iterations)
+                     //              1 is Newton's method, warm-started from the previous [H+]
+#define HTOL 1.0e-10 // relative tolerance on [H+] for the Newton solver
+#define HITMAX 50    // max number of iterations for the Newton solver
+
+
 // ============= function prototypes =================
 
 
@@ -296,10 +359,24 @@ double get_averaged_light(double,double,double);    // Calculate limiting averag
 double get_averaged_light_eh(double,double,double); // As above but for E. huxleyi only
 double get_averaged_light_cal(double,double,double); // As above but for Calcification only
 double get_light_intensity(double,double);          // Calculate light at a given depth
+void get_light_limitation(double,double,double,double,double,light*); // All the above in one go (ISAT, ISATEH given)
+void get_attenuation(double,double[]);               // Attenuation coefficients (three layer model)
+void get_light_profile(double,double,double,const double[],double[]); // Light through the MLD
+double get_light_response(double,double,double);    // Photosynthesis-irradiance function
+int get_light_layers(double,double,double,const double[],double[],double[]); // Light at the layers' boundaries
+double get_steele_average(int,const double[],const double[],double,double); // Analytic MLD average (Steele)
+double get_mm_average(int,const double[],const double[],double,double);     // Analytic MLD average (M-M)
+double get_light_average(int,const double[],const double[],double,double,double); // Analytic MLD average
+void set_light_table(const char*);                  // Build (or load) the light limitation table
+void free_light_table(void);
+void get_light_table(double,double,double,light*);  // As get_light_limitation, from the table
 
 double get_gas_transfer_velocity(double,double);       
 double get_co2_solubility(double,double);           
 double get_param_water(double,double,double,double,double,int); 
+void get_carbonate_system(double,double,double,double,double,carbonate*); // all species at once
+void get_carbonate_constants(double,double,carbconst*);                   // T and S dependent part
+void get_carbonate_species(double,double,double,const carbconst*,carbonate*); // given the constants
 
 double min(double, double);
 double max(double, double);
@@ -0,0 +1,72 @@
+//
+//                      readres.cc
+//
+//  Reads the binary results file of a run (results.h):
+//
+//     ./readres results/results.bin               columns and years
+//     ./readres results/results.bin var           var on every day of every year
+//     ./readres results/results.bin var yy        var on every day of year yy
+//     ./readres results/results.bin var yy day    var on day 'day' (1 to 365) of year yy
+//
+//  The values are printed with the time (hours from the start of the run)
+//  and the day of the year. Compile with
+//
+//     g++ readres.cc -o readres
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "results.h"
+
+static void print_year(const results_file *r, int y, int c, int day)
+{
+  int j, t=get_results_column(r,"time");
+
+  for(j=0;j<r->year[y].nrec;j++){
+    if(day>0 && j!=day-1) continue;
+    printf("%.10g  %d  %.10g\n",get_results_value(r,y,t,j),j+1,get_results_value(r,y,c,j));
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  results_file r;
+  int c, y, day;
+
+  if(argc<2){
+    printf(" usage: %s results.bin [var [yy [day]]]\n",argv[0]);
+    return 1;
+  }
+  if(open_results(&r,argv[1])){
+    printf(" %s is not a complete results file\n",argv[1]);
+    return 1;
+  }
+
+  if(argc==2){
+    for(c=0;c<r.h->ncol;c++)
+      printf(" %-10s %-16s float%d\n",r.col[c].name,r.col[c].unit,8*r.col[c].size);
+    for(y=0;y<r.nyear;y++) printf(" year %d: %d days\n",r.year[y].yy,r.year[y].nrec);
+  }
+  else{
+    if((c=get_results_column(&r,argv[2]))<0){
+      printf(" no %s in %s\n",argv[2],argv[1]);
+      return 1;
+    }
+    if(argc==3) for(y=0;y<r.nyear;y++) print_year(&r,y,c,0);
+    else if((y=get_results_year(&r,atoi(argv[3])))<0){
+      printf(" year %s not in %s\n",argv[3],argv[1]);
+      return 1;
+    }
+    else{
+      day=argc>4 ? atoi(argv[4]) : 0;
+      if(argc>4 && (day<1 || day>r.year[y].nrec)){
+	printf(" day %s not in year %s of %s (1 to %d)\n",argv[4],argv[3],argv[1],r.year[y].nrec);
+	return 1;
+      }
+      print_year(&r,y,c,day);
+    }
+  }
+
+  close_results(&r);
+  return 0;
+}
@@ -0,0 +1,179 @@
+//
+//                      results.h
+//
+//                    header file
+//
+//
+//  Binary results file of a run (./results/results.bin) and a reader
+//  that maps it in memory
+//
+//  The file holds the daily results of all the years integrated by the
+//  run, year after year, in columns:
+//    header   RSMAGIC, the number of columns and the hours of a year
+//    columns  name, unit and size of each column (8 for float64, 4 for
+//             float32)
+//    years    for each year, the values of each column one after the
+//             other: nrec values, padded to 8 bytes; record j is the end
+//             of day j+1 of the year
+//    index    for each year: the year of the run (0 is the first), the
+//             number of records and the offset of the year in the file
+//    trailer  the offset of the index, the number of years and RSMAGIC
+//  The index is at the end so that the file is written in one pass. A
+//  value of any year and day is then read at a known offset, without
+//  reading the rest of the file.
+//
+
+#ifndef _RESULTS_H_
+#define _RESULTS_H_
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define RSMAGIC "PBSRES01"
+
+struct results_header {
+  char magic[8];
+  int ncol;          // number of columns
+  int hstep;         // hours of a year
+};
+
+struct results_column {
+  char name[16];
+  char unit[16];
+  int size;          // bytes of a value, 8 (float64) or 4 (float32)
+  int pad;
+};
+
+struct results_year {
+  int yy;            // year of the run
+  int nrec;          // number of records (days)
+  long offset;       // of the first column, from the start of the file
+};
+
+struct results_trailer {
+  long index;        // offset of the index
+  long nyear;        // number of years
+  char magic[8];
+};
+
+
+// ===== READER =====
+
+struct results_file {
+  char *map;                 // the file, mapped read-only
+  size_t size;
+  const results_header *h;
+  const results_column *col; // h->ncol columns
+  const results_year *year;  // nyear years
+  long nyear;
+};
+
+// bytes of a column of n records in a year
+static inline long get_results_size(const results_column *c, int n)
+{
+  return ((long)n*c->size+7)/8*8;
+}
+
+// TRUE if the columns and the years of the mapped file r, with the
+// index at 'index', are all within the file
+static inline int check_results(const results_file *r, long index)
+{
+  long begin=sizeof(results_header)+(long)r->h->ncol*sizeof(results_column), off;
+  int c, y;
+
+  if(r->h->ncol<=0 || r->h->ncol>index/(long)sizeof(results_column) || begin>index) return 0;
+  for(c=0;c<r->h->ncol;c++)
+    if((r->col[c].size!=4 && r->col[c].size!=8) || r->col[c].name[15] || r->col[c].unit[15]) return 0;
+  for(y=0;y<r->nyear;y++){
+    off=r->year[y].offset;
+    if(r->year[y].nrec<0 || r->year[y].nrec>index/4 || off<begin || off%8) return 0;
+    for(c=0;c<r->h->ncol && off<=index;c++) off+=get_results_size(&r->col[c],r->year[y].nrec);
+    if(off>index) return 0;
+  }
+  return 1;
+}
+
+// map the file 'name'; returns 0 if it is a complete results file
+static inline int open_results(results_file *r, const char *name)
+{
+  struct stat st;
+  const results_trailer *t;
+  int fd=open(name,O_RDONLY);
+
+  memset(r,0,sizeof(results_file));
+  if(fd<0) return 1;
+  if(fstat(fd,&st) || st.st_size<(long)(sizeof(results_header)+sizeof(results_trailer))){
+    close(fd);
+    return 1;
+  }
+  r->size=st.st_size;
+  r->map=(char *)mmap(NULL,r->size,PROT_READ,MAP_SHARED,fd,0);
+  close(fd);
+  if(r->map==MAP_FAILED){
+    r->map=NULL;
+    return 1;
+  }
+
+  r->h=(const results_header *)r->map;
+  t=(const results_trailer *)(r->map+r->size-sizeof(results_trailer));
+  if(memcmp(r->h->magic,RSMAGIC,8) || memcmp(t->magic,RSMAGIC,8) ||  // not written to the end
+     t->index<(long)sizeof(results_header) || t->index%8 || t->nyear<0 ||
+     t->nyear>(long)r->size/(long)sizeof(results_year) ||
+     t->index+t->nyear*(long)sizeof(results_year)>(long)(r->size-sizeof(results_trailer))){
+    munmap(r->map,r->size);
+    r->map=NULL;
+    return 1;
+  }
+  r->col=(const results_column *)(r->map+sizeof(results_header));
+  r->year=(const results_year *)(r->map+t->index);
+  r->nyear=t->nyear;
+  if(!check_results(r,t->index)){              // truncated or corrupt
+    munmap(r->map,r->size);
+    r->map=NULL;
+    return 1;
+  }
+  return 0;
+}
+
+static inline void close_results(results_file *r)
+{
+  if(r->map) munmap(r->map,r->size);
+  r->map=NULL;
+}
+
+// index of the column 'name', -1 if there is none
+static inline int get_results_column(const results_file *r, const char *name)
+{
+  for(int c=0;c<r->h->ncol;c++) if(!strncmp(r->col[c].name,name,sizeof(r->col[c].name))) return c;
+  return -1;
+}
+
+// index of year yy of the run, -1 if it was not integrated
+static inline int get_results_year(const results_file *r, int yy)
+{
+  for(int y=0;y<r->nyear;y++) if(r->year[y].yy==yy) return y;
+  return -1;
+}
+
+// the values of column c in year y (indices as above), as written
+static inline const void *get_results_data(const results_file *r, int y, int c)
+{
+  long off=r->year[y].offset;
+
+  for(int i=0;i<c;i++) off+=get_results_size(&r->col[i],r->year[y].nrec);
+  return r->map+off;
+}
+
+// value of column c at record j of year y
+static inline double get_results_value(const results_file *r, int y, int c, int j)
+{
+  const void *p=get_results_data(r,y,c);
+
+  if(r->col[c].size==4) return ((const float *)p)[j];
+  return ((const double *)p)[j];
+}
+
+#endif
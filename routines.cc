@@ -25,6 +25,11 @@
 //
 // 4. LIGHT INTENSITY AT DEPTH
 // calculation of light at a certain depth
+// (get_light_limitation gives 3. and 4. in one go)
+//
+// 4b. LIGHT LIMITATION TABLE
+// precomputed light limitation terms, interpolated in 
+// surface irradiance, chlorophyll and MLD
 //
 // 5. MIN / MAX ROUTINES
 // calculation of the minimum between two numbers
@@ -58,6 +63,9 @@
  
 #include "param.h"
 
+double *dvector(long nl, long nh);                  // from nrutil.cc, for the light table
+void free_dvector(double *v, long nl, long nh);
+
 #define SOLARC 1373.0 // solar constant in W m-2, see Kirk at pag 27
 #define WTOE 4.17     // Watts (W m-2) to Einstein (uEin m-2 s-1) conversion 
                       // factor, see Lalli and Parsons at pag 261
@@ -289,400 +297,362 @@ double get_light(double irr_surf, double chloro, double d)   // d is MLD
 //======================== LIMITING IRRADIANCE THROUGH DEPTH ============================
 
 
-double get_averaged_light(double irr_surf, double chloro, double d)   // d is MLD
-{
-
-  int i=0;
-  int j=0;
-
-  int z=0;            // depth
-  int nz=0;           // new depth
+// The light profile and the photosynthesis-irradiance function are chosen at
+// compile time with LIGHT_PROFILE and LIGHT_RESPONSE (see param.h). Only the
+// selected formulation is compiled into the routines below.
 
-  double Iz2=0.0;     // irradiance calculated at depth z with 2w
-  double Iz1=0.0;     // irradiance calculated at depth z with 1w
-  double psi2w=0.0;   // M-M light limitation term (two wave-band model) 
-  double psi1w=0.0;   // M-M light limitation term (single wave-band model) 
-  double psi3l=0.0;   // M-M light limitation term (three-layer model) 
-  double psi3lsat=0.0;// Sat light limitation term (three-layer model)
-  double psi2wsat=0.0;// Sat light limitation term (two-waveband model)
 
-  double psia=0.0;    // averaged light in the MLD
+// attenuation coefficients of the three layer model (ANDE93)
 
-  double res=0.0;
-  double res1=0.0;
-  double res2=0.0;
+void get_attenuation(double chloro, double k[3])
+{
 
-  int ires=0;
-  int ires1=0;
-  int ires2=0;
+  int i=0;
+  int j=0;
 
-  double Iz=0.0;    // irradiance calculated at depth z with 3l
-  double integ=0.0; // irradiance integrated through depth (averaged light)
   double c;         // square root of pigment concentration
   
-  double k[3]={0.0, 0.0, 0.0};  // attenuation coefficients
-  
   double b[3][6] = {
     {0.13096, 0.030969, 0.042644, -0.013738, 0.0024617, -0.00018059},
     {0.041025, 0.036211, 0.062297, -0.030098, 0.0062597, -0.00051944},
     {0.021517, 0.050150, 0.058900, -0.040539, 0.0087586, -0.00049476},
   };
 
- // --- Three layer model (Anderson's) ---
-
-  // irr_surf is in W m-2
-
   c=sqrt(chloro); // chloro is = G in Tom's model. sqrt is to ensure a bias 
                   // toward smaller values (more frequent in nature)
  
   // calculate att. coeff. for the three layers (k1, k2, k3) 
   for(i=0;i<3;i++){
+    k[i]=0.0;
     for(j=0;j<6;j++) k[i]+=b[i][j]*pow(c,j);      
   }
+}
+
+
+// irradiance at the middle of each of the 30 intervals of the MLD (d),
+// k are the attenuation coefficients from get_attenuation (three layer
+// model only)
+
+void get_light_profile(double irr_surf, double chloro, double d, const double k[3], double Iz[30])
+{
+
+  int z=0;          // depth
+
+#if LIGHT_PROFILE==1
+
+ // --- Three layer model (Anderson's) ---
+
+  // irr_surf is in W m-2
+
+  int ires1=0;      // last interval in the first layer
+  int ires2=0;      // last interval in the second layer
+
   //case 1: M<=5
   if(d<=5){
     // calculate light attenuation in layer 1 (0-5 m)
-    for(z=1;z<=30;z++){
-      Iz=irr_surf*exp(-k[0]*((z-0.5)*d/30.0));
-      psi3l+=Iz/(Iz+IHD);                     // Michaelis-Menten's function (see TOTT93a pag 330 case ii)
-      psi3lsat+=(Iz/ISAT)*exp(1.0-Iz/ISAT);   // Steele's function (see TOTT93a pag 330 case iii)
-      psia+=Iz;
-    } 
+    for(z=1;z<=30;z++) Iz[z-1]=irr_surf*exp(-k[0]*((z-0.5)*d/30.0));
   }
   //case 2: 5<M<=23
   if((d>5) && (d<=23)){
-    res = (30.0/d)*5.0;  // number of intervals in the first layer
-    ires = (int) res;    // take the integer part of res
+    ires1 = (int) ((30.0/d)*5.0);  // number of intervals in the first layer
     // calculate light attenuation in layer 1 (0-5 m)
-    for(z=1;z<=ires;z++){
-      Iz=irr_surf*exp(-k[0]*((z-0.5)*5.0/30.0));
-      psi3l+=Iz/(Iz+IHD);                     // Michaelis-Menten's function (see TOTT93a pag 330 case ii)
-      psi3lsat+=(Iz/ISAT)*exp(1.0-Iz/ISAT);   // Steele's function (see TOTT93a pag 330 case iii)
-    } 
+    for(z=1;z<=ires1;z++) Iz[z-1]=irr_surf*exp(-k[0]*((z-0.5)*5.0/30.0));
     // calculate light attenuation in layer 2 (5-23 m)
-    for(z=ires+1;z<=30;z++){
-      Iz=irr_surf*exp(-5.0*k[0])*exp(-k[1]*((z-0.5)*d/30.0));
-      psi3l+=Iz/(Iz+IHD);                     // Michaelis-Menten's function (see TOTT93a pag 330 case ii)
-      psi3lsat+=(Iz/ISAT)*exp(1.0-Iz/ISAT);   // Steele's function (see TOTT93a pag 330 case iii)
-    }
+    for(z=ires1+1;z<=30;z++) Iz[z-1]=irr_surf*exp(-5.0*k[0])*exp(-k[1]*((z-0.5)*d/30.0));
   }
   //case 3: M>23
   if(d>23){
-    res1 = (30.0/d)*5.0;    // number of intervals in the first layer
-    res2 = (30.0/d)*18.0;   // number of intervals in the second layer
-    ires1 = (int) res1;     // take the integer part of res1
-    ires2 = (int) res2;     // take the integer part of res2
+    ires1 = (int) ((30.0/d)*5.0);  // number of intervals in the first layer
+    ires2 = (int) ((30.0/d)*18.0); // number of intervals in the second layer
     // calculate light attenuation in layer 1 (0-5 m)
-    for(z=1;z<=ires1;z++){
-      Iz=irr_surf*exp(-k[0]*((z-0.5)*5.0/30.0));
-      psi3l+=Iz/(Iz+IHD);                     // Michaelis-Menten's function (see TOTT93a pag 330 case ii)
-      psi3lsat+=(Iz/ISAT)*exp(1.0-Iz/ISAT);   // Steele's function (see TOTT93a pag 330 case iii)
-    } 
+    for(z=1;z<=ires1;z++) Iz[z-1]=irr_surf*exp(-k[0]*((z-0.5)*5.0/30.0));
     // calculate light attenuation in layer 2 (5-23 m)
-    for(z=ires1+1;z<=ires2;z++){
-      Iz=irr_surf*exp(-5.0*k[0])*exp(-k[1]*((z-0.5)*23.0/30.0));
-      psi3l+=Iz/(Iz+IHD);                     // Michaelis-Menten's function (see TOTT93a pag 330 case ii)
-      psi3lsat+=(Iz/ISAT)*exp(1.0-Iz/ISAT);   // Steele's function (see TOTT93a pag 330 case iii)
-    }
+    for(z=ires1+1;z<=ires2;z++) Iz[z-1]=irr_surf*exp(-5.0*k[0])*exp(-k[1]*((z-0.5)*23.0/30.0));
     // calculate light attenuation in layer 3 (23-60 m)
-    for(z=ires2+1;z<=30;z++){
-      Iz=irr_surf*exp(-5.0*k[0])*exp(-18.0*k[1])*exp(-k[2]*((z-0.5)*d/30.0));
-      psi3l+=Iz/(Iz+IHD);                     // Michaelis-Menten's function (see TOTT93a pag 330 case ii)
-      psi3lsat+=(Iz/ISAT)*exp(1.0-Iz/ISAT);   // Steele's function (see TOTT93a pag 330 case iii)
-    }
+    for(z=ires2+1;z<=30;z++) Iz[z-1]=irr_surf*exp(-5.0*k[0])*exp(-18.0*k[1])*exp(-k[2]*((z-0.5)*d/30.0));
   }
-  psi3l=psi3l/30.0;
-  psi3lsat=psi3lsat/30.0;
 
+#elif LIGHT_PROFILE==2
 
   // --- Two waveband approximation ---
 
   for(z=1;z<=30;z++){     //1.9875 makes Chl in mmol/m3
-    Iz2=0.5*irr_surf*(exp(-(KGR + KSS*chloro/1.9875)*((z-0.5)*(d/30.0))) + 
-                      exp(-(KRE + KSS*chloro/1.9875)*((z-0.5)*(d/30.0)))); 
-    psi2w+=Iz2/(Iz2+IHD);
-    psi2wsat+=(Iz2/ISAT)*exp(1-(Iz2/ISAT));
+    Iz[z-1]=0.5*irr_surf*(exp(-(KGR + KSS*chloro/1.9875)*((z-0.5)*(d/30.0))) + 
+                          exp(-(KRE + KSS*chloro/1.9875)*((z-0.5)*(d/30.0)))); 
+  }
+
+#else
+
+  // --- Single waveband approximation ---
 
+  for(z=1;z<=30;z++){     //1.9875 makes Chl in mmol/m3 
+    Iz[z-1]=irr_surf*exp(-(KW + KSS*chloro/1.9875)*((z-0.5)*(d/30.0)));
   }
-  psi2w=psi2w/30.0;
-  psi2wsat=psi2wsat/30.0;
+
+#endif
+}
+
+
+// photosynthesis-irradiance function, is is the saturating light
+// (Steele's) and ih the half-saturation constant (Michaelis-Menten's)
+
+double get_light_response(double Iz, double is, double ih)
+{
+#if LIGHT_RESPONSE==1
+  return (Iz/is)*exp(1.0-Iz/is);   // Steele's function (see TOTT93a pag 330 case iii)
+#else
+  return Iz/(Iz+ih);               // Michaelis-Menten's function (see TOTT93a pag 330 case ii)
+#endif
+}
+
+
+//======================= ANALYTIC INTEGRATION THROUGH THE MLD =========================
+
+
+// With LIGHT_INTEGRATION 2 (see param.h) the light limitation terms are 
+// averaged over the MLD exactly instead of with the 30 intervals midpoint
+// rule. Within a layer of attenuation k the irradiance is I(z)=Ia*exp(-k*z),
+// so that dz = -dI/(k*I) and, from the top (Ia) to the bottom (Ib) of the layer:
+//
+//   Steele's:           int (I/is)*exp(1-I/is) dz = exp(1)/k*(exp(-Ib/is)-exp(-Ia/is))
+//   Michaelis-Menten's: int I/(I+ih) dz            = 1/k*log((Ia+ih)/(Ib+ih))
+//
+// The two waveband approximation is not a single exponential and is 
+// always integrated with the midpoint rule.
+
+
+// irradiance at the boundaries of the layers in the MLD (d): Ib[0] at the 
+// surface, Ib[i+1] at the bottom of layer i, whose attenuation coefficient
+// is kl[i]. Returns the number of layers.
+
+int get_light_layers(double irr_surf, double chloro, double d, const double k[3], double Ib[4], double kl[3])
+{
+
+  int nl=0;          // number of layers in the MLD
+
+  double top[3];     // depth of the top of each layer
+  double bot[3];     // depth of the bottom of each layer
+
+#if LIGHT_PROFILE==1
+
+  // --- Three layer model (Anderson's): 0-5 m, 5-23 m, below 23 m ---
+
+  top[0]=0.0;  bot[0]=min(d,5.0);  kl[0]=k[0];
+  top[1]=5.0;  bot[1]=min(d,23.0); kl[1]=k[1];
+  top[2]=23.0; bot[2]=d;           kl[2]=k[2];
+
+  nl=1;
+  if(d>5) nl=2;
+  if(d>23) nl=3;
+
+#else
 
   // --- Single waveband approximation ---
 
-  for(z=1;z<=30;z++){
-    Iz1=irr_surf*exp(-(KW + KSS*chloro/1.9875)*((z-0.5)*(d/30.0)));  //1.9875 makes Chl in mmol/m3 
-    psi1w+=Iz1/(Iz1+IHD);
+  top[0]=0.0; bot[0]=d; kl[0]=KW + KSS*chloro/1.9875;  //1.9875 makes Chl in mmol/m3
+  nl=1;
+
+#endif
+
+  int i;
+  Ib[0]=irr_surf;
+  for(i=0;i<nl;i++) Ib[i+1]=Ib[i]*exp(-kl[i]*(bot[i]-top[i]));
+
+  return nl;
+}
+
+
+// averaged Steele's function through the MLD, from get_light_layers
+
+double get_steele_average(int nl, const double Ib[], const double kl[], double d, double is)
+{
+  int i;
+  double sum=0.0;
+  double ea, eb;
+
+  ea=exp(-Ib[0]/is);
+  for(i=0;i<nl;i++){
+    eb=exp(-Ib[i+1]/is);
+    sum+=(eb-ea)/kl[i];
+    ea=eb;
   }
-  psi1w=psi1w/30.0;
 
+  return exp(1.0)*sum/d;
+}
 
-  // ===== Return - to all but Ehux =====
 
-  //return psi3l;       // Michaelis-Menten's fashion
-  return psi3lsat;    // Steele's fashion
+// averaged Michaelis-Menten's function through the MLD, from get_light_layers
 
-  //return psi2w;
-  //return psi2wsat;
+double get_mm_average(int nl, const double Ib[], const double kl[], double d, double ih)
+{
+  int i;
+  double sum=0.0;
 
-  // ====================================
+  for(i=0;i<nl;i++) sum+=log((Ib[i]+ih)/(Ib[i+1]+ih))/kl[i];
 
+  return sum/d;
 }
 
 
-double get_averaged_light_eh(double irr_surf, double chloro, double d) //with IHEH required by ehux
+// averaged photosynthesis-irradiance function through the MLD (as get_light_response)
+
+double get_light_average(int nl, const double Ib[], const double kl[], double d, double is, double ih)
 {
+#if LIGHT_RESPONSE==1
+  return get_steele_average(nl,Ib,kl,d,is);
+#else
+  return get_mm_average(nl,Ib,kl,d,ih);
+#endif
+}
 
-  int i=0;
-  int j=0;
 
-  int z=0;          // depth
-  int nz=0;         // new depth
+#if LIGHT_INTEGRATION==2 && LIGHT_PROFILE!=2
+#define LIGHT_ANALYTIC       // analytic integration through the MLD
+#endif
 
-  double Iz2=0.0;   // irradiance calculated at depth z with 2w
-  double Iz1=0.0;   // irradiance calculated at depth z with 1w
-  double psi2w=0.0;
-  double psi1w=0.0;
-  double psi3l=0.0;
 
-  double psi3lsat=0.0;
-  double psi2wsat=0.0;
+double get_averaged_light(double irr_surf, double chloro, double d)   // d is MLD
+{
 
-  double res=0.0;
-  double res1=0.0;
-  double res2=0.0;
+  int z=0;            // depth
 
-  int ires=0;
-  int ires1=0;
-  int ires2=0;
+  double Iz[30];      // irradiance at depth z
+  double psi=0.0;     // light limitation term
 
-  double Iz=0.0;    // irradiance calculated at depth z with 3l
-  double integ=0.0; // irradiance integrated through depth (averaged light)
-  double c;         // square root of pigment concentration
-  
   double k[3]={0.0, 0.0, 0.0};  // attenuation coefficients
-  
-  double b[3][6] = {
-    {0.13096, 0.030969, 0.042644, -0.013738, 0.0024617, -0.00018059},
-    {0.041025, 0.036211, 0.062297, -0.030098, 0.0062597, -0.00051944},
-    {0.021517, 0.050150, 0.058900, -0.040539, 0.0087586, -0.00049476},
-  };
 
- // --- Three layer model (Anderson's) ---
+#if LIGHT_PROFILE==1
+  get_attenuation(chloro,k);
+#endif
 
-  c=sqrt(chloro); // chloro is = G in Tom's model. sqrt is to ensure a bias 
-                  // toward smaller values (more frequent in nature)
- 
-  // calculate att. coeff. for the three layers (k1, k2, k3) 
-  for(i=0;i<3;i++){
-    for(j=0;j<6;j++) k[i]+=b[i][j]*pow(c,j);      
-  }
-  //case 1: M<=5
-  if(d<=5){
-    // calculate light attenuation in layer 1 (0-5 m)
-    for(z=1;z<=30;z++){
-      Iz=irr_surf*exp(-k[0]*((z-0.5)*d/30));
-      psi3l+=Iz/(Iz+IHEH);
-      psi3lsat+=(Iz/ISATEH)*exp(1.0-Iz/ISATEH);   // Steele's function (see TOTT93a pag 330 case iii)
-    } 
-  }
-  //case 2: 5<M<=23
-  if((d>5) && (d<=23)){
-    res = (30/d)*5;  // number of intervals in the first layer
-    ires = (int) res; // take the integer part of res
-    // calculate light attenuation in layer 1 (0-5 m)
-    for(z=1;z<=ires;z++){
-      Iz=irr_surf*exp(-k[0]*((z-0.5)*5/30));
-      psi3l+=Iz/(Iz+IHEH);
-      psi3lsat+=(Iz/ISATEH)*exp(1.0-Iz/ISATEH);   // Steele's function (see TOTT93a pag 330 case iii)
-    } 
-    // calculate light attenuation in layer 2 (5-23 m)
-    for(z=ires+1;z<=30;z++){
-      Iz=irr_surf*exp(-5*k[0])*exp(-k[1]*((z-0.5)*d/30));
-      psi3l+=Iz/(Iz+IHEH);
-      psi3lsat+=(Iz/ISATEH)*exp(1.0-Iz/ISATEH);   // Steele's function (see TOTT93a pag 330 case iii)
-    }
-  }
-  //case 3: M>23
-  if(d>23){
-    res1 = (30/d)*5;    // number of intervals in the first layer
-    res2 = (30/d)*18;   // number of intervals in the second layer
-    ires1 = (int) res1; // take the integer part of res1
-    ires2 = (int) res2; // take the integer part of res2
-    // calculate light attenuation in layer 1 (0-5 m)
-    for(z=1;z<=ires1;z++){
-      Iz=irr_surf*exp(-k[0]*((z-0.5)*5/30));
-      psi3l+=Iz/(Iz+IHEH);
-      psi3lsat+=(Iz/ISATEH)*exp(1.0-Iz/ISATEH);   // Steele's function (see TOTT93a pag 330 case iii)
-    } 
-    // calculate light attenuation in layer 2 (5-23 m)
-    for(z=ires1+1;z<=ires2;z++){
-      Iz=irr_surf*exp(-5*k[0])*exp(-k[1]*((z-0.5)*23/30));
-      psi3l+=Iz/(Iz+IHEH);     
-      psi3lsat+=(Iz/ISATEH)*exp(1.0-Iz/ISATEH);   // Steele's function (see TOTT93a pag 330 case iii)
-    }
-    // calculate light attenuation in layer 3 (23-60 m)
-    for(z=ires2+1;z<=30;z++){
-      Iz=irr_surf*exp(-5*k[0])*exp(-18*k[1])*exp(-k[2]*((z-0.5)*d/30));
-      psi3l+=Iz/(Iz+IHEH);      
-      psi3lsat+=(Iz/ISATEH)*exp(1.0-Iz/ISATEH);   // Steele's function (see TOTT93a pag 330 case iii)
-    }
-  }
-  psi3l=psi3l/30.0;
-  psi3lsat=psi3lsat/30.0;
+#ifdef LIGHT_ANALYTIC
+  double Ib[4], kl[3];
+  int nl=get_light_layers(irr_surf,chloro,d,k,Ib,kl);
+  psi=30.0*get_light_average(nl,Ib,kl,d,ISAT,IHD);
+#else
+  get_light_profile(irr_surf,chloro,d,k,Iz);
 
+  for(z=0;z<30;z++) psi+=get_light_response(Iz[z],ISAT,IHD);
+#endif
 
-  // --- Two waveband approximation ---
-  
-  for(z=1;z<=30;z++){
-    Iz2=0.5*irr_surf*(exp(-(KGR + KSS*chloro/1.9875)*((z-0.5)*(d/30.0))) +  //1.9875 makes Chl in mmol/m3
-		      exp(-(KRE + KSS*chloro/1.9875)*((z-0.5)*(d/30.0)))); 
-    psi2w+=Iz2/(Iz2+IHEH);
-    psi2wsat+=(Iz2/ISATEH)*exp(1-(Iz2/ISATEH));
-  }
-  psi2w=psi2w/30.0;
-  psi2wsat=psi2wsat/30.0;
-  
-  
-  // --- Single waveband approximation ---
-  
-  for(z=1;z<=30;z++){
-    Iz1=irr_surf*exp(-(KW + KSS*chloro/1.9875)*((z-0.5)*(d/30.0)));  //1.9875 makes Chl in mmol/m3 
-    psi1w+=Iz1/(Iz1+IHEH);
-  }
-  psi1w=psi1w/30.0;
-  
- 
-  // ==== Return - only to Ehux ====
+  // ===== Return - to all but Ehux =====
 
-  //return psi3l;     // Michaelis-Menten's fashion
-  return psi3lsat;  // Steele's fashion
+  return psi/30.0;
+}
+
+
+double get_averaged_light_eh(double irr_surf, double chloro, double d) //with IHEH required by ehux
+{
+
+  int z=0;            // depth
 
-  //return psi2w;
-  //return psi2wsat;
+  double Iz[30];      // irradiance at depth z
+  double psi=0.0;     // light limitation term
 
-  // ==============================
+  double k[3]={0.0, 0.0, 0.0};  // attenuation coefficients
+
+#if LIGHT_PROFILE==1
+  get_attenuation(chloro,k);
+#endif
+
+#ifdef LIGHT_ANALYTIC
+  double Ib[4], kl[3];
+  int nl=get_light_layers(irr_surf,chloro,d,k,Ib,kl);
+  psi=30.0*get_light_average(nl,Ib,kl,d,ISATEH,IHEH);
+#else
+  get_light_profile(irr_surf,chloro,d,k,Iz);
+
+  for(z=0;z<30;z++) psi+=get_light_response(Iz[z],ISATEH,IHEH);
+#endif
+
+  // ==== Return - only to Ehux ====
+
+  return psi/30.0;
 }
 
 
 double get_averaged_light_cal(double irr_surf, double chloro, double d) //with IHEH required by ehux
 {
 
-  int i=0;
-  int j=0;
+  int z=0;            // depth
 
-  int z=0;          // depth
-  int nz=0;         // new depth
+  double Iz[30];      // irradiance at depth z
+  double psi=0.0;     // light limitation term
 
-  double Iz2=0.0;   // irradiance calculated at depth z with 2w
-  double Iz1=0.0;   // irradiance calculated at depth z with 1w
-  double psi2w=0.0;
-  double psi1w=0.0;
-  double psi3l=0.0;
+  double k[3]={0.0, 0.0, 0.0};  // attenuation coefficients
 
-  double psi2wsat=0.0;
+#if LIGHT_PROFILE==1
+  get_attenuation(chloro,k);
+#endif
 
-  double res=0.0;
-  double res1=0.0;
-  double res2=0.0;
+  // calcification is always in Michaelis-Menten's fashion
+#ifdef LIGHT_ANALYTIC
+  double Ib[4], kl[3];
+  int nl=get_light_layers(irr_surf,chloro,d,k,Ib,kl);
+  psi=30.0*get_mm_average(nl,Ib,kl,d,IHCA);
+#else
+  get_light_profile(irr_surf,chloro,d,k,Iz);
 
-  int ires=0;
-  int ires1=0;
-  int ires2=0;
+  for(z=0;z<30;z++) psi+=Iz[z]/(Iz[z]+IHCA);
+#endif
 
-  double Iz=0.0;    // irradiance calculated at depth z with 3l
-  double integ=0.0; // irradiance integrated through depth (averaged light)
-  double c;         // square root of pigment concentration
-  
+  // ==== Return - only to calcification ====
+
+  return psi/30.0;
+}
+
+
+
+//=================== ALL LIGHT LIMITATION TERMS AT ONCE ===============================
+
+
+// Same as get_averaged_light (psi), get_averaged_light_eh (psieh), 
+// get_averaged_light_cal (psica) and get_light_intensity (li) together:
+// the attenuation coefficients and the light profile through the MLD are
+// calculated only once and used for the four terms. At night (irr_surf=0)
+// all the terms are zero and nothing is calculated. The saturating light of
+// Steele's function is given (is, iseh in place of ISAT, ISATEH) so that it
+// can be changed at run time.
+
+void get_light_limitation(double irr_surf, double chloro, double d, double is, double iseh, light *lt)   // d is MLD
+{
+
+  int z=0;            // depth
+
+  double Iz[30];      // irradiance at depth z
   double k[3]={0.0, 0.0, 0.0};  // attenuation coefficients
-  
-  double b[3][6] = {
-    {0.13096, 0.030969, 0.042644, -0.013738, 0.0024617, -0.00018059},
-    {0.041025, 0.036211, 0.062297, -0.030098, 0.0062597, -0.00051944},
-    {0.021517, 0.050150, 0.058900, -0.040539, 0.0087586, -0.00049476},
-  };
 
- // --- Three layer model (Anderson's) ---
+  lt->psi=0.0;
+  lt->psieh=0.0;
+  lt->psica=0.0;
+  lt->li=0.0;
 
-  c=sqrt(chloro); // chloro is = G in Tom's model. sqrt is to ensure a bias 
-                  // toward smaller values (more frequent in nature)
- 
-  // calculate att. coeff. for the three layers (k1, k2, k3) 
-  for(i=0;i<3;i++){
-    for(j=0;j<6;j++) k[i]+=b[i][j]*pow(c,j);      
-  }
-  //case 1: M<=5
-  if(d<=5){
-    // calculate light attenuation in layer 1 (0-5 m)
-    for(z=1;z<=30;z++){
-      Iz=irr_surf*exp(-k[0]*((z-0.5)*d/30));
-      psi3l+=Iz/(Iz+IHCA);
-    } 
-  }
-  //case 2: 5<M<=23
-  if((d>5) && (d<=23)){
-    res = (30/d)*5;  // number of intervals in the first layer
-    ires = (int) res; // take the integer part of res
-    // calculate light attenuation in layer 1 (0-5 m)
-    for(z=1;z<=ires;z++){
-      Iz=irr_surf*exp(-k[0]*((z-0.5)*5/30));
-      psi3l+=Iz/(Iz+IHCA);
-    } 
-    // calculate light attenuation in layer 2 (5-23 m)
-    for(z=ires+1;z<=30;z++){
-      Iz=irr_surf*exp(-5*k[0])*exp(-k[1]*((z-0.5)*d/30));
-      psi3l+=Iz/(Iz+IHCA);
-    }
-  }
-  //case 3: M>23
-  if(d>23){
-    res1 = (30/d)*5;    // number of intervals in the first layer
-    res2 = (30/d)*18;   // number of intervals in the second layer
-    ires1 = (int) res1; // take the integer part of res1
-    ires2 = (int) res2; // take the integer part of res2
-    // calculate light attenuation in layer 1 (0-5 m)
-    for(z=1;z<=ires1;z++){
-      Iz=irr_surf*exp(-k[0]*((z-0.5)*5/30));
-      psi3l+=Iz/(Iz+IHCA);
-    } 
-    // calculate light attenuation in layer 2 (5-23 m)
-    for(z=ires1+1;z<=ires2;z++){
-      Iz=irr_surf*exp(-5*k[0])*exp(-k[1]*((z-0.5)*23/30));
-      psi3l+=Iz/(Iz+IHCA);     
-    }
-    // calculate light attenuation in layer 3 (23-60 m)
-    for(z=ires2+1;z<=30;z++){
-      Iz=irr_surf*exp(-5*k[0])*exp(-18*k[1])*exp(-k[2]*((z-0.5)*d/30));
-      psi3l+=Iz/(Iz+IHCA);      
-    }
-  }
-  psi3l=psi3l/30.0;
+  if(irr_surf<=0.0) return;  // night
 
-  // --- Two waveband approximation ---
-  
-  for(z=1;z<=30;z++){
-    Iz2=0.5*irr_surf*(exp(-(KGR + KSS*chloro/1.9875)*((z-0.5)*(d/30.0))) +  //1.9875 makes Chl in mmol/m3
-		      exp(-(KRE + KSS*chloro/1.9875)*((z-0.5)*(d/30.0)))); 
-    psi2w+=Iz2/(Iz2+IHCA);
-  }
-  psi2w=psi2w/30.0;
-  
-  
-  // --- Single waveband approximation ---
-  
-  for(z=1;z<=30;z++){
-    Iz1=irr_surf*exp(-(KW + KSS*chloro/1.9875)*((z-0.5)*(d/30.0)));  //1.9875 makes Chl in mmol/m3 
-    psi1w+=Iz1/(Iz1+IHCA);
-  }
-  psi1w=psi1w/30.0;
-  
- 
-  // ==== Return - only to calcification ====
+  get_attenuation(chloro,k);
 
-  return psi3l;     // Michaelis-Menten's fashion
+#ifdef LIGHT_ANALYTIC
+  double Ib[4], kl[3];
+  int nl=get_light_layers(irr_surf,chloro,d,k,Ib,kl);
 
+  lt->psi=get_light_average(nl,Ib,kl,d,is,IHD);        // all but Ehux
+  lt->psieh=get_light_average(nl,Ib,kl,d,iseh,IHEH);    // Ehux
+  lt->psica=get_mm_average(nl,Ib,kl,d,IHCA);            // calcification (Michaelis-Menten)
+#else
+  get_light_profile(irr_surf,chloro,d,k,Iz);
 
+  for(z=0;z<30;z++){
+    lt->psi+=get_light_response(Iz[z],is,IHD);        // all but Ehux
+    lt->psieh+=get_light_response(Iz[z],iseh,IHEH);   // Ehux
+    lt->psica+=Iz[z]/(Iz[z]+IHCA);                    // calcification (Michaelis-Menten)
+  }
+  lt->psi=lt->psi/30.0;
+  lt->psieh=lt->psieh/30.0;
+  lt->psica=lt->psica/30.0;
+#endif
 
-  // ==============================
+  // light at 5 m, as in get_light_intensity
+  lt->li=irr_surf*exp(-k[0]*5);
 }
 
 
@@ -691,28 +661,11 @@ double get_averaged_light_cal(double irr_surf, double chloro, double d) //with I
 
 double get_light_intensity(double s_irrad, double chl){
 
-  int i=0;
-  int j=0;
-  
   double f=0.0;         // irradiance calculate at depth z
 
-  double c=0.0;         // square root of pigment concentration
-  
   double k[3]={0.0, 0.0, 0.0};  // attenuation coefficients
-  
-  double b[3][6] = {
-    {0.13096, 0.030969, 0.042644, -0.013738, 0.0024617, -0.00018059},
-    {0.041025, 0.036211, 0.062297, -0.030098, 0.0062597, -0.00051944},
-    {0.021517, 0.050150, 0.058900, -0.040539, 0.0087586, -0.00049476},
-  };
 
-  c=sqrt(chl); // chloro is = to G in Tom's model. sqrt is to ensure a bias 
-               // toward smaller values (more frequent in nature)
- 
-  // calculate att. coeff. for the three layers (k1, k2, k3) 
-  for(i=0;i<3;i++){
-    for(j=0;j<6;j++) k[i]+=b[i][j]*pow(c,j);      
-  }
+  get_attenuation(chl,k);
 
   // calculate light attenuation in layer 1 (0-5 m) at 5 m
   f=s_irrad*exp(-k[0]*5);
@@ -723,6 +676,196 @@ double get_light_intensity(double s_irrad, double chl){
   
   
 
+//============================ LIGHT LIMITATION TABLE ==================================
+
+
+// psi, psieh, psica and li (as from get_light_limitation) tabulated on a
+// regular grid of surface irradiance (0-LTIMAX), square root of chlorophyll
+// (0-sqrt(LTCMAX), the attenuation coefficients are polynomials in it) and
+// MLD (LTDMIN-LTDMAX), and interpolated trilinearly. The table is built once
+// by set_light_table (or loaded from its cache file) before the run and is
+// only read afterwards, so it can be shared by any number of runs.
+// Points outside of the grid are calculated with get_light_limitation.
+
+static double *ltpsi, *ltpsieh, *ltpsica, *ltli;  // the table, [LTNI][LTNC][LTND]
+
+static double lterr[3];  // max error of psi, psieh, psica against get_averaged_light*
+
+#define LTSIZE (LTNI*LTNC*LTND)
+#define LTPAR 17         // number of values in the header of the cache file
+
+
+// grid values at nodes (i, j, l)
+
+static double lt_irr(int i){ return LTIMAX*i/(LTNI-1.0); }
+static double lt_chl(int j){ double c=sqrt(LTCMAX)*j/(LTNC-1.0); return c*c; }
+static double lt_mld(int l){ return LTDMIN+(LTDMAX-LTDMIN)*l/(LTND-1.0); }
+
+
+// header of the cache file: resolution, ranges and everything the light
+// limitation depends on, so that a stale cache is never used
+
+static void lt_header(double par[LTPAR])
+{
+  par[0]=LTNI;   par[1]=LTNC;   par[2]=LTND;
+  par[3]=LTIMAX; par[4]=LTCMAX; par[5]=LTDMIN; par[6]=LTDMAX;
+  par[7]=LIGHT_PROFILE; par[8]=LIGHT_RESPONSE; par[9]=LIGHT_INTEGRATION;
+  par[10]=ISAT;  par[11]=ISATEH; par[12]=IHD; par[13]=IHEH; par[14]=IHCA;
+  par[15]=KSS;   par[16]=KW;
+}
+
+
+// load the table from 'cache' if it matches the current settings, otherwise
+// build it, estimate its error and save it to 'cache'
+
+void set_light_table(const char *cache)
+{
+  int i,j,l,n;
+  light lt;
+
+  double par[LTPAR], cpar[LTPAR];
+
+  ltpsi=dvector(0,LTSIZE-1);
+  ltpsieh=dvector(0,LTSIZE-1);
+  ltpsica=dvector(0,LTSIZE-1);
+  ltli=dvector(0,LTSIZE-1);
+
+  lt_header(par);
+
+  // === try the cache file first ===
+  ifstream in(cache, ios::in | ios::binary);
+  if(in){
+    in.read((char*)cpar,sizeof(cpar));
+    for(n=0;n<LTPAR;n++) if(!in || cpar[n]!=par[n]) break;
+    if(n==LTPAR){
+      in.read((char*)lterr,sizeof(lterr));
+      in.read((char*)ltpsi,LTSIZE*sizeof(double));
+      in.read((char*)ltpsieh,LTSIZE*sizeof(double));
+      in.read((char*)ltpsica,LTSIZE*sizeof(double));
+      in.read((char*)ltli,LTSIZE*sizeof(double));
+      if(in){
+	cout<<" light table loaded from "<<cache<<endl;
+	cout<<"   max error psi "<<lterr[0]<<", psieh "<<lterr[1]<<", psica "<<lterr[2]<<endl;
+	return;
+      }
+    }
+    in.close();
+  }
+
+  // === build the table ===
+  cout<<" building light table ("<<LTNI<<" x "<<LTNC<<" x "<<LTND<<")"<<endl;
+
+  n=0;
+  for(i=0;i<LTNI;i++){
+    for(j=0;j<LTNC;j++){
+      for(l=0;l<LTND;l++){
+	get_light_limitation(lt_irr(i),lt_chl(j),lt_mld(l),ISAT,ISATEH,&lt);
+	ltpsi[n]=lt.psi;
+	ltpsieh[n]=lt.psieh;
+	ltpsica[n]=lt.psica;
+	ltli[n]=lt.li;
+	n++;
+      }
+    }
+  }
+
+  // max error, at the centre of the cells (worst case for linear interpolation)
+  double e, c, d;
+  lterr[0]=lterr[1]=lterr[2]=0.0;
+  for(i=0;i<LTNI-1;i++){
+    for(j=0;j<LTNC-1;j++){
+      for(l=0;l<LTND-1;l++){
+	e=0.5*(lt_irr(i)+lt_irr(i+1));
+	c=0.5*(sqrt(lt_chl(j))+sqrt(lt_chl(j+1)));
+	d=0.5*(lt_mld(l)+lt_mld(l+1));
+	get_light_table(e,c*c,d,&lt);
+	lterr[0]=max(lterr[0],fabs(lt.psi-get_averaged_light(e,c*c,d)));
+	lterr[1]=max(lterr[1],fabs(lt.psieh-get_averaged_light_eh(e,c*c,d)));
+	lterr[2]=max(lterr[2],fabs(lt.psica-get_averaged_light_cal(e,c*c,d)));
+      }
+    }
+  }
+  cout<<"   max error psi "<<lterr[0]<<", psieh "<<lterr[1]<<", psica "<<lterr[2]<<endl;
+
+  // === save it ===
+  ofstream out(cache, ios::out | ios::binary);
+  if(!out){
+    cout<<" Impossible to write light table to "<<cache<<"\n";
+    return;
+  }
+  out.write((char*)par,sizeof(par));
+  out.write((char*)lterr,sizeof(lterr));
+  out.write((char*)ltpsi,LTSIZE*sizeof(double));
+  out.write((char*)ltpsieh,LTSIZE*sizeof(double));
+  out.write((char*)ltpsica,LTSIZE*sizeof(double));
+  out.write((char*)ltli,LTSIZE*sizeof(double));
+  out.close();
+}
+
+
+void free_light_table(void)
+{
+  free_dvector(ltpsi,0,LTSIZE-1);
+  free_dvector(ltpsieh,0,LTSIZE-1);
+  free_dvector(ltpsica,0,LTSIZE-1);
+  free_dvector(ltli,0,LTSIZE-1);
+}
+
+
+// light limitation terms from the table (as get_light_limitation)
+
+void get_light_table(double irr_surf, double chloro, double d, light *lt)
+{
+  int i,j,l;
+  double fi,fj,fl;   // position within the cell (0-1)
+  double x;
+
+  if(irr_surf<=0.0){  // night
+    lt->psi=lt->psieh=lt->psica=lt->li=0.0;
+    return;
+  }
+  if(irr_surf>LTIMAX || chloro>LTCMAX || chloro<0.0 || d<LTDMIN || d>LTDMAX){
+    get_light_limitation(irr_surf,chloro,d,ISAT,ISATEH,lt);
+    return;
+  }
+
+  x=irr_surf/LTIMAX*(LTNI-1);
+  i=(int)x; if(i>LTNI-2) i=LTNI-2;
+  fi=x-i;
+
+  x=sqrt(chloro/LTCMAX)*(LTNC-1);
+  j=(int)x; if(j>LTNC-2) j=LTNC-2;
+  fj=x-j;
+
+  x=(d-LTDMIN)/(LTDMAX-LTDMIN)*(LTND-1);
+  l=(int)x; if(l>LTND-2) l=LTND-2;
+  fl=x-l;
+
+  // weights of the 8 corners
+  double w[8];
+  int o[8];
+  int n0=(i*LTNC+j)*LTND+l;
+
+  w[0]=(1-fi)*(1-fj)*(1-fl); o[0]=n0;
+  w[1]=(1-fi)*(1-fj)*fl;     o[1]=n0+1;
+  w[2]=(1-fi)*fj*(1-fl);     o[2]=n0+LTND;
+  w[3]=(1-fi)*fj*fl;         o[3]=n0+LTND+1;
+  w[4]=fi*(1-fj)*(1-fl);     o[4]=n0+LTNC*LTND;
+  w[5]=fi*(1-fj)*fl;         o[5]=n0+LTNC*LTND+1;
+  w[6]=fi*fj*(1-fl);         o[6]=n0+LTNC*LTND+LTND;
+  w[7]=fi*fj*fl;             o[7]=n0+LTNC*LTND+LTND+1;
+
+  lt->psi=lt->psieh=lt->psica=lt->li=0.0;
+  for(int m=0;m<8;m++){
+    lt->psi+=w[m]*ltpsi[o[m]];
+    lt->psieh+=w[m]*ltpsieh[o[m]];
+    lt->psica+=w[m]*ltpsica[o[m]];
+    lt->li+=w[m]*ltli[o[m]];
+  }
+}
+
+
+
 //================================= MINIMUM ROUTINE ====================================
 
 
@@ -812,23 +955,22 @@ double get_co2_solubility(double sa, double te)
 // Or look at the routine: '/users/phd/am1/model/14c/carbof/pco2.f'
 //
 //
-// Output flags:
-//    r=1 -> get pCO2 in seawater
-//    r=2 -> get [CO3]
-//    r=3 -> get omega calcite
-//    r=4 -> get omega aragonite
-//    r=5 -> get pH
-//    r=6 -> get [HCO3-]
-//    r=7 -> get [Co2(aq)]
+// The calculation is split in two parts:
+//  - get_carbonate_constants: all the constants that depend on temperature
+//    and salinity only (dissociation constants, solubilities, pressure
+//    corrections). These can be computed once for each hour of the forcing.
+//  - get_carbonate_species: the [H+] iteration and the species, given 
+//    alkalinity, TCO2 and silicate and the constants above.
 //
-//                     salinity  temperature alkalinity    TCO2    silicate  output flag
-double get_param_water(double sa, double te, double al, double co, double si, int r)
+// get_carbonate_system does both.
+
+
+//                         salinity   temperature    output
+void get_carbonate_constants(double sa, double te, carbconst *kk)
 {
 
   double tek=0.0;
 
-  double pco2=0.0;  // output of this function: pCO2
-
   double kc1, kc2, kb, kp1, kp2, kp3, kw; 
   kc1=kc2=kb=kp1=kp2=kp3=kw=0.0;
   
@@ -836,23 +978,10 @@ double get_param_water(double sa, double te, double al, double co, double si, in
 
   double fh=0.0;
 
-  double ah1=0.0;
-
-  double ac,ab,as,ap,aw;
-  ab=as=ap=aw=0.0;
-  
-  double talk=0.0;
-
   double cp=0.0;
   double prat=0.0;
   double z=3.0;   // depth (to take into account effects of pressure on solubility)
 
-  // get the proper units for calculations 
-  al=al*1.0e-6;   // Eq m-3
-  si=si*1.0e-6;   // mol m-3
-  double po=0.0;  // mol m-3
-  co=co*1.0e-6;   // mol m-3
-
   tek=te+273.15;        // temperature in K
   double pres = z/10.0; // pressure in bar
 
@@ -880,8 +1009,7 @@ double get_param_water(double sa, double te, double al, double co, double si, in
   kb = kb*prat;
 
   // computing - dissociation constants for silicic acid (PENG87)
-  static double ks;
-  ks = 1.0e-10;
+  // ks = 1.0e-10 is used directly in get_carbonate_species
 
   // computing - dissociation constants for phosphoric acid, kp2 and kp3 only
   kp2 = exp(-9.039 - 1450.0/tek);
@@ -897,13 +1025,101 @@ double get_param_water(double sa, double te, double al, double co, double si, in
   // computing - total borate concentration (PENG87)
   bo = 4.106e-4*(sa/35);
 
-  double c1 = kc1/2.0;
-  double c2 = 1.0-4.0*kc2/kc1;
-  double c4 = bo*kb;
+  double khco2; // co2 solubility in seawater
 
-  double aht = 1.0e-8;
+  // calculate solubility of CO2 in seawater:  kco2  using the formulation of
+  // Weiss (1974, Marine Chem., 2, 203-215) in mol kg-1 atm-1
+  // (Edmond and Geiskes, as in Stumm and Morgan p 204, is no longer used)
+  khco2 = exp(-60.2409 + 9345.17/tek + 23.3585*log(tek/100.0) + 
+              sa*(0.023517 - 2.3656e-4*tek + 4.7036e-7*tek*tek));
+
+  double rr = 83.143;       // cm3 bar K-1 mol-1 (ideal gas const.: R = 8.314 J mol-1 K-1)
+
+  // calculate [ca++] from Millero pag. 270, eq. 127
+  double calcium = 0.01028*(sa/35.0); 
+
+  // calculate omega-calcite and omega-aragonite (from Mucci 1983, see also Millero pag. 249)
+  double lnksp0cal = -395.8293 + 6537.773/tek + 71.595*log(tek) - 0.17959*tek;
+  double lnksp0arag = -395.9180 + 6685.079/tek + 71.595*log(tek) - 0.17959*tek;
+ 
+  double kcal = exp(lnksp0cal + (-1.78938 + 410.64/tek + 0.0065453*tek)*sqrt(sa) -
+		           0.17755*sa + 0.0094979*pow(sa,1.5));
+
+  double karag = exp(lnksp0arag + (-0.157481 + 202.938/tek + 0.0039780*tek)*sqrt(sa) -
+	                     0.23067*sa + 0.0136808*pow(sa,1.5));
+
+  double saltrat = sqrt(sa)/sqrt(35.0);
+
+  // calcite volume correction
+  double dvc = -45.464 + 0.3529*te - 4.985*te*te*pow(10,-3.0)*saltrat;        
+  // calcite compressibility correction
+  double dkc = (-13.70 + 0.1245*te + 0.0*te*te*pow(10,-3.0))*pow(10,-3.0)*saltrat;
+  // aragonite volume correction
+  double dva = -42.680 + 0.3529*te - 4.985*te*te*pow(10,-3.0)*saltrat;
+  // aragonite compressibility correction
+  double dka = (-13.70 + 0.1245*te + 0.0*te*te*pow(10,-3.0))*pow(10,-3.0)*saltrat;
+  
+  // Millero's book, pag 249
+  //double dvc = -48.76 + 0.5302*te;
+  //double dkc = (-11.76 + 0.3692*te)/1000;
+  //double dva = -46.0 + 0.5304*te;
+  //double dka = (-11.76 + 0.3692*te)/1000;
+
+  kcal = kcal*exp(-dvc*cp + 0.5*dkc*(pres*pres)/rr/tek);
+  karag = karag*exp(-dva*cp + 0.5*dka*(pres*pres)/rr/tek);
+
+  kk->kc1=kc1;
+  kk->kc2=kc2;
+  kk->kb=kb;
+  kk->kp2=kp2;
+  kk->kp3=kp3;
+  kk->kw=kw;
+  kk->fh=fh;
+  kk->bo=bo;
+  kk->kh=khco2;
+  kk->kcal=kcal/calcium;   // omega = [CO3=]/kcal
+  kk->karag=karag/calcium; // omega = [CO3=]/karag
+}
+
+
+// The [H+] iteration is selected with HSOLVER in param.h, and cs->ah must 
+// be set before the call: 0.0 for a cold start, or the value left by the 
+// previous call.
+//
+//                         alkalinity    TCO2      silicate   constants         output
+void get_carbonate_species(double al, double co, double si, const carbconst *kk, carbonate *cs)
+{
+
+  double pco2=0.0;  // pCO2
+
+  double kc1=kk->kc1;
+  double kc2=kk->kc2;
+  double kb=kk->kb;
+  double kp2=kk->kp2;
+  double kp3=kk->kp3;
+  double kw=kk->kw;
+  double fh=kk->fh;
+  double bo=kk->bo;
+
+  double ah1=0.0;
+
+  double ac,ab,as,ap,aw;
+  ab=as=ap=aw=0.0;
+
+  // get the proper units for calculations 
+  al=al*1.0e-6;   // Eq m-3
+  si=si*1.0e-6;   // mol m-3
+  double po=0.0;  // mol m-3
+  co=co*1.0e-6;   // mol m-3
 
   int icnt=1;
+  int hfail=0;
+
+#if HSOLVER==0
+
+  double c1 = kc1/2.0;
+  double c2 = 1.0-4.0*kc2/kc1;
+  double aht = 1.0e-8;
 
   // computing the several alkalinity species iteratively 
   // starting with an initial 'aht' trial value
@@ -926,90 +1142,123 @@ double get_param_water(double sa, double te, double al, double co, double si, in
 
   }
 
-  double co3 = (ac - co)/(1.0 - (ah1*ah1)/(kc1*kc2));
-  double hco3 = co/(1.0 + ah1/kc1 + kc2/ah1);
-  double co2 = co/(1.0 + kc1/ah1 + kc1*kc2/(ah1*ah1));
+#else
 
-  double Is;
-  double khco2; // co2 solubility in seawater
+  // solving the total alkalinity equation f(H+) = 0 with Newton's method,
+  // f(H+) = carbonate + borate + silicate + phosphate + water alkalinity - al.
+  // f is monotonically decreasing in H+, the step is only safeguarded to
+  // keep H+ positive. The iteration is warm-started from the [H+] of the 
+  // previous call stored in 'cs' (1.0e-8 if none). The derivative of the
+  // phosphate term is neglected ('po' is zero here)
+  double aht = (cs->ah > 0.0) ? cs->ah : 1.0e-8;
+  double dd, fa, dfa, dah;
 
-  // saturation of CO2, from Edmond and Geiskes (Stumm and Morgan p 204)
-  Is = 0.00147 + 0.03592*sa/2.0 + .000068*(sa/2.0)*(sa/2.0);
-  khco2 = -2385.73/tek + 14.0184 - 0.0152642*tek + Is*(0.28596 - 6.167e-4*tek);
-  
-  khco2 = pow(10,-khco2);    // Kh = { HCO3* } / pCO2
+  do{
 
-  // calculate solubility of CO2 in seawater:  kco2  using the formulation of
-  // Weiss (1974, Marine Chem., 2, 203-215) in mol kg-1 atm-1
-  khco2 = exp(-60.2409 + 9345.17/tek + 23.3585*log(tek/100.0) + 
-              sa*(0.023517 - 2.3656e-4*tek + 4.7036e-7*tek*tek));
+    dd = aht*aht + kc1*aht + kc1*kc2;
 
-  
-  double atm = PCO2A/1.0e6;         // pCO2(air) in atm
-  double satco2 = khco2*atm*1000.0; // in mol m-3
+    ab = bo*kb/(aht + kb);                          // borate alkalinity
+    as = si*4*1.0e-10/(aht + 4*1.0e-10);            // silicate alkalinity
+    ap = po*(1/(1 + kp2/aht + kp2*kp3/(aht*aht)) +  // phosphate alkalinity 
+	     2/(1 + aht/kp2 + kp3/aht) + 
+	     3/(1 + aht/kp3 + aht*aht/kp2*kp3));
+    aw = (kw*fh/aht) - (aht/fh);                    // water alkalinity
 
-  // calculate Steady State pCO2
-  pco2 = co2/khco2;                 // in atm
+    fa = co*kc1*(aht + 2.0*kc2)/dd + ab + as + ap + aw - al;
 
-  //calculate h2co3
-  double h2co3 = khco2*pco2;
+    dfa = - co*kc1*(aht*aht + 4.0*kc2*aht + kc1*kc2)/(dd*dd) 
+          - bo*kb/((aht + kb)*(aht + kb)) 
+          - si*4*1.0e-10/((aht + 4*1.0e-10)*(aht + 4*1.0e-10)) 
+          - kw*fh/(aht*aht) - 1.0/fh;
 
-  // calcite solubility, from Sayles 1980
-  double kprime = 4.75e-7;  // mol2 kg-2
-  double delv = -44.0;      // cm3 mol-1
-  double rr = 83.143;       // cm3 bar K-1 mol-1 (ideal gas const.: R = 8.314 J mol-1 K-1)
-  double dk = -0.0133;      // cm3 bar-1 mol-1
-  double kpres = log(10.0);
-  kpres = log(kprime) - delv/(rr*tek)*(pres) + 0.5*dk/(rr*tek)*pres*pres;
-  kpres = exp(kpres);
-  double csat = kpres/0.01;  
+    dah = -fa/dfa;
+    if(aht + dah <= 0.0) dah = -0.9*aht;            // keep H+ positive
+    aht += dah;
+
+    icnt++;
+
+  } while(fabs(dah) > HTOL*aht && icnt <= HITMAX);
+
+  hfail = (fabs(dah) > HTOL*aht);                  // stopped by HITMAX
+  ah1 = aht;
+
+  ab = bo*kb/(ah1 + kb);
+  as = si*4*1.0e-10/(ah1 + 4*1.0e-10);
+  ap = po*(1/(1 + kp2/ah1 + kp2*kp3/(ah1*ah1)) + 
+	   2/(1 + ah1/kp2 + kp3/ah1) + 
+	   3/(1 + ah1/kp3 + ah1*ah1/kp2*kp3));
+  aw = (kw*fh/ah1) - (ah1/fh);
+
+  ac = al - ab - as - ap - aw;                      // carbonate alkalinity
+
+#endif
+
+  cs->ah = ah1;          // [H+] for warm-starting the next call
+  cs->niter = icnt-1;    // number of iterations used
+  cs->hfail = hfail;     // to be reported by the caller
+
+  double co3 = (ac - co)/(1.0 - (ah1*ah1)/(kc1*kc2));
+  double hco3 = co/(1.0 + ah1/kc1 + kc2/ah1);
+  double co2 = co/(1.0 + kc1/ah1 + kc1*kc2/(ah1*ah1));
+
+  // calculate Steady State pCO2
+  pco2 = co2/kk->kh;                // in atm
 
   double pH;
   double hplus = kc2*hco3/co3;
   pH = -log(hplus)/2.303;
 
-  // calculate [ca++] from Millero pag. 270, eq. 127
-  double calcium = 0.01028*(sa/35.0); 
+  cs->pco2=pco2;                // pCO2 in atm
+  cs->co3=co3*1.0e6;            // [CO3=] in umol kg-1
+  cs->ocal=co3/kk->kcal;        // omega calcite
+  cs->oara=co3/kk->karag;       // omega aragonite
+  cs->ph=pH;                    // pH
+  cs->hco3=hco3*1.0e6;          // [HCO3-] in umol kg-1
+  cs->co2=co2*1.0e6;            // [CO2(aq)] in umol kg-1
+}
 
-  // calculate omega-calcite and omega-aragonite (from Mucci 1983, see also Millero pag. 249)
-  double lnksp0cal = -395.8293 + 6537.773/tek + 71.595*log(tek) - 0.17959*tek;
-  double lnksp0arag = -395.9180 + 6685.079/tek + 71.595*log(tek) - 0.17959*tek;
- 
-  double kcal = exp(lnksp0cal + (-1.78938 + 410.64/tek + 0.0065453*tek)*sqrt(sa) -
-		           0.17755*sa + 0.0094979*pow(sa,1.5));
 
-  double karag = exp(lnksp0arag + (-0.157481 + 202.938/tek + 0.0039780*tek)*sqrt(sa) -
-	                     0.23067*sa + 0.0136808*pow(sa,1.5));
+// The whole system is solved once and all the species are returned
+// together in 'cs' (see struct carbonate in param.h), cs->ah as in
+// get_carbonate_species.
+//
+//                          salinity  temperature alkalinity    TCO2      silicate   output
+void get_carbonate_system(double sa, double te, double al, double co, double si, carbonate *cs)
+{
+  carbconst kk;
 
-  double saltrat = sqrt(sa)/sqrt(35.0);
+  get_carbonate_constants(sa,te,&kk);
+  get_carbonate_species(al,co,si,&kk,cs);
+}
 
-  // calcite volume correction
-  double dvc = -45.464 + 0.3529*te - 4.985*te*te*pow(10,-3.0)*saltrat;        
-  // calcite compressibility correction
-  double dkc = (-13.70 + 0.1245*te + 0.0*te*te*pow(10,-3.0))*pow(10,-3.0)*saltrat;
-  // aragonite volume correction
-  double dva = -42.680 + 0.3529*te - 4.985*te*te*pow(10,-3.0)*saltrat;
-  // aragonite compressibility correction
-  double dka = (-13.70 + 0.1245*te + 0.0*te*te*pow(10,-3.0))*pow(10,-3.0)*saltrat;
-  
-  // Millero's book, pag 249
-  //double dvc = -48.76 + 0.5302*te;
-  //double dkc = (-11.76 + 0.3692*te)/1000;
-  //double dva = -46.0 + 0.5304*te;
-  //double dka = (-11.76 + 0.3692*te)/1000;
 
-  kcal = kcal*exp(-dvc*cp + 0.5*dkc*(pres*pres)/rr/tek);
-  karag = karag*exp(-dva*cp + 0.5*dka*(pres*pres)/rr/tek);
+// Single parameter version of get_carbonate_system (kept for compatibility).
+//
+// Output flags:
+//    r=1 -> get pCO2 in seawater
+//    r=2 -> get [CO3]
+//    r=3 -> get omega calcite
+//    r=4 -> get omega aragonite
+//    r=5 -> get pH
+//    r=6 -> get [HCO3-]
+//    r=7 -> get [Co2(aq)]
+//
+//                     salinity  temperature alkalinity    TCO2    silicate  output flag
+double get_param_water(double sa, double te, double al, double co, double si, int r)
+{
+  carbonate cs;
+
+  cs.ah=0.0;  // cold start
+  get_carbonate_system(sa,te,al,co,si,&cs);
 
-  double omega_cal = (calcium*co3)/kcal;
-  double omega_arag = (calcium*co3)/karag;
+  if(r==1) return cs.pco2;      // return pCO2 in atm
+  if(r==2) return cs.co3;       // return [CO3=] in umol kg-1
+  if(r==3) return cs.ocal;      // return omega calcite
+  if(r==4) return cs.oara;      // return omega aragonite
+  if(r==5) return cs.ph;        // return pH
+  if(r==6) return cs.hco3;      // return [HCO3-] in umol kg-1
+  if(r==7) return cs.co2;       // return [CO2(aq)] in umol kg-1
 
-  if(r==1) return pco2;         // return pCO2 in atm
-  if(r==2) return co3*1.0e6;    // return [CO3=] in umol kg-1
-  if(r==3) return omega_cal;    // return omega calcite
-  if(r==4) return omega_arag;   // return omega aragonite
-  if(r==5) return pH;           // return pH
-  if(r==6) return hco3*1.0e6;   // return [HCO3-] in umol kg-1
-  if(r==7) return co2*1.0e6;    // return [CO2(aq)] in umol kg-1
+  return 0.0;
 }
 
@@ -29,14 +29,19 @@
 //                nrutil.cc 
 //
 //  EXAMPLE: 
-//  to compile type:  g++ succession4new.cc routines.cc nrutil.cc -o a.out -Wno-deprecated
+//  to compile type:  g++ succession4new.cc routines.cc nrutil.cc -o a.out -Wno-deprecated -pthread
 //  to run type:      ./a.out 
+//  or, for an ensemble of parameter sets (see ENSEMBLE below):
+//                    ./a.out ensemble.in [number of threads]
+//  or, to convert the input files to the binary FORCING, mapped instead of parsing them:
+//                    ./a.out -convert
 //
 //
 //  INPUT FILES:  mldXX.in (or mldnew.dat for 'Fasham-modified' MLD) 
 //                sstXX.in 
 //                winXX.in
 //                sal.in
+//                (or all of them in forcing.bin, see FORCING)
 // 
 //  HEADER FILES: param.h
 //                nrutil.h
@@ -45,6 +50,12 @@
 //  CRUCIAL PARAMETERS: Y    (number of years to run the model)
 //                      IGNY (number of initial years to ignore for steady-state)
 //                      HOFY (hour of the year to consider for poincare' sections)  
+//                      SSRTOL (change of the state over one year that ends the spin-up)
+//                      SHOOTING (1 to find the periodic state by Anderson mixing)
+//                      INTEGRATOR (1 fixed-step RK4, 2 adaptive Dormand-Prince,
+//                                  3 adaptive Rosenbrock for stiff conditions)
+//                      LANES (ensemble members integrated together with RK4)
+//                      CHECKPOINT (1 to reuse the spin-up of an earlier run)
 //
 //                      trans (set TRUE to look at transient results)
 //                            (set FALSE to look at steady-state results)
@@ -53,8 +64,26 @@
 #include <iostream.h>
 #include <fstream.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <charconv>
+#include <chrono>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
 #include "param.h"     // parameters and prototype functions
 #include "nrutil.h"    // required by function rk4
+#include "results.h"   // binary results file
 
 #define TRUE 1         // first year run
 #define FALSE 0        // after first year run
@@ -63,9 +92,21 @@
 #define STEP 366       // number of steps in integration
 
 #define Y 9            // number of years for which run the model (0 is one year cycle)
+#define NTY 7          // number of years of forcing from 1995 on at the end of a transient run (the
+                       // years before are spin-up), all of them in CATALOG
 
 #define IGNY 0         // number of years required by the model to reach equilibrium (spin-up)
 
+#define SSRTOL 1.0e-6  // relative change of the state between the start of two spin-up years below which
+                       // it is periodic, and the following spin-up years with the same forcing are skipped
+                       // (0 to integrate all the years)
+#define SSATOL 1.0e-9  // absolute change of the state added to SSRTOL for the variables near 0
+
+#define SHOOTING 0     // periodic state of a forcing repeated in the spin-up: 0 integrating its years,
+                       // 1 by Anderson mixing of the one-year iterates
+#define SHMAXY 60      // max number of one-year integrations of the shooting
+#define SHDEPTH 5      // number of iterates combined by Anderson mixing
+
 #define HOFY 4320      // hour of the year to consider for poincare' sections
 
 #define DSTEP 365      // number of steps [number of days in one year]
@@ -82,853 +123,578 @@
 #define TH 8761        // final time [hour]
 #define THH 17521      // final time [1/2 hour]
 
+#define INTEGRATOR 1   // 1 classical RK4 with a fixed step of one hour
+                       // 2 adaptive Dormand-Prince 5(4) with dense output at every hour
+                       // 3 adaptive Rosenbrock 4(3), linearly implicit, with Hermite output 
+#define ADATOL 1.0e-6  // absolute tolerance of the adaptive integrators
+#define ADRTOL 1.0e-5  // relative tolerance of the adaptive integrators
+#define ADH0 1.0       // first trial step of the adaptive integrators [hour]
+#define ADHMAX 24.0    // max step of the adaptive integrators [hour]
+#define ADHMIN 1.0e-6  // min step of the adaptive integrators [hour]
+
+#define CHECKPOINT 0   // 1 to save the state at the end of each spin-up year in CPDIR, and to start
+                       // from the last one saved by an earlier run with the same inputs (the results
+                       // files are then written only from that year on)
+#define CPDIR "./checkpoints" // directory of the checkpoints
+#define CPMAX 1000     // max number of checkpoints kept in CPDIR (the ones used least recently are removed)
+
+#define FORCING "./input/forcing.bin" // binary store of the forcing files, mapped instead of parsing
+                                      // the text files it holds (./a.out -convert makes it)
+#define CATALOG "./input/forcing.cat" // file of each variable of each year of forcing
+#define FCMAX 3        // max number of years of forcing held in memory, unless the runs use more (a year
+                       // is loaded when needed)
+#define FSAHEAD 2      // years of a multi-year forcing file held by its reader, which reads the next
+                       // ones while the run integrates the current one
+#define FTCACHE 0      // 1 to save the forcing table of each year in FTDIR, and to load it from there
+                       // when a later run has the same forcing for that year
+#define FTDIR "./tables" // directory of the forcing tables
+#define FTMAX 40       // max number of forcing tables kept in FTDIR (the ones used least recently are removed)
+#define FLTHREADS 4    // threads parsing text forcing files at the same time
+#define FLCHUNK 65536  // bytes read at a time from a multi-year text forcing file
+
+
+#define OBSIZE 65536   // bytes of the buffer of a results file, written when full by the writer thread
+#define NRCOL 40       // columns of the binary results file (rscol)
+#define OBQUEUE 64     // spare buffers, and max number of full buffers waiting for the writer thread
+
+
+#define NPAR 17        // number of run-time parameters (struct params)
+#define NSUM 18        // number of values in the summary of an ensemble member
+#define LANES 4        // ensemble members integrated together by the batched engine
+                       // (4 for AVX2, 8 for AVX-512, 1 to run them one by one with rkdriver)
+
+
+// ======== RUN-TIME PARAMETERS ========
+//
+// The parameters that an ensemble can change from one member to another.
+// They are the rates of param.h, given here in d-1 (not h-1) so that they
+// can be written as in the papers, and they are divided by 24 where used.
+// set_default_params gives the values of param.h.
+
+struct params {
+  double md, mf, mdf, meh;          // phytoplankton mortality (d-1), as MD, MF, MDF, MEH
+  double mzmi, mzme;                // zooplankton mortality (d-1), as MZMI, MZME
+  double zmid, zmif, zmie;          // microzoo max ingestion (d-1), as ZMID, ZMIF, ZMIE
+  double zmed, zmedf, zmemi;        // mesozoo max ingestion (d-1), as ZMED, ZMEDF, ZMEMI
+  double kmig, kmeg;                // grazing half saturation (mmol m-3), as KMIG, KMEG
+  double isat, isateh;              // saturating light (W m-2), as ISAT, ISATEH
+  double vdt;                       // detritus sinking (m d-1), as VDT
+};
+
+
+// ======== FORCING TABLE ========
+//
+// The terms of set_forcing and derivs that depend only on the forcing, at
+// each hour k of the year, as set_forcing gives them at the start of the
+// hour (f=0). A table is built once for each year of the catalog
+// (set_forcing_table) and shared by the models of all the runs that use
+// that year, which point to it. The exchange through the thermocline also
+// depends on the mixing of the run year, and is computed by set_forcing.
+
+struct forcing_table {
+  // carbonate system constants, gas transfer velocity and CO2 solubility
+  double kc1[HSTEP], kc2[HSTEP];
+  double kb[HSTEP];
+  double kp2[HSTEP], kp3[HSTEP];
+  double kw[HSTEP];
+  double fh[HSTEP];
+  double bo[HSTEP];
+  double kh[HSTEP];
+  double kcal[HSTEP];
+  double karag[HSTEP];
+  double gtv[HSTEP];
+  double co2sol[HSTEP];
+
+  double varT[HSTEP];  // growth limitation with temperature (EPPL72)
+  double varH[HSTEP];  // h(t)=dM/dt
+  double varHp[HSTEP]; // h+(t)=maximum(h(t), 0)
+  double mixed[HSTEP]; // M(t)
+  double esurf[HSTEP]; // light at surface
+};
+
+
+// ======== DIAGNOSTIC VARIABLES ========
+//
+// The groups of diagnostic variables of the model. A run lists the ones it
+// needs in model.diag (the ones read by its results files, as given by
+// get_output_diagnostics), and set_diagnostics computes only those.
 
-// ======== FUNCTIONS ======== 
+#define DGRAZ 1        // grazd, graze, diagra, dingra, flagra, ehugra, micgra
+#define DPROD 2        // regphypro, newphypro, reg*pro, regtest, totphypro, totzoopro, pon
+#define DLOSS 4        // totphyloss, totphymix, totzooloss
+#define DGROW 8        // *nutgro, *lightgro, callightgro, caltemgro
+#define DCALC 16       // calcieh, photoeh, ingDI
 
-void rkdriver(double vstart[], int nvar, double t1, double t2, int nstep, 
-	      void (*derivs)(double, double [], double []));
 
-void rk4(double y[], double dydt[], int n, double t, double h, double yout[], 
-	 void (*derivs)(double, double [], double []));
+// ======== MODEL STATE ========
+//
+// Everything a run changes while it is integrated: the forcing of the
+// current year, the terms passed from rkdriver to derivs, the diagnostic
+// variables set by set_diagnostics, the integrator workspace and the trajectory. 
+// Each run owns one and passes it to rkdriver, which passes it on to the
+// integrators and to derivs. The input forcing of all years (above), the
+// light table and the output files are shared by all runs.
 
-void derivs(double t, double y[], double dydt[]);
+struct model {
 
+  params par;        // parameters of the run
 
-// ===== GLOBAL VARIABLES =====
-           
-static int trans = TRUE; // set to TRUE  to look at transient results
-                         // set to FALSE to look at steady-state
+  int out;           // TRUE to write the results files and the progress
+  int diag;          // groups of diagnostic variables the run needs (DGRAZ...), computed
+                     // by set_diagnostics at the output instants only
 
-int yy;
+  int yy;            // actual year
 
-//double MEH=0.0;
+  // ==== forcing of the current year (in the catalog, shared by the runs) ====
 
-double ingEH=0.0;      // variable ingestion rate for Ehuxleyi (depends on omega)
-double ingDI=0.0;      // variable ingesiton rate for diatoms (depends on silicate)
+  const double *mld; // mixed layer depth variation
+  const double *mldo;// mixed layer depth
+  const double *tem; // temperature
+  const double *sir; // irradiance at surface
+  const double *wsp; // wind speed
+  const double *sal; // salinity
 
-double pon=0.0;          // particulate organic nitrogen  
-double photoeh=0.0;      // photosinthetic rate of Ehux
-double calcieh=0.0;      // calcification rate of Ehuc
-double newphypro=0.0;    // new primary production
+  const forcing_table *ftab; // terms of the forcing at each hour of the year, NULL before set_year
+
+  // ==== terms read by derivs ====
 
-double regphypro=0.0;    // regenerated primary production
-double regdiapro=0.0;    // regenerated diatoms primary production
-double regdinpro=0.0;    // regenerated dinofla primary production
-double regflapro=0.0;    // regenerated flagell primary production
-double regehupro=0.0;    // regenerated ehuxley primary production
-double regtest=0.0;
+  double diff;       // cross-termocline mixing rate
 
-double totphypro=0.0;    // primary production as given by the phytoplankton growth term
-double totzoopro=0.0;    // total zooplankton biomass
-double totphyloss=0.0;   // total phytoplankton loss
-double totzooloss=0.0;   // total zooplankton loss
-double totphymix=0.0;    // total phytoplankton mixing
+  double nbo;
+  double sbo;
 
-double dianutgro=0.0;
-double dinnutgro=0.0;
-double flanutgro=0.0;
-double ehunutgro=0.0;
+  double varTeh;
+  double varT;
+  double varH;       // h(t)=d(mixed)/dt
+  double varHp;      // h+(t) = maximum(h(t), 0) as in FASH93
+  double exch;       // (diff+varHp)/mixed, exchange rate through the thermocline
 
-double dialightgro=0.0;
-double dinlightgro=0.0;
-double flalightgro=0.0;
-double ehulightgro=0.0;
+  double mixed;      // actual mixed layer depth as obtained from Levitus data
 
-double diagra=0.0;
-double dingra=0.0;
-double flagra=0.0;
-double ehugra=0.0;
-double micgra=0.0;
+  double esurf; 
 
-double callightgro=0.0;
-double caltemgro=0.0;
+  double ingEH;      // variable ingestion rate for Ehuxleyi (depends on omega)
 
-double grazd=0.0;        // microzoo grazing on diatoms
-double graze=0.0;        // microzoo grazing on Ehu
+  double gtv;        // gas transfer velocity
+  double co2sol;     // CO2 solubility in seawater
+  double pco2w;      // pCO2 in seawater
+  double co32;       // [CO3=] 
+  double o_cal;      // Omega calcite
+  double o_ara;      // Omega aragonite
+  double ph;         // pH
+  double bica;       // [HCO3-]
+  double co2aq;      // [CO2(aq)]
 
-double esurf=0.0; 
+  double psi;        // light limiting all phytoplankton
+  double psieh;      // light limiting Emiliania huxleyi
+  double psica;      // light limiting calcification
 
-double diff=0.0;   // cross-termocline mixing rate
+  double li;         // light at 5 m
 
-double nbo=0.0;
-double sbo=0.0;
+  carbonate carb;    // carbonate system of the last call of derivs_forced, its
+                     // [H+] is the first guess of the next call
 
-double **y, *tt;   // required by rkdriver, for communicating back with main
+  // ==== diagnostic variables set by set_diagnostics, by group ====
 
-double varTeh=0.0;
+  double ingDI;      // variable ingesiton rate for diatoms (depends on silicate)
 
-double varT=0.0;
-double varM=0.0;
-double varH=0.0;   // h+(t) = maximum(h(t), 0) as in FASH93, h(t) is d(mixed)/dt
+  double pon;        // particulate organic nitrogen  
+  double photoeh;    // photosinthetic rate of Ehux
+  double calcieh;    // calcification rate of Ehuc
+  double newphypro;  // new primary production
 
-double mixed=0.0;  // actual mixed layer depth as obtained from Levitus data
+  double regphypro;  // regenerated primary production
+  double regdiapro;  // regenerated diatoms primary production
+  double regdinpro;  // regenerated dinofla primary production
+  double regflapro;  // regenerated flagell primary production
+  double regehupro;  // regenerated ehuxley primary production
+  double regtest;
 
-double mld[HSTEP]; // mixed layer depth
-double mldo[HSTEP];
+  double totphypro;  // primary production as given by the phytoplankton growth term
+  double totzoopro;  // total zooplankton biomass
+  double totphyloss; // total phytoplankton loss
+  double totzooloss; // total zooplankton loss
+  double totphymix;  // total phytoplankton mixing
 
-double *mldp95, *mldp95o, *sstp95, *win94;   // forcing prior 1995
+  double dianutgro;
+  double dinnutgro;
+  double flanutgro;
+  double ehunutgro;
 
-double *mld95o, *mld96o, *mld97o, *mld98o, *mld99o, *mld00o, *mld01o;
+  double dialightgro;
+  double dinlightgro;
+  double flalightgro;
+  double ehulightgro;
 
-double *mld95, *mld96, *mld97, *mld98, *mld99, *mld00, *mld01;
-double *sst95, *sst96, *sst97, *sst98, *sst99, *sst00, *sst01;
-double *par95, *par96, *par97, *par98, *par99, *par00, *par01;
-double *win95, *win96, *win97, *win98, *win99, *win00, *win01;
+  double diagra;
+  double dingra;
+  double flagra;
+  double ehugra;
+  double micgra;
 
-double chltoc=0.0; // adaptive Chl:C ratio
+  double callightgro;
+  double caltemgro;
 
-double tem[HSTEP]; // temperature
-double sal[HSTEP]; // salinity
-double sir[HSTEP]; // irradiance at surface
-double wsp[HSTEP]; // wind speed
+  double grazd;      // microzoo grazing on diatoms
+  double graze;      // microzoo grazing on Ehu
 
-double gtv=0.0;    // gas transfer velocity
-double co2sol=0.0; // CO2 solubility in seawater
-double pco2w=0.0;  // pCO2 in seawater
-double co32=0.0;   // [CO3=] 
-double o_cal=0.0;  // Omega calcite
-double o_ara=0.0;  // Omega aragonite
-double ph=0.0;     // pH
-double bica=0.0;   // [HCO3-]
-double co2aq=0.0;  // [CO2(aq)]
+  // ==== integrators ====
 
-double psi=0.0;    // light limiting all phytoplankton
-double psieh=0.0;  // light limiting Emiliania huxleyi
-double psica=0.0;  // light limiting calcification
+  // state of the adaptive integrators, kept between calls of adapt_dense
+  struct {
+    double t, h;                     // time reached and next trial step
+    double y[NEQ+1], dydt[NEQ+1];    // state and its derivative at t
+    double told, hold;               // last accepted step, from told to told+hold
+    double r1[NEQ+1], r2[NEQ+1], r3[NEQ+1], r4[NEQ+1], r5[NEQ+1]; // dense output coefficients
+    double dfdy[NEQ+1][NEQ+1];       // Jacobian at t (Rosenbrock only) 
+    double dfdt[NEQ+1];              // and derivative with respect to time
+    int jac;                         // TRUE when dfdy and dfdt are up to date
+    long nacc, nrej;                 // accepted and rejected steps
+  } adapt;
 
-double li,gli,nc,gnc,glidf,gncdf,sc,gsc; 
+  long nrhs;         // number of evaluations of derivs
+  long nhfail;       // carbonate systems whose [H+] did not converge (HITMAX)
+  int nspin;         // number of spin-up years integrated
+  double ssd;        // change of the state over the last of them, relative to SSRTOL
 
-double ber=0.0;
-double los=0.0;
+  unsigned long cpkey[Y+1]; // checkpoint keys: cpkey[yy] identifies the state at the start of year yy
 
-double yi1,yi2,yi3,yi4,yi5,yi6,yi7,yi8,yi9,yi10,yi11,yi12,yi13,yi14;  // initial reservois' values 
+  // ==== results ====
 
+  double **y, *tt;   // trajectory of the current year, filled by rkdriver
 
-// open files for results
-ofstream outinf("./results/info.dat");
+  double nc, sc;     // nitrate and silicate at the last daily output
 
-// multi-year solution
-ofstream out1("./results/diato.dat");
-ofstream out2("./results/flage.dat");
-ofstream out3("./results/nitra.dat");
-ofstream out4("./results/silic.dat");
-ofstream out5("./results/mesoz.dat");
-ofstream out6("./results/detri.dat");
-ofstream out7("./results/micro.dat");
-ofstream out8("./results/dinof.dat");
-ofstream out9("./results/ehuxl.dat");
-ofstream out10("./results/ammon.dat");
-ofstream out11("./results/acocc.dat");
-ofstream out12("./results/fcocc.dat");
-ofstream out13("./results/tdic.dat");
-ofstream out14("./results/talk.dat");
-ofstream out15("./results/pco2.dat");
-ofstream out16("./results/co32.dat");
-ofstream out17("./results/ocal.dat");
-ofstream out18("./results/oara.dat");
-ofstream out19("./results/tzoop.dat");
-ofstream out20("./results/npratio.dat");
-
-ofstream outa("./results/tempd.dat");
-ofstream outb("./results/tempdf.dat");
-ofstream outc("./results/airr.dat"); 
-ofstream outd("./results/sirr.dat");
+  double yi[NEQ+1];  // initial reservois' values 
+};
 
-// one-year (last) solution
-ofstream outl("./results/dia_d.dat");
-ofstream outm("./results/fla_d.dat");
-ofstream outn("./results/nit_d.dat");
-ofstream outo("./results/mic_d.dat");
-ofstream outp("./results/din_d.dat");
-ofstream outq("./results/sil_d.dat");
-ofstream outr("./results/mes_d.dat");
-ofstream outs("./results/det_d.dat");
-ofstream outw("./results/ehu_d.dat");
-ofstream outx("./results/amm_d.dat");
-ofstream outf("./results/aco_d.dat");
-ofstream outg("./results/fco_d.dat");
-
-ofstream outcp("./results/diagnoST-PROVA.dat");
-ofstream outres("./results/resST-PROVA.dat");
-
-ofstream outt("./results/phy_d.dat");
-ofstream outu("./results/phyto.dat");
-ofstream outy("./results/tzo_d.dat");
-
-ofstream outv("./results/zp.dat");
-ofstream outz("./results/ehc_d.dat");
-
-ofstream outctochl("./results/cch_d.dat");
-ofstream outluce("./results/ali_d.dat");
-
-ofstream outdic("./results/dic_d.dat");
-ofstream outalk("./results/alk_d.dat");
-ofstream outpco("./results/pco_d.dat");
-ofstream outco3("./results/co3_d.dat");
-ofstream outoca("./results/oca_d.dat");
-ofstream outora("./results/oar_d.dat");
-ofstream outoph("./results/ph_d.dat");
-ofstream outobi("./results/bic_d.dat");
-
-
-ofstream outbe("./results/birth.dat");
-ofstream outlo("./results/loss.dat");
-
-ofstream outmi("./results/mixed.dat");
 
-//=================================== MAIN ======================================
+// ======== BATCH OF MEMBERS ========
+//
+// LANES ensemble members integrated in lockstep with RK4 by rkdriver_batch.
+// What differs between the members is stored as arrays over the lanes
+// (structure of arrays), so that the loops over the lanes of derivs_batch
+// and rk4_batch can be vectorised. The forcing is the same for all the
+// lanes: it is set in the model of lane 0 only. The right-hand side is
+// written once for N lanes (get_rhs): derivs calls it with the one lane of
+// a model, derivs_batch with the LANES of a batch.
+
+template<int N> struct lanes {
+  // parameters of each lane, as in params (d-1)
+  double md[N], mf[N], mdf[N], meh[N];
+  double mzmi[N], mzme[N];
+  double zmid[N], zmif[N], zmie[N];
+  double zmed[N], zmedf[N], zmemi[N];
+  double kmig[N], kmeg[N];
+  double vdt[N];
+
+  // terms read by the right-hand side that depend on the state of each lane
+  double psi[N];     // light limiting all phytoplankton
+  double psieh[N];   // light limiting Emiliania huxleyi
+  double psica[N];   // light limiting calcification
+  double pco2w[N];   // pCO2 in seawater
+};
+
+struct batch : lanes<LANES> {
+  model *m[LANES];   // model of each lane: trajectory and parameters (forcing in m[0])
+  carbonate carb[LANES]; // carbonate system, its [H+] is the first guess of the next hour
+};
+
+
+// ======== CHECKPOINT ========
+//
+// What a run carries from the end of a spin-up year to the next one, as
+// saved in CPDIR by put_checkpoint.
 
+struct checkpoint {
+  double v[NEQ+1];   // state at the start of the year
+  double ah;         // [H+] guess of rkdriver
+  double ahf;        // [H+] guess of derivs_forced (model.carb)
+  double ssd;        // change of the state over the year before (model.ssd)
+  int nspin;         // spin-up years integrated (model.nspin)
+};
 
-main()
-{
 
-  static int first_time = TRUE;  // for setting first year initial conditions
+// ======== RESULTS FILES ========
+//
+// The results files are written with << and endl as ofstreams, but into
+// a buffer of OBSIZE bytes in memory, and endl does not flush it. A full
+// buffer is queued to a writer thread, which writes it to its file while
+// the run goes on, and the last one is queued by close. The file goes on
+// in a spare buffer, and the writer gives the written ones back as
+// spares: OBQUEUE spares are allocated with the first file, and none in
+// the time loop. Both queues have a single producer and a single
+// consumer, and are lock-free: the run waits only when all the spares
+// are waiting to be written.
+
+struct out_chunk {
+  int fd;            // file
+  int last;          // TRUE to close the file once written
+  size_t n;          // bytes
+  char *b;           // buffer, a spare once written
+};
+
+struct out_writer {
+  out_chunk q[OBQUEUE];               // the queue, q[i%OBQUEUE]
+  std::atomic<unsigned> head, tail;   // next to write, next to queue
+  char *spare[OBQUEUE];               // written buffers, spare[i%OBQUEUE]
+  std::atomic<unsigned> shead, stail; // next to take, next to give back
+  std::atomic<int> stop;              // set when no more buffers will be queued
+  std::thread th;                     // started with the first file
+
+  ~out_writer();
+};
+
+class outbuf : public std::streambuf {
+public:
+  outbuf(const char *name);
+  ~outbuf();
+  void open();
+  void close();
+  int is_open(){ return fd>=0; }
+  outbuf *next;      // the results files, listed by their constructors
+protected:
+  int overflow(int c);
+  int sync();
+private:
+  const char *name;
+  int fd;
+  void put(int last);
+};
+
+class outfile : private outbuf, public std::ostream {
+public:
+  outfile(const char *name) : outbuf(name), std::ostream(this) {}
+  void open(){ outbuf::open(); clear(); }
+  void close(){ outbuf::close(); }
+  int is_open(){ return outbuf::is_open(); }
+};
 
 
-  // === LOAD INPUT FILES (MLD, TEMP, SAL, AND WIND SPEED VALUES) === 
+// ======== FUNCTIONS ======== 
 
-  int h=0;  
-  int hi=0;
-  
-  int t=0;
-
-  mldp95=dvector(1,HSTEP);
-  mldp95o=dvector(1,HSTEP);
-  sstp95=dvector(1,HSTEP);
-  win94=dvector(1,HSTEP);
-
-  mld95=dvector(1,HSTEP);
-  sst95=dvector(1,HSTEP);
-  par95=dvector(1,HSTEP);
-  win95=dvector(1,HSTEP);
-
-  mld96=dvector(1,HSTEP);
-  sst96=dvector(1,HSTEP);
-  par96=dvector(1,HSTEP);
-  win96=dvector(1,HSTEP);
-
-  mld97=dvector(1,HSTEP);
-  sst97=dvector(1,HSTEP);
-  par97=dvector(1,HSTEP);
-  win97=dvector(1,HSTEP);
-
-  mld98=dvector(1,HSTEP);
-  sst98=dvector(1,HSTEP);
-  par98=dvector(1,HSTEP);
-  win98=dvector(1,HSTEP);
-
-  mld99=dvector(1,HSTEP);
-  sst99=dvector(1,HSTEP);
-  par99=dvector(1,HSTEP);
-  win99=dvector(1,HSTEP);
-
-  mld00=dvector(1,HSTEP);
-  sst00=dvector(1,HSTEP);
-  par00=dvector(1,HSTEP);
-  win00=dvector(1,HSTEP);
-
-  mld01=dvector(1,HSTEP);
-  sst01=dvector(1,HSTEP);
-  par01=dvector(1,HSTEP);
-  win01=dvector(1,HSTEP);
-
-  mld95o=dvector(1,HSTEP);
-  mld96o=dvector(1,HSTEP);
-  mld97o=dvector(1,HSTEP);
-  mld98o=dvector(1,HSTEP);
-  mld99o=dvector(1,HSTEP);
-  mld00o=dvector(1,HSTEP);
-  mld01o=dvector(1,HSTEP);
-
-  //char mldp95f[20]=".input/mldnew2i.in";
-  //char sstp95f[20]=".input/tem.in";
-
-  char mldp95f[20]="./input/mldnew2i.in";
-  char sstp95f[20]="./input/tem.in";
-  char win94f[20]="./input/win94.in";
-
-
-  char mld95f[20]="./input/mld95i2.in";
-  char sst95f[20]="./input/sst95i.in";
-  char par95f[20]="./input/par95n.in";
-  char win95f[20]="./input/win95.in";
-
-  char mld96f[20]="./input/mld96i.in";
-  char sst96f[20]="./input/sst96i.in";
-  char par96f[20]="./input/par96n.in";
-  char win96f[20]="./input/win96.in";
-
-  char mld97f[20]="./input/mld97i2.in";
-  char sst97f[20]="./input/sst97i.in";
-  char par97f[20]="./input/par97n.in";
-  char win97f[20]="./input/win97.in";
-
-  char mld98f[20]="./input/mld98i.in";
-  char sst98f[20]="./input/sst98i.in";
-  char par98f[20]="./input/par98n.in";
-  char win98f[20]="./input/win98.in";
-
-  char mld99f[20]="./input/mld99i.in";
-  char sst99f[20]="./input/sst99i.in";
-  char par99f[20]="./input/par99n.in";
-  char win99f[20]="./input/win99.in";
-
-  char mld00f[20]="./input/mld00i.in";
-  char sst00f[20]="./input/sst00i.in";
-  char par00f[20]="./input/par00n.in";
-  char win00f[20]="./input/win00.in";
-
-  char mld01f[20]="./input/mld01i2.in";
-  char sst01f[20]="./input/sst01bi2.in";
-  char par01f[20]="./input/par01n.in";
-  char win01f[20]="./input/win01.in";
+void rkdriver(model *m, double vstart[], int nvar, double t1, double t2, int nstep, 
+	      void (*derivs)(model *, double, double [], double []));
+
+void rk4(model *m, double y[], double dydt[], int n, double t, double h, double yout[], 
+	 void (*derivs)(model *, double, double [], double []));
+
+void derivs(model *m, double t, double y[], double dydt[]);
+void set_diagnostics(model *m, const double y[]);
+int get_output_diagnostics(void);
+
+void set_forcing(model *m, int k, double f, double chlo, double alk, double tco2, double sil, carbonate *carb);
+void derivs_forced(model *m, double t, double y[], double dydt[]);
+
+void dopri5(model *m, double y[], double dydt[], int n, double t, double h, double yout[], 
+	    double dydtout[], double yerr[], void (*derivs)(model *, double, double [], double []));
+void rosenbrock(model *m, double y[], double dydt[], int n, double t, double h, double yout[], 
+		double dydtout[], double yerr[], void (*derivs)(model *, double, double [], double []));
+void jacobian(model *m, double t, double y[], double dydt[], int n, void (*derivs)(model *, double, double [], double []));
+void ludcmp(double a[][NEQ+1], int n, int indx[]);
+void lubksb(double a[][NEQ+1], int n, int indx[], double b[]);
+void adapt_start(model *m, double t, double y[], int n, void (*derivs)(model *, double, double [], double []));
+void adapt_dense(model *m, double t, double yout[], int n, void (*derivs)(model *, double, double [], double []));
+
+void set_year(model *m);
+
+long load_forcing(const char *file, double **a);
+void free_forcing(double *a);
+void free_forcing_store(void);
+double *get_mld_change(const double *mld);
+int has_forcing(const char *file);
+int get_calendar_year(int yy);
+int set_catalog(const char *file);
+void get_catalog_year(model *m, int year);
+void end_model(model *m);
+void free_catalog(void);
+int convert_forcing(const char *dir, const char *file);
+int bench_forcing(const char *dir, int nrep);
+void load_forcing_files(int nf, const char *const file[], double *a[], long n[], int text);
+
+int get_spinup(void);
+int get_periodic(model *m, const double vold[], const double vnew[]);
+int get_last_year(model *m);
+unsigned long get_year_hash(unsigned long h, model *m);
+unsigned long get_hash(unsigned long h, const void *p, size_t n);
+unsigned long get_build_hash(unsigned long h);
+void set_checkpoint_keys(model *m, const double vstart[]);
+void clean_directory(const char *dir, int n);
+int get_checkpoint(model *m, int yy, checkpoint *c);
+void set_checkpoint(model *m, const checkpoint *c, double vstart[], double *ah);
+void put_checkpoint(model *m, int yy, const double vstart[], double ah);
+
+void get_annual_map(model *m, const double x[], double xout[], const carbonate *carb,
+		    void (*derivs)(model *, double, double [], double []));
+double get_shoot_norm(const double f[], const double w[]);
+int shoot(model *m, double x[], const carbonate *carb, int *ny,
+	  void (*derivs)(model *, double, double [], double []));
+
+void set_forcing_table(forcing_table *t, const double mld[], const double mldo[], const double tem[],
+		       const double sir[], const double wsp[], const double sal[]);
+void get_carbonate_table(model *m, int k, carbconst *kk);
+
+void open_output(void);
+void free_output_writer(void);
+void put_results_row(const double r[]);
+void put_results_year(int yy);
+void put_results_index(void);
+
+void set_default_params(params *p);
+double *get_param(params *p, const char *name);
+int run_ensemble(const char *file, const double vstart[], int nthr);
+void get_summary(model *m, double s[]);
+
+void set_batch(batch *b, model *m[], const params par[], int n);
+void rkdriver_batch(batch *b, double vstart[][LANES]);
+void rk4_batch(batch *b, double y[][LANES], double dydt[][LANES], double t, double h, double yout[][LANES]);
+void derivs_batch(batch *b, double y[][LANES], double dydt[][LANES]);
+void set_forcing_batch(batch *b, int k, const double chlo[], const double alk[], const double tco2[], const double sil[]);
 
 
-  //============== Forcing for post-1995 years =============
-  
-  if(trans){ 
+// ===== GLOBAL VARIABLES =====
+           
+static int trans = TRUE; // set to TRUE  to look at transient results
+                         // set to FALSE to look at steady-state
 
-    cout<<endl;
-    cout<<"looking at transient"<<endl;
-    cout<<endl;
 
-    // === open 1995 ===
-    ifstream inl1(mld95f);  
-    if(!inl1){
-      cout<<" Impossible to open 1995 MLD file\n";
-      return 1;
-    }
-    ifstream inl2(sst95f); 
-    if(!inl2){
-      cout<<" Impossible to open 1995 TEM file\n";
-      return 1;
-    }
-    ifstream inl3(par95f);  
-    if(!inl3){
-      cout<<" Impossible to open 1995 PAR file\n";
-      return 1;
-    }
-    ifstream inlw1(win95f);  
-    if(!inlw1){
-      cout<<" Impossible to open 1995 WIN file\n";
-      return 1;
-    }
+double varM=0.0;
+double chltoc=0.0; // adaptive Chl:C ratio
 
-    // === open 1996 ===
-    ifstream inl4(mld96f);  
-    if(!inl4){
-      cout<<" Impossible to open 1996 MLD file\n";
-      return 1;
-    }
-    ifstream inl5(sst96f); 
-    if(!inl5){
-      cout<<" Impossible to open 1996 TEM file\n";
-      return 1;
-    }
-    ifstream inl6(par96f);  
-    if(!inl6){
-      cout<<" Impossible to open 1996 PAR file\n";
-      return 1;
-    }
-    ifstream inlw2(win96f);  
-    if(!inlw2){
-      cout<<" Impossible to open 1997 WIN file\n";
-      return 1;
-    }
+double gli,gnc,glidf,gncdf,gsc; 
 
-    // === open 1997 ===
-    ifstream inl7(mld97f);  
-    if(!inl7){
-      cout<<" Impossible to open 1997 MLD file\n";
-      return 1;
-    }
-    ifstream inl8(sst97f); 
-    if(!inl8){
-      cout<<" Impossible to open 1997 TEM file\n";
-      return 1;
-    }
-    ifstream inl9(par97f);  
-    if(!inl9){
-      cout<<" Impossible to open 1997 PAR file\n";
-      return 1;
-    }
-    ifstream inlw3(win97f);  
-    if(!inlw3){
-      cout<<" Impossible to open 1997 WIN file\n";
-      return 1;
-    }
+double ber=0.0;
+double los=0.0;
 
-    // === open 1998 ===
-    ifstream inl10(mld98f);  
-    if(!inl10){
-      cout<<" Impossible to open 1998 MLD file\n";
-      return 1;
-    }
-    ifstream inl11(sst98f); 
-    if(!inl11){
-      cout<<" Impossible to open 1998 TEM file\n";
-      return 1;
-    }
-    ifstream inl12(par98f);  
-    if(!inl12){
-      cout<<" Impossible to open 1998 PAR file\n";
-      return 1;
-    }
-    ifstream inlw4(win95f);  
-    if(!inlw4){
-      cout<<" Impossible to open 1998 WIN file\n";
-      return 1;
-    }
 
-    // === open 1999 ===
-    ifstream inl13(mld99f);  
-    if(!inl13){
-      cout<<" Impossible to open 1999 MLD file\n";
-      return 1;
-    }
-    ifstream inl14(sst99f); 
-    if(!inl14){
-      cout<<" Impossible to open 1999 TEM file\n";
-      return 1;
-    }
-    ifstream inl15(par99f);  
-    if(!inl15){
-      cout<<" Impossible to open 1999 PAR file\n";
-      return 1;
-    }
-    ifstream inlw5(win99f);  
-    if(!inlw5){
-      cout<<" Impossible to open 1999 WIN file\n";
-      return 1;
-    }
+// files for results, opened by open_output for a single run
+static out_writer obw;   // writes them (before them, so that it ends after them)
+static outbuf *outfiles=NULL;
 
-    // === open 2000 ===
-    ifstream inl16(mld00f);  
-    if(!inl16){
-      cout<<" Impossible to open 2000 MLD file\n";
-      return 1;
-    }
-    ifstream inl17(sst00f); 
-    if(!inl17){
-      cout<<" Impossible to open 2000 TEM file\n";
-      return 1;
-    }
-    ifstream inl18(par00f);  
-    if(!inl18){
-      cout<<" Impossible to open 2000 PAR file\n";
-      return 1;
-    }
-    ifstream inlw6(win95f);  
-    if(!inlw6){
-      cout<<" Impossible to open 2000 WIN file\n";
-      return 1;
-    }
+outfile outinf("./results/info.dat");
 
-    // === open 2001 ===
-    ifstream inl19(mld01f);  
-    if(!inl19){
-      cout<<" Impossible to open 2001 MLD file\n";
-      return 1;
-    }
-    ifstream inl20(sst01f); 
-    if(!inl20){
-      cout<<" Impossible to open 2001 TEM file\n";
-      return 1;
-    }
-    ifstream inl21(par01f);  
-    if(!inl21){
-      cout<<" Impossible to open 2001 PAR file\n";
-      return 1;
-    }
-    ifstream inlw7(win95f);  
-    if(!inlw7){
-      cout<<" Impossible to open 2001 WIN file\n";
-      return 1;
-    }
+// multi-year solution
+outfile out1("./results/diato.dat");
+outfile out2("./results/flage.dat");
+outfile out3("./results/nitra.dat");
+outfile out4("./results/silic.dat");
+outfile out5("./results/mesoz.dat");
+outfile out6("./results/detri.dat");
+outfile out7("./results/micro.dat");
+outfile out8("./results/dinof.dat");
+outfile out9("./results/ehuxl.dat");
+outfile out10("./results/ammon.dat");
+outfile out11("./results/acocc.dat");
+outfile out12("./results/fcocc.dat");
+outfile out13("./results/tdic.dat");
+outfile out14("./results/talk.dat");
+outfile out15("./results/pco2.dat");
+outfile out16("./results/co32.dat");
+outfile out17("./results/ocal.dat");
+outfile out18("./results/oara.dat");
+outfile out19("./results/tzoop.dat");
+outfile out20("./results/npratio.dat");
+
+outfile outa("./results/tempd.dat");
+outfile outb("./results/tempdf.dat");
+outfile outc("./results/airr.dat"); 
+outfile outd("./results/sirr.dat");
 
-    // ==== load 1995 ====
-    t=0;
-    while(inl1){
-      inl1>>mld95[t];
-      //test
-      mld95[t]=mld95[t];// + 3.0;
-      mld95o[t]=mld95[t];
-      t++;
-    }
-    for(h=0;h<=HSTEP;h++){                 // calculating dM/dt, as in FASH93 at pag.493
-      mld95[h]=(mld95[h+1]-mld95[h])/1.0;  // 1.0 is the time interval (1 hour)
-    }
-    t=0;
-    while(inl2){
-      inl2>>sst95[t];
-      t++;
-    }
-    t=0;
-    while(inl3){
-      inl3>>par95[t];
-      t++;
-    }
-    t=0;
-    while(inlw1){
-      inlw1>>win95[t];
-      t++;
-    }
+// one-year (last) solution
+outfile outl("./results/dia_d.dat");
+outfile outm("./results/fla_d.dat");
+outfile outn("./results/nit_d.dat");
+outfile outo("./results/mic_d.dat");
+outfile outp("./results/din_d.dat");
+outfile outq("./results/sil_d.dat");
+outfile outr("./results/mes_d.dat");
+outfile outs("./results/det_d.dat");
+outfile outw("./results/ehu_d.dat");
+outfile outx("./results/amm_d.dat");
+outfile outf("./results/aco_d.dat");
+outfile outg("./results/fco_d.dat");
+
+outfile outcp("./results/diagnoST-PROVA.dat");
+outfile outres("./results/resST-PROVA.dat");
+
+outfile outt("./results/phy_d.dat");
+outfile outu("./results/phyto.dat");
+outfile outy("./results/tzo_d.dat");
+
+outfile outv("./results/zp.dat");
+outfile outz("./results/ehc_d.dat");
+
+outfile outctochl("./results/cch_d.dat");
+outfile outluce("./results/ali_d.dat");
+
+outfile outdic("./results/dic_d.dat");
+outfile outalk("./results/alk_d.dat");
+outfile outpco("./results/pco_d.dat");
+outfile outco3("./results/co3_d.dat");
+outfile outoca("./results/oca_d.dat");
+outfile outora("./results/oar_d.dat");
+outfile outoph("./results/ph_d.dat");
+outfile outobi("./results/bic_d.dat");
+
+
+outfile outbe("./results/birth.dat");
+outfile outlo("./results/loss.dat");
+
+outfile outmi("./results/mixed.dat");
+
+outfile outbin("./results/results.bin");   // all the daily results, in columns (results.h)
+
+// diagnostic variables read by each results file
+static struct {
+  outfile *f;
+  int diag;
+} outdiag[]={{&outcp,DGRAZ|DPROD|DLOSS|DGROW|DCALC},
+	     {&outres,DGRAZ|DCALC},
+	     {&outinf,DPROD},
+	     {&outbin,DGRAZ|DPROD|DLOSS|DCALC}};
 
-    // ==== load 1996 ====
-    t=0;
-    while(inl4){
-      inl4>>mld96[t];
-      //test
-      mld96[t]=mld96[t];// + 3.0;
-      mld96o[t]=mld96[t];
-      t++;
-    }
-    for(h=0;h<=HSTEP;h++){                 // calculating dM/dt, as in FASH93 at pag.493
-      mld96[h]=(mld96[h+1]-mld96[h])/1.0;  // 1.0 is the time interval (1 hour)
-    }
-    t=0;
-    while(inl5){
-      inl5>>sst96[t];
-      t++;
-    }
-    t=0;
-    while(inl6){
-      inl6>>par96[t];
-      t++;
-    }
-    t=0;
-    while(inlw2){
-      inlw2>>win96[t];
-      t++;
-    }
+//=================================== MAIN ======================================
 
-    // ==== load 1997 ====
-    t=0;
-    while(inl7){
-      inl7>>mld97[t];
-      //test
-      mld97[t]=mld97[t];// - 5.0;
-      mld97o[t]=mld97[t];
-      t++;
-    }
-    for(h=0;h<=HSTEP;h++){                 // calculating dM/dt, as in FASH93 at pag.493
-      mld97[h]=(mld97[h+1]-mld97[h])/1.0;  // 1.0 is the time interval (1 hour)
-    }
-    t=0;
-    while(inl8){
-      inl8>>sst97[t];
-      t++;
-    }
-    t=0;
-    while(inl9){
-      inl9>>par97[t];
-      t++;
-    }
-    t=0;
-    while(inlw3){
-      inlw3>>win97[t];
-      t++;
-    }
 
-    // ==== load 1998 ====
-    t=0;
-    while(inl10){
-      inl10>>mld98[t];
-      //test
-      mld98[t]=mld98[t];// + 3.0;
-      mld98o[t]=mld98[t];
-      t++;
-    }
-    for(h=0;h<=HSTEP;h++){                 // calculating dM/dt, as in FASH93 at pag.493
-      mld98[h]=(mld98[h+1]-mld98[h])/1.0;  // 1.0 is the time interval (1 hour)
-    }
-    t=0;
-    while(inl11){
-      inl11>>sst98[t];
-      t++;
-    }
-    t=0;
-    while(inl12){
-      inl12>>par98[t];
-      t++;
-    }
-    t=0;
-    while(inlw4){
-      inlw4>>win98[t];
-      t++;
-    }
+main(int argc, char *argv[])
+{
 
-    // ==== load 1999 ====
-    t=0;
-    while(inl13){
-      inl13>>mld99[t];
-      //test
-      mld99[t]=mld99[t];// + 3.0;
-      mld99o[t]=mld99[t];
-      t++;
-    }
-    for(h=0;h<=HSTEP;h++){                 // calculating dM/dt, as in FASH93 at pag.493
-      mld99[h]=(mld99[h+1]-mld99[h])/1.0;  // 1.0 is the time interval (1 hour)
-    }
-    t=0;
-    while(inl14){
-      inl14>>sst99[t];
-      t++;
-    }
-    t=0;
-    while(inl15){
-      inl15>>par99[t];
-      t++;
-    }
-    t=0;
-    while(inlw5){
-      inlw5>>win99[t];
-      t++;
-    }
+  static int first_time = TRUE;  // for setting first year initial conditions
 
-    // ==== load 2000 ====
-    t=0;
-    while(inl16){
-      inl16>>mld00[t];
-      //test
-      mld00[t]=mld00[t];// + 3.0;
-      mld00o[t]=mld00[t];
-      t++;
-    }
-    for(h=0;h<=HSTEP;h++){                 // calculating dM/dt, as in FASH93 at pag.493
-      mld00[h]=(mld00[h+1]-mld00[h])/1.0;  // 1.0 is the time interval (1 hour)
-    }
-    t=0;
-    while(inl17){
-      inl17>>sst00[t];
-      t++;
-    }
-    t=0;
-    while(inl18){
-      inl18>>par00[t];
-      t++;
-    }
-    t=0;
-    while(inlw6){
-      inlw6>>win00[t];
-      t++;
-    }
+  static model run;              // state of the run (zero initialised)
 
-    // ==== load 2001 ====
-    t=0;
-    while(inl19){
-      inl19>>mld01[t];
-      //test
-      mld01[t]=mld01[t];// + 3.0;
-      mld01o[t]=mld01[t];
-      t++;
-    }
-    for(h=0;h<=HSTEP;h++){                 // calculating dM/dt, as in FASH93 at pag.493
-      mld01[h]=(mld01[h+1]-mld01[h])/1.0;  // 1.0 is the time interval (1 hour)
-    }
-    t=0;
-    while(inl20){
-      inl20>>sst01[t];
-      t++;
-    }
-    t=0;
-    while(inl21){
-      inl21>>par01[t];
-      t++;
-    }
-    t=0;
-    while(inlw7){
-      inlw7>>win01[t];
-      t++;
-    }
 
-    // === close input files ===
-
-    inl1.close();
-    inl2.close();
-    inl3.close();
-    inl4.close();
-    inl5.close();
-    inl6.close();
-    inl7.close();
-    inl8.close();
-    inl9.close();
-    inl10.close();
-    inl11.close();
-    inl12.close();
-    inl13.close();
-    inl14.close();
-    inl15.close();
-    inl16.close();
-    inl17.close();
-    inl18.close();
-    inl19.close();
-    inl20.close();
-    inl21.close();
-    inlw1.close();
-    inlw2.close();
-    inlw3.close();
-    inlw4.close();
-    inlw5.close();
-    inlw6.close();
-    inlw7.close();
+  // === LOAD INPUT FILES (MLD, TEMP, SAL, AND WIND SPEED VALUES) === 
+
+  if(argc>1 && !strcmp(argv[1],"-convert")) return convert_forcing("./input",FORCING);
+  if(argc>1 && !strcmp(argv[1],"-bench")) return bench_forcing("./input",argc>2 ? atoi(argv[2]) : 10);
+
+  //============== Forcing for post-1995 years =============
+  
+  if(trans){ 
 
+    cout<<endl;
+    cout<<"looking at transient"<<endl;
+    cout<<endl;
   }
   else{
 
     cout<<endl;
     cout<<"looking at steady-state"<<endl;
     cout<<endl;
-
-    ifstream in1(mld96f);  //in1("mldnew.dat");
-    if(!in1){
-      cout<<" Impossible to open MLD file\n";
-      return 1;
-    }
-    ifstream in2(sst96f);  //in2("tem.dat");  
-    if(!in2){
-      cout<<" Impossible to open TEM file\n";
-      return 1;
-    }   
-    ifstream in5(par96f);
-    if(!in5){
-      cout<<" Impossible to open PAR file\n";
-      return 1;
-    }
-    ifstream inw(win96f);
-    if(!inw){
-      cout<<" Impossible to open WIN file\n";
-      return 1;
-    }
-
-    t=0;
-    while(in1){
-      in1>>mld96[t];
-      mld96o[t]=mld96[t];
-      t++;
-    }
-    t=0;
-    while(in2){
-      in2>>sst96[t];
-      //tem[t]+=5;
-      t++;
-    }
-    t=0;
-    while(in5){
-      in5>>par96[t];
-      t++;
-    }
-   t=0;
-    while(inw){
-      inw>>win96[t];
-      t++;
-    }
-    for(h=0;h<=HSTEP;h++){                // calculating dM/dt, as in FASH93 at pag.493
-      mld96[h]=(mld96[h+1]-mld96[h])/1.0; // 1.0 is the time interval (1 hour)
-    }
-  
-    in1.close();
-    in2.close();
-    in5.close();
-    inw.close();
-  }
-
-  //==================================================
-
-  // ==== open pre-1995 ====
-  ifstream in6(mldp95f);
-  if(!in6){
-    cout<<" Impossible to open pre-1995 MLD file\n";
-    return 1;
-  }
-  ifstream in7(sstp95f);
-  if(!in7){
-    cout<<" Impossible to open pre-1995 SST file\n";
-    return 1;
-  }
-  ifstream in8(par95f);
-  if(!in8){
-    cout<<" Impossible to open pre-1995 PAR file\n";
-    return 1;
-  }
-  ifstream in9(win94f);
-  if(!in9){
-    cout<<" Impossible to open pre-1995 WIN file\n";
-    return 1;
-  }
-
-  // ==== load pre-1995 ====
-  t=0;
-  while(in6){
-    in6>>mldp95[t];
-    mldp95o[t]=mldp95[t];
-    t++;
-  }
-  t=0;
-  while(in7){
-    in7>>sstp95[t];
-    t++;
-  }
-  t=0;
-  while(in8){
-    in8>>par95[t];
-    t++;
-  }
-  t=0;
-  while(in9){
-    in9>>win94[t];
-    t++;
-  }
-
-
-  for(h=0;h<=HSTEP;h++){                     // calculating dM/dt, as in FASH93 at pag.493
-      mldp95[h]=(mldp95[h+1]-mldp95[h])/1.0; // 1.0 is the time interval (1 hour)
-  }
-
-
-  // == THESE SAL AND WSP SHOULD BE DELETED NOW ==
-
-  // == open sal and WSP ==
-  ifstream in3("./input/sal.in");
-  if(!in3){
-    cout<<" Impossible to open SAL file\n";
-    return 1;
-  }
-  ifstream in4("./input/wsp.in");
-  if(!in4){
-    cout<<" Impossible to open WSP file\n";
-    return 1;
   }
-  // == load sal and WSP ==
-  t=0;
-  while(in3){
-    in3>>sal[t];
-    t++;
-  }
-  t=0;
-  while(in4){
-    in4>>wsp[t];
-    t++;
-  }
-  
-  in3.close();
-  in4.close();
-
-  // =============================================
 
-  in6.close();
-  in7.close();
-  in8.close();
-  in9.close();
+  // the files of each year are listed in CATALOG, and are loaded when
+  // the run gets to the year
+  if(set_catalog(CATALOG)) return 1;
 
   // =================================================
   
   
-  int i=0;
   double *vstart;
   
-  tt=dvector(1,HSTEP);
-  y=dmatrix(1,NEQ,1,HSTEP);
+  run.tt=dvector(1,HSTEP);
+  run.y=dmatrix(1,NEQ,1,HSTEP);
   vstart=dvector(1,NEQ);
   
   
@@ -955,15 +721,6 @@ main()
     i12=0.0001;//0.0001; // fco
     i13=2100.0;// dic  
     i14=2250.0;// alk
-
-    outres<<"#jday "<<"month "<<"temp "<<"MLD "<<"sal "<<"Irr "<<"diato "<<"flage "<<"dino "
-          <<"ehux "<<"microz "<<"mesoz "<<"totphy "<<"nit "<<"ammo "<<"sil "<<"DIC "<<"Alk "
-	  <<"pCO2 "<<"CO3 "<<"omegacal "<<"omegaara "<<"acocco "<<"fcocco "<<"CO2(aq) "<<"HCO3 "
-          <<"totzoo "<<endl;
-
-    outcp<<"#jday  "<<"month  "<<"Pho:Cal ratio  "<<"f-ratio  "<<"Tot phy biomass  "
-         <<"Tot phy prod (phyto growth terms)  "<<"PON  "<<"Tot zoo biomass  "
-         <<"C:Chl ratio  "<<"TAlk  "<<"Sal"<<endl;
   }
   
   vstart[1]=i1;   // [1] - diatoms
@@ -984,81 +741,64 @@ main()
   //vstart[10]=0.0;  // [10] - silicate mass balance management
   //vstart[11]=0.0;  // [11] - nitrogen mass balance management
   
-  yi1=vstart[1];
-  yi2=vstart[2];
-  yi3=vstart[3];
-  yi4=vstart[4];
-  yi5=vstart[5];
-  yi6=vstart[6];
-  yi7=vstart[7];
-  yi8=vstart[8];
-  yi9=vstart[9];
-  yi10=vstart[10];
-  yi11=vstart[11];
-  yi12=vstart[12];
-  yi13=vstart[13];
-  yi14=vstart[14];
+  run.yi[1]=vstart[1];
+  run.yi[2]=vstart[2];
+  run.yi[3]=vstart[3];
+  run.yi[4]=vstart[4];
+  run.yi[5]=vstart[5];
+  run.yi[6]=vstart[6];
+  run.yi[7]=vstart[7];
+  run.yi[8]=vstart[8];
+  run.yi[9]=vstart[9];
+  run.yi[10]=vstart[10];
+  run.yi[11]=vstart[11];
+  run.yi[12]=vstart[12];
+  run.yi[13]=vstart[13];
+  run.yi[14]=vstart[14];
 
 
   // ===========================================
+
+#if LIGHT_TABLE
+  set_light_table(LTFILE);   // light limitation table, built once for the whole run
+#endif
   
-  
-  rkdriver(vstart,NEQ,TI,TH,HSTEP,derivs);   
+  int err=0;
+
+  if(argc>1){                // ensemble of parameter sets, as given in argv[1]
+    err=run_ensemble(argv[1],vstart,argc>2 ? atoi(argv[2]) : 0);
+  }
+  else{                      // single run with the parameters of param.h
+    open_output();           // the results files, only now
+
+    outres<<"#jday "<<"month "<<"temp "<<"MLD "<<"sal "<<"Irr "<<"diato "<<"flage "<<"dino "
+          <<"ehux "<<"microz "<<"mesoz "<<"totphy "<<"nit "<<"ammo "<<"sil "<<"DIC "<<"Alk "
+	  <<"pCO2 "<<"CO3 "<<"omegacal "<<"omegaara "<<"acocco "<<"fcocco "<<"CO2(aq) "<<"HCO3 "
+          <<"totzoo "<<endl;
+
+    outcp<<"#jday  "<<"month  "<<"Pho:Cal ratio  "<<"f-ratio  "<<"Tot phy biomass  "
+         <<"Tot phy prod (phyto growth terms)  "<<"PON  "<<"Tot zoo biomass  "
+         <<"C:Chl ratio  "<<"TAlk  "<<"Sal"<<endl;
+
+    set_default_params(&run.par);
+    run.out=TRUE;
+    run.diag=get_output_diagnostics();
+    rkdriver(&run,vstart,NEQ,TI,TH,HSTEP,derivs);   
+  }
   
 
   // ==== free all vectors ====
   
-  free_dmatrix(y,1,NEQ,1,HSTEP);
-  free_dvector(tt,1,HSTEP);
+  free_dmatrix(run.y,1,NEQ,1,HSTEP);
+  free_dvector(run.tt,1,HSTEP);
   free_dvector(vstart,1,NEQ);
   
-  free_dvector(mldp95,1,HSTEP);
-  free_dvector(mldp95o,1,HSTEP);
-  free_dvector(sstp95,1,HSTEP);
-  free_dvector(win94,1,HSTEP);
-
-  free_dvector(mld95,1,HSTEP);
-  free_dvector(sst95,1,HSTEP);
-  free_dvector(par95,1,HSTEP);
-  free_dvector(win95,1,HSTEP);
-
-  free_dvector(mld96,1,HSTEP);
-  free_dvector(sst96,1,HSTEP);
-  free_dvector(par96,1,HSTEP);
-  free_dvector(win96,1,HSTEP);
-
-  free_dvector(mld97,1,HSTEP);
-  free_dvector(sst97,1,HSTEP);
-  free_dvector(par97,1,HSTEP);
-  free_dvector(win97,1,HSTEP);
-
-  free_dvector(mld98,1,HSTEP);
-  free_dvector(sst98,1,HSTEP);
-  free_dvector(par98,1,HSTEP);
-  free_dvector(win98,1,HSTEP);
-
-  free_dvector(mld99,1,HSTEP);
-  free_dvector(sst99,1,HSTEP);
-  free_dvector(par99,1,HSTEP);
-  free_dvector(win99,1,HSTEP);
-
-  free_dvector(mld00,1,HSTEP);
-  free_dvector(sst00,1,HSTEP);
-  free_dvector(par00,1,HSTEP);
-  free_dvector(win00,1,HSTEP);
-
-  free_dvector(mld01,1,HSTEP);
-  free_dvector(sst01,1,HSTEP);
-  free_dvector(par01,1,HSTEP);
-  free_dvector(win01,1,HSTEP);
-
-  free_dvector(mld95o,1,HSTEP);
-  free_dvector(mld96o,1,HSTEP);
-  free_dvector(mld97o,1,HSTEP);
-  free_dvector(mld98o,1,HSTEP);
-  free_dvector(mld99o,1,HSTEP);
-  free_dvector(mld00o,1,HSTEP);
-  free_dvector(mld01o,1,HSTEP);
+  free_catalog();
+  free_forcing_store();
+
+#if LIGHT_TABLE
+  free_light_table();
+#endif
 
 
   // ===== close all files =====
@@ -1130,7 +870,12 @@ main()
 
   outmi.close();
 
-  return 0;  
+  if(outbin.is_open()) put_results_index();
+  outbin.close();
+
+  free_output_writer();    // after the last buffers are written
+
+  return err;  
   
 }
 
@@ -1138,8 +883,8 @@ main()
 //============================= ODE ROUTINES ================================
 
 
-void rkdriver(double vstart[], int nvar, double t1, double t2, int nstep, 
-	      void (*derivs)(double, double [], double []))
+void rkdriver(model *m, double vstart[], int nvar, double t1, double t2, int nstep, 
+	      void (*derivs)(model *, double, double [], double []))
 {
 
   int i,k;
@@ -1177,196 +922,72 @@ void rkdriver(double vstart[], int nvar, double t1, double t2, int nstep,
   double temp=0.0;   // temperature - to feed into the carbonate routines
   double salin=0.0;  // salinity - to feed into the carbonate routines
   double wspeed=0.0; // wind speed - to feed into the carbonate routines
+
+  carbonate carb;    // carbonate system species
+  carb.ah=0.0;       // no previous [H+] to start from
+  long hiter=0;      // [H+] iterations in the current year
   
   double t,h;
-  double *v,*vout,*dv;
-
-  //int yy;                // actual year
-
-  for(yy=0;yy<=Y;yy++){  // number of years
+  double v[NEQ+1],vout[NEQ+1],dv[NEQ+1];  // on the stack, nvar must not exceed NEQ
 
-    diff=mm;
+#if NRCOUNT
+  long nalloc;       // heap allocations before the time loop
+#endif
+  long nrhs0;        // derivs evaluations before the time loop
+  long nhfail0;      // [H+] not converged before the time loop
 
-    if(yy==3) diff=mm95;
-    if(yy==4) diff=mm96;
-    if(yy==5) diff=mm97;
-    if(yy==6) diff=mm98;
-    if(yy==7) diff=mm99;
-    if(yy==8) diff=mm00;
-    if(yy==9) diff=mm01;
-
-    nbo=N0;
-    sbo=S0;
+  //int yy;                // actual year
 
-    if(yy==2){
-      nbo=N094;
-      sbo=S094;
+  int y0=0;          // first year to integrate
+#if SHOOTING
+  int last;          // last year with the forcing of the current one
+#endif
+  double vprev[NEQ+1];  // state at the start of the previous year
+
+  m->nspin=0;
+  m->ssd=HUGE_VAL;
+
+#if CHECKPOINT
+  checkpoint cp;
+  set_checkpoint_keys(m,vstart);
+  for(y0=get_spinup();y0>0 && !get_checkpoint(m,y0,&cp);y0--);
+  if(y0>0) set_checkpoint(m,&cp,vstart,&carb.ah);
+  if(m->out && y0>0) cout<<" spin-up of "<<y0<<" years from "<<CPDIR<<endl;
+#endif
+
+  for(i=1;i<=nvar;i++) vprev[i]=vstart[i];
+
+  for(m->yy=y0;m->yy<=Y;m->yy++){  // number of years
+
+    set_year(m);             // forcing, mixing and boundary values of year yy
+
+#if SHOOTING
+    // first year of a forcing repeated in the spin-up: its periodic state by
+    // shooting, then only the last year with this forcing is integrated
+    if(m->yy<get_spinup() && (last=get_last_year(m))>m->yy){
+      int ny;
+      int conv=shoot(m,vstart,&carb,&ny,derivs);
+      if(m->out) cout<<"   periodic state "<<(conv ? "" : "not ")<<"found by shooting with "<<ny
+		     <<" one-year integrations, for "<<last-m->yy+1<<" years of spin-up"<<endl;
+      m->nspin+=ny;
+      for(i=1;i<=nvar;i++) m->yi[i]=vstart[i];
+      if(conv){                // else the spin-up goes on from the best state found
+	m->yy=last;
+	set_year(m);
+      }
     }
+#endif
 
-    if(yy==4){
-      nbo=N095;
-      sbo=S095;
-    }
+#if NRCOUNT
+    nalloc=nr_nalloc;
+#endif
+    nrhs0=m->nrhs;
+    nhfail0=m->nhfail;
 
-    if(yy==4){
-      nbo=N096;
-      sbo=S096;
-    }
-
-    if(yy==5){
-      nbo=N097;
-      sbo=S097;
-    }
-
-    if(yy==6){
-      nbo=N098;
-      sbo=S098;
-    }
-
-    if(yy==6){
-      nbo=N099;
-      sbo=S099;
-    }
-
-    if(yy==7){
-      nbo=N000;
-      sbo=S000;
-    }
-
-    if(yy==8){
-      nbo=N001;
-      sbo=S001;
-    }
-
-
-    // The model is run for a number of years to stabilize it
-    // and in order to look at steady-state results. But
-    // when a transient result is needed (last year forcing
-    // different than all previous years) then the variable 
-    // 'trans' is set TRUE and different MLD and TEM forcing 
-    // functions are used for last year run. 
-
-    // === transient ===
-    if(yy<Y-6 && trans){
-      cout<<" year before 1995"<<endl;
-      for(i=0;i<HSTEP;i++){
-	mld[i]=mldp95[i];
-	mldo[i]=mldp95o[i];
-	tem[i]=sstp95[i];
-	if(i>2880 && i<6720) sir[i]=par95[i];// + 0.0;
-	else sir[i]=par95[i];
-	sir[i]=par95[i];
-	wsp[i]=win94[i];
-      }
-    }
-    if(yy==Y-6 && trans){
-      cout<<" year 1995"<<endl;    
-      for(i=0;i<HSTEP;i++){
-    	mld[i]=mld95[i];
-    	mldo[i]=mld95o[i];
-    	tem[i]=sst95[i];
-	if(i>2880 && i<6720) sir[i]=par95[i];// - 8.0;
-    	else sir[i]=par95[i];
-	wsp[i]=win95[i];
-      }
-    }
-    if(yy==Y-5 && trans){
-      cout<<" year 1996"<<endl;
-      for(i=0;i<HSTEP;i++){
-	mld[i]=mld96[i];
-	mldo[i]=mld96o[i];
-	tem[i]=sst96[i];
-	if(i>2880 && i<6720) sir[i]=par96[i];// + 3.0;
-	else sir[i]=par96[i];
-	wsp[i]=win96[i];
-      }
-    }
-    if(yy==Y-4 && trans){
-      cout<<" year 1997"<<endl;    
-      for(i=0;i<HSTEP;i++){
-    	mld[i]=mld97[i];
-    	mldo[i]=mld97o[i];
-    	tem[i]=sst97[i];
-    	if(i>2880 && i<6720) sir[i]=par97[i];// + 10.0;
-	else sir[i]=par97[i];
-	wsp[i]=win97[i];
-      }
-    }
-    if(yy==Y-3 && trans){
-      cout<<" year 1998"<<endl;
-      for(i=0;i<HSTEP;i++){
-	mld[i]=mld98[i];
-	mldo[i]=mld98o[i];
-	tem[i]=sst98[i];
-	if(i>2880) sir[i]=par98[i];// + 8.0;
-	else sir[i]=par98[i];
-	wsp[i]=win98[i];
-      }
-    }
-    if(yy==Y-2 && trans){
-      cout<<" year 1999"<<endl;
-      for(i=0;i<HSTEP;i++){
-	mld[i]=mld99[i];
-	mldo[i]=mld99o[i];
-	tem[i]=sst99[i];
-	if(i>2880 && i<6720) sir[i]=par99[i];// + 8.0;
-	else  sir[i]=par99[i];
-	wsp[i]=win99[i];
-      }
-    }
-    if(yy==Y-1 && trans){
-      cout<<" year 2000"<<endl;
-      for(i=0;i<HSTEP;i++){
-	mld[i]=mld00[i];
-	mldo[i]=mld00o[i];
-	tem[i]=sst00[i];
-	if(i>2880 && i<6720) sir[i]=par00[i];// + 10.0;
-	else sir[i]=par00[i];
-	wsp[i]=win00[i];
-      }
-    }
-    if(yy==Y && trans){
-      cout<<" year 2001"<<endl;
-      for(i=0;i<HSTEP;i++){
-	mld[i]=mld01[i];
-	mldo[i]=mld01o[i];
-	tem[i]=sst01[i];
-	if(i>2880 && i<6720) sir[i]=par01[i];// - 5.0;
-	else sir[i]=par01[i];
-	wsp[i]=win01[i];
-      }
-    }
-
-    // === steady-state ===
-    if(yy<Y && !trans){
-      cout<<" year before 1995"<<endl;
-      for(i=0;i<HSTEP;i++){
-	mld[i]=mldp95[i];
-	mldo[i]=mldp95o[i];	
-	tem[i]=sstp95[i];
-	sir[i]=par95[i];
-	wsp[i]=win94[i];
-      }
-    }
-    if(yy==Y && !trans){
-      cout<<" year 1996"<<endl;
-      for(i=0;i<HSTEP;i++){
-	mld[i]=mld96[i];
-	mldo[i]=mld96o[i];
-	tem[i]=sst96[i];
-	sir[i]=par96[i];
-	wsp[i]=win96[i];
-      }
-    }
-
-    v=dvector(1,nvar);
-    vout=dvector(1,nvar);
-    dv=dvector(1,nvar);
-    
     // note: nvar is the number of ODEs (i.e. NEQ)
     for(i=1;i<=nvar;i++){   // loading starting values
       v[i]=vstart[i];
-      y[i][1]=v[i];
+      m->y[i][1]=v[i];
     }
 
     //cout<<"\n";
@@ -1378,14 +999,20 @@ void rkdriver(double vstart[], int nvar, double t1, double t2, int nstep,
     //cout<<"detri  "<<vstart[6]<<"\n";
     //cout<<"\n";
     
-    tt[1]=t1;
+    m->tt[1]=t1;
     t=t1;
 
     h=(t2-t1)/nstep;
     
     int conta=0;
 
-    if(yy==0) chlcd=chlcdf=chlcf=chlceh=CHLTOC; //0.025;  // initial value for Chl:C ratio
+    hiter=0;
+
+#if INTEGRATOR>=2
+    adapt_start(m,t,v,nvar,derivs_forced);
+#endif
+
+    if(m->yy==y0) chlcd=chlcdf=chlcf=chlceh=CHLTOC; //0.025;  // initial value for Chl:C ratio
       
     chlo=NTOC*(chlcd*v[1]+chlcdf*v[2]+chlcf*v[8]+chlceh*v[9]); // total chlorophyll in mg Chl/m3       
 
@@ -1397,48 +1024,16 @@ void rkdriver(double vstart[], int nvar, double t1, double t2, int nstep,
 
     for(k=1;k<=nstep-3;k++){    // take nstep (for ex.: 8760, when in h-1) steps
 
-      // ================= light system ==================
-
-      varH=mld[k+1];                        // mixed layer depth variation, h(t)=dM/dt as in FASH93
-      mixed=mldo[k+1];                      // mixed layer depth, M(t) in FASH93
-
-      //esurf=get_light_at_surface(k+1);    // CALCULATED light at surface at time k of the year
-      esurf=sir[k+1];                       // MEASURED   light at surface at time k of the year
-    
-      outd<<(k+1)<<"   "<<esurf<<endl;      // save light at surface (in W m-2)
-
-      psi=get_averaged_light(esurf,chlo,mixed);      // light limitation for all phytopl either than Ehux
-      psieh=get_averaged_light_eh(esurf,chlo,mixed); // light limitation for E. huxleyi
-      psica=get_averaged_light_cal(esurf,chlo,mixed);// light limitation for Calcification
-
-      li=get_light_intensity(esurf,chlo);           // light at a given depth (5 m)
-
-      // ================ carbonate system ================
-
-      temp=tem[k];
-      salin=sal[k];      
-      wspeed=wsp[k];
-
-      gtv=get_gas_transfer_velocity(wspeed,temp);        // get gas transfer velocity
-      co2sol=get_co2_solubility(salin,temp);             // get CO2 solubility 
-
-      pco2w=get_param_water(salin,temp,alk,tco2,sil,1);  // get pCO2 in water
-      co32=get_param_water(salin,temp,alk,tco2,sil,2);   // get [CO3=] 
-      o_cal=get_param_water(salin,temp,alk,tco2,sil,3);  // get omega-calcite
-      o_ara=get_param_water(salin,temp,alk,tco2,sil,4);  // get omega-aragonite
-      ph=get_param_water(salin,temp,alk,tco2,sil,5);     // get pH
-      bica=get_param_water(salin,temp,alk,tco2,sil,6);   // get [HCO3-]
-      co2aq=get_param_water(salin,temp,alk,tco2,sil,7);  // get [CO2(aq)]
-
-      //ingEH=90.0/exp(o_cal*o_cal);
-      ingEH=10.0/(o_cal*o_cal*o_cal*o_cal); //16.45
-      //MEH=1.2/(1.3*o_cal*o_cal*o_cal);//f(x)=1.2/(1.3*x*x*x)
-      //ingEH=90000.0/(o_cal*o_cal*o_cal*o_cal*o_cal*o_cal*o_cal*o_cal*o_cal*o_cal*o_cal*o_cal*o_cal*o_cal*o_cal); 
+#if INTEGRATOR==1
+      set_forcing(m,k,0.0,chlo,alk,tco2,sil,&carb);   // light and carbonate systems at the start of hour k
+      hiter+=carb.niter;
+#endif
 
-      // =============== temperature system ===============
+      if(m->out) outd<<(k+1)<<"   "<<m->sir[k+1]<<endl;     // save light at surface (in W m-2)
 
-      varT=exp(0.063*temp);          // compute growth limitation with temperature (EPPL72)
-      varTeh=exp(0.063*temp);
+      temp=m->tem[k];
+      salin=m->sal[k];      
+      wspeed=m->wsp[k];
 
       // =================== Chl:C system =================  // Cloern et al. 1995 L&O:40(7) 1313-1321
       
@@ -1466,145 +1061,156 @@ void rkdriver(double vstart[], int nvar, double t1, double t2, int nstep,
       // ==================================================
 
 
-      (*derivs)(t,v,dv);      
-      rk4(v,dv,nvar,t,h,vout,derivs);
+#if INTEGRATOR==1
+      (*derivs)(m,t,v,dv);      
+      rk4(m,v,dv,nvar,t,h,vout,derivs);
+#else
+      adapt_dense(m,t+h,vout,nvar,derivs_forced);   // state at the end of hour k
+      if(m->out && fmod(k,24)==0){                // forcing at the output instants 
+	chlo=NTOC*(chlcd*vout[1]+chlcdf*vout[2]+chlcf*vout[8]+chlceh*vout[9]);
+	set_forcing(m,k,1.0,chlo,vout[14],vout[13],vout[4],&carb);
+	hiter+=carb.niter;
+      }
+#endif
       
       if((double)(t+h) == t) nrerror(" Step size too small in routine rkdriver ");
       t+=h;
-      tt[k+1]=t;              // store intermediate steps
+      m->tt[k+1]=t;              // store intermediate steps
 
       for(i=1;i<=14;i++) vout[i]=fabs(vout[i]);
 
+      if(m->out && m->diag && fmod(k,24)==0) set_diagnostics(m,vout);  // at the output instants only
+
       for(i=1;i<=nvar;i++){ 
 	v[i]=vout[i];
-	y[i][k+1]=v[i];      
+	m->y[i][k+1]=v[i];      
 	
-	if(fmod(k,24)==0 && yy==Y){
-	  nc=v[3];
-	  sc=v[4];
+	if(fmod(k,24)==0 && m->yy==Y){
+	  m->nc=v[3];
+	  m->sc=v[4];
 	}
 
 	// (tt[k+1]+HSTEP*yy)/TIME
 	if(i==1){ 
-	  if(fmod(k,24)==0) out1<<tt[k+1]+HSTEP*yy<<"  "<<y[i][k+1]<<endl; // save diatoms   	
-	  dia=y[i][k+1];
+	  if(m->out && fmod(k,24)==0) out1<<m->tt[k+1]+HSTEP*m->yy<<"  "<<m->y[i][k+1]<<endl; // save diatoms   	
+	  dia=m->y[i][k+1];
 	}
 	if(i==2){
-	  if(fmod(k,24)==0) out2<<tt[k+1]+HSTEP*yy<<"  "<<y[i][k+1]<<endl; // save flage
-	  fla=y[i][k+1];	
+	  if(m->out && fmod(k,24)==0) out2<<m->tt[k+1]+HSTEP*m->yy<<"  "<<m->y[i][k+1]<<endl; // save flage
+	  fla=m->y[i][k+1];	
 	}
 	if(i==3){
-	  if(fmod(k,24)==0) out3<<tt[k+1]+HSTEP*yy<<"  "<<y[i][k+1]<<endl; // save nitrate	
+	  if(m->out && fmod(k,24)==0) out3<<m->tt[k+1]+HSTEP*m->yy<<"  "<<m->y[i][k+1]<<endl; // save nitrate	
 	}
 	if(i==4){
-	  if(fmod(k,24)==0) out4<<tt[k+1]+HSTEP*yy<<"  "<<y[i][k+1]<<endl; // save silicate 	
+	  if(m->out && fmod(k,24)==0) out4<<m->tt[k+1]+HSTEP*m->yy<<"  "<<m->y[i][k+1]<<endl; // save silicate 	
 	}      
 	if(i==5){
-	  if(fmod(k,24)==0) out5<<tt[k+1]+HSTEP*yy<<"  "<<y[i][k+1]<<endl; // save mesozoo
-	  mes=y[i][k+1];
+	  if(m->out && fmod(k,24)==0) out5<<m->tt[k+1]+HSTEP*m->yy<<"  "<<m->y[i][k+1]<<endl; // save mesozoo
+	  mes=m->y[i][k+1];
 	}
 	if(i==6){
-	  if(fmod(k,24)==0) out6<<tt[k+1]+HSTEP*yy<<"  "<<y[i][k+1]<<endl; // save detritus
+	  if(m->out && fmod(k,24)==0) out6<<m->tt[k+1]+HSTEP*m->yy<<"  "<<m->y[i][k+1]<<endl; // save detritus
 	}
      	if(i==7){
-	  if(fmod(k,24)==0) out7<<tt[k+1]+HSTEP*yy<<"  "<<y[i][k+1]<<endl; // save microzoo
-	  mic=y[i][k+1];
+	  if(m->out && fmod(k,24)==0) out7<<m->tt[k+1]+HSTEP*m->yy<<"  "<<m->y[i][k+1]<<endl; // save microzoo
+	  mic=m->y[i][k+1];
 	}
 	if(i==8){
-	  if(fmod(k,24)==0) out8<<tt[k+1]+HSTEP*yy<<"  "<<y[i][k+1]<<endl; // save dinofla
-	  din=y[i][k+1];
+	  if(m->out && fmod(k,24)==0) out8<<m->tt[k+1]+HSTEP*m->yy<<"  "<<m->y[i][k+1]<<endl; // save dinofla
+	  din=m->y[i][k+1];
 	}
 	if(i==9){
-	  if(fmod(k,24)==0) out9<<tt[k+1]+HSTEP*yy<<"  "<<y[i][k+1]<<endl; // save ehux
-	  ehu=y[i][k+1];
+	  if(m->out && fmod(k,24)==0) out9<<m->tt[k+1]+HSTEP*m->yy<<"  "<<m->y[i][k+1]<<endl; // save ehux
+	  ehu=m->y[i][k+1];
 	}
 	if(i==10){
-	  if(fmod(k,24)==0) out10<<tt[k+1]+HSTEP*yy<<"  "<<y[i][k+1]<<endl; // save ammonia
+	  if(m->out && fmod(k,24)==0) out10<<m->tt[k+1]+HSTEP*m->yy<<"  "<<m->y[i][k+1]<<endl; // save ammonia
 	}
 	if(i==11){
-	  if(fmod(k,24)==0) out11<<tt[k+1]+HSTEP*yy<<"  "<<y[i][k+1]<<endl; // save acocc
+	  if(m->out && fmod(k,24)==0) out11<<m->tt[k+1]+HSTEP*m->yy<<"  "<<m->y[i][k+1]<<endl; // save acocc
 	}
 	if(i==12){
-	  if(fmod(k,24)==0) out12<<tt[k+1]+HSTEP*yy<<"  "<<y[i][k+1]<<endl; // save fcocc
+	  if(m->out && fmod(k,24)==0) out12<<m->tt[k+1]+HSTEP*m->yy<<"  "<<m->y[i][k+1]<<endl; // save fcocc
 	}
 	if(i==13){
-	  if(fmod(k,24)==0) out13<<tt[k+1]+HSTEP*yy<<"  "<<y[i][k+1]<<endl; // save tdic
+	  if(m->out && fmod(k,24)==0) out13<<m->tt[k+1]+HSTEP*m->yy<<"  "<<m->y[i][k+1]<<endl; // save tdic
 	}
 	if(i==14){
-	  if(fmod(k,24)==0) out14<<tt[k+1]+HSTEP*yy<<"  "<<y[i][k+1]<<endl; // save talk
+	  if(m->out && fmod(k,24)==0) out14<<m->tt[k+1]+HSTEP*m->yy<<"  "<<m->y[i][k+1]<<endl; // save talk
 	}
       }
 
 
       //if(fmod(k,24)==0){ // start saving since firts year
 
-      if(yy>2 && fmod(k,24)==0){  // start saving after third-year run 
+      if(m->out && m->yy>2 && fmod(k,24)==0){  // start saving after third-year run 
 
       //if(yy==Y && fmod(k,24)==0){  // start saving after year before last
 
       //if(yy==Y){
 
 	// NTOC = 12 * CTON  (CTON = 6.625)
-	outl<<tt[k+1]/24.0<<"  "<<y[1][k+1]<<"  "<<tt[k+1]*0.00126+1<<endl;        // diatom (mmol N m-3)
-	outm<<tt[k+1]/24.0<<"  "<<y[2][k+1]<<"  "<<tt[k+1]*0.00126+1<<endl;        // flagel (mmol N m-3)
-	outn<<tt[k+1]/24.0<<"  "<<y[3][k+1]<<"  "<<tt[k+1]*0.00126+1<<endl;        // nitrat (mmol N m-3) 
-	outq<<tt[k+1]/24.0<<"  "<<y[4][k+1]<<"  "<<tt[k+1]*0.00126+1<<endl;        // silica (mmol Si m-3)
-	outr<<tt[k+1]/24.0<<"  "<<y[5][k+1]<<"  "<<tt[k+1]*0.00126+1<<endl;        // mesozo (mmol N m-3) 
-	outs<<tt[k+1]/24.0<<"  "<<y[6][k+1]<<"  "<<tt[k+1]*0.00126+1<<endl;        // detrit (mmol N m-3)
-	outo<<tt[k+1]/24.0<<"  "<<y[7][k+1]<<"  "<<tt[k+1]*0.00126+1<<endl;        // microz (mmol N m-3)
-	outp<<tt[k+1]/24.0<<"  "<<y[8][k+1]<<"  "<<tt[k+1]*0.00126+1<<endl;        // dinofl (mmol N m-3)
-	outw<<tt[k+1]/24.0<<"  "<<y[9][k+1]<<"  "<<tt[k+1]*0.00126+1<<endl;        // ehuxle (mmol N m-3)
-	outx<<tt[k+1]/24.0<<"  "<<y[10][k+1]<<"  "<<tt[k+1]*0.00126+1<<endl;       // ammoni (mmol N m-3)
-	outz<<tt[k+1]/24.0<<"  "<<12*CTON*y[9][k+1]<<"  "<<tt[k+1]*0.00126+1<<endl;// ehuxle (mg org-C m-3)
-	outf<<tt[k+1]/24.0<<"  "<<12*y[11][k+1]<<"  "<<tt[k+1]*0.00126+1<<endl;    // at coc (mg cal-C m-3)
-	outg<<tt[k+1]/24.0<<"  "<<12*y[12][k+1]<<"  "<<tt[k+1]*0.00126+1<<endl;    // fr coc (mg cal-C m-3)
-	outdic<<tt[k+1]/24.0<<"  "<<y[13][k+1]<<"  "<<tt[k+1]*0.00126+1<<endl;     // Total CO2 (umol C kg-1)
-	outalk<<tt[k+1]/24.0<<"  "<<y[14][k+1]<<"  "<<tt[k+1]*0.00126+1<<endl;     // Total Alk (uEq kg-1)
-	outctochl<<tt[k+1]/24.0<<"  "<<1.0/chlcd<<"  "<<1.0/chlcdf<<"  "<<1.0/chlcf
-                 <<"  "<<1.0/chlceh<<"  "<<tt[k+1]*0.00126+1<<endl;  // C:Chl seasonal ratio
-
-	outluce<<tt[k+1]/24.0<<"  "<<luce<<"  "<<tt[k+1]*0.00126+1<<endl;
+	outl<<m->tt[k+1]/24.0<<"  "<<m->y[1][k+1]<<"  "<<m->tt[k+1]*0.00126+1<<endl;        // diatom (mmol N m-3)
+	outm<<m->tt[k+1]/24.0<<"  "<<m->y[2][k+1]<<"  "<<m->tt[k+1]*0.00126+1<<endl;        // flagel (mmol N m-3)
+	outn<<m->tt[k+1]/24.0<<"  "<<m->y[3][k+1]<<"  "<<m->tt[k+1]*0.00126+1<<endl;        // nitrat (mmol N m-3) 
+	outq<<m->tt[k+1]/24.0<<"  "<<m->y[4][k+1]<<"  "<<m->tt[k+1]*0.00126+1<<endl;        // silica (mmol Si m-3)
+	outr<<m->tt[k+1]/24.0<<"  "<<m->y[5][k+1]<<"  "<<m->tt[k+1]*0.00126+1<<endl;        // mesozo (mmol N m-3) 
+	outs<<m->tt[k+1]/24.0<<"  "<<m->y[6][k+1]<<"  "<<m->tt[k+1]*0.00126+1<<endl;        // detrit (mmol N m-3)
+	outo<<m->tt[k+1]/24.0<<"  "<<m->y[7][k+1]<<"  "<<m->tt[k+1]*0.00126+1<<endl;        // microz (mmol N m-3)
+	outp<<m->tt[k+1]/24.0<<"  "<<m->y[8][k+1]<<"  "<<m->tt[k+1]*0.00126+1<<endl;        // dinofl (mmol N m-3)
+	outw<<m->tt[k+1]/24.0<<"  "<<m->y[9][k+1]<<"  "<<m->tt[k+1]*0.00126+1<<endl;        // ehuxle (mmol N m-3)
+	outx<<m->tt[k+1]/24.0<<"  "<<m->y[10][k+1]<<"  "<<m->tt[k+1]*0.00126+1<<endl;       // ammoni (mmol N m-3)
+	outz<<m->tt[k+1]/24.0<<"  "<<12*CTON*m->y[9][k+1]<<"  "<<m->tt[k+1]*0.00126+1<<endl;// ehuxle (mg org-C m-3)
+	outf<<m->tt[k+1]/24.0<<"  "<<12*m->y[11][k+1]<<"  "<<m->tt[k+1]*0.00126+1<<endl;    // at coc (mg cal-C m-3)
+	outg<<m->tt[k+1]/24.0<<"  "<<12*m->y[12][k+1]<<"  "<<m->tt[k+1]*0.00126+1<<endl;    // fr coc (mg cal-C m-3)
+	outdic<<m->tt[k+1]/24.0<<"  "<<m->y[13][k+1]<<"  "<<m->tt[k+1]*0.00126+1<<endl;     // Total CO2 (umol C kg-1)
+	outalk<<m->tt[k+1]/24.0<<"  "<<m->y[14][k+1]<<"  "<<m->tt[k+1]*0.00126+1<<endl;     // Total Alk (uEq kg-1)
+	outctochl<<m->tt[k+1]/24.0<<"  "<<1.0/chlcd<<"  "<<1.0/chlcdf<<"  "<<1.0/chlcf
+                 <<"  "<<1.0/chlceh<<"  "<<m->tt[k+1]*0.00126+1<<endl;  // C:Chl seasonal ratio
+
+	outluce<<m->tt[k+1]/24.0<<"  "<<luce<<"  "<<m->tt[k+1]*0.00126+1<<endl;
 
 
 	// ============= DIAGNOSTIC OUTPUT =============
 	//
 	// to obtain PP in units of mmol C m-2 d-1 multiply by 24.0*mixed*CTON
-	outcp<<tt[k+1]/24.0<<"  "<<tt[k+1]+HSTEP*yy<<"  "<<calcieh/(CTON*photoeh)
-             <<"  "<<newphypro/(newphypro+regphypro)<<"  "<<totphypro<<"  "<<(newphypro+regphypro)
-             <<"  "<<pon<<"  "<<totzoopro<<"  "<<1.0/(chlcd+chlcf+chlcdf+chlceh)*4
-             <<"  "<<y[14][k+1]<<"  "<<salin<<"  "<<newphypro<<"  "<<regphypro
-             <<"  "<<totphyloss<<"  "<<totzooloss<<"  "<<totphymix
-             <<"  "<<dialightgro<<"  "<<dinlightgro<<"  "<<flalightgro<<"  "<<ehulightgro
-             <<"  "<<dianutgro<<"  "<<dinnutgro<<"  "<<flanutgro<<"  "<<ehunutgro
-             <<"  "<<callightgro<<"  "<<caltemgro<<"  "<<diagra<<"  "<<dingra<<"  "<<flagra
-             <<"  "<<ehugra<<"  "<<micgra<<endl;
-
-	outinf<<regdiapro<<"  "<<regdinpro<<"  "<<regflapro<<"  "<<regehupro<<"  "<<amm<<endl;
+	outcp<<m->tt[k+1]/24.0<<"  "<<m->tt[k+1]+HSTEP*m->yy<<"  "<<m->calcieh/(CTON*m->photoeh)
+             <<"  "<<m->newphypro/(m->newphypro+m->regphypro)<<"  "<<m->totphypro<<"  "<<(m->newphypro+m->regphypro)
+             <<"  "<<m->pon<<"  "<<m->totzoopro<<"  "<<1.0/(chlcd+chlcf+chlcdf+chlceh)*4
+             <<"  "<<m->y[14][k+1]<<"  "<<salin<<"  "<<m->newphypro<<"  "<<m->regphypro
+             <<"  "<<m->totphyloss<<"  "<<m->totzooloss<<"  "<<m->totphymix
+             <<"  "<<m->dialightgro<<"  "<<m->dinlightgro<<"  "<<m->flalightgro<<"  "<<m->ehulightgro
+             <<"  "<<m->dianutgro<<"  "<<m->dinnutgro<<"  "<<m->flanutgro<<"  "<<m->ehunutgro
+             <<"  "<<m->callightgro<<"  "<<m->caltemgro<<"  "<<m->diagra<<"  "<<m->dingra<<"  "<<m->flagra
+             <<"  "<<m->ehugra<<"  "<<m->micgra<<endl;
+
+	outinf<<m->regdiapro<<"  "<<m->regdinpro<<"  "<<m->regflapro<<"  "<<m->regehupro<<"  "<<amm<<endl;
 
 	// N:P ratio
 	//       jday                  month                      N/P                     P                N
-	out20<<tt[k+1]/24<<"  "<<tt[k+1]*0.00126+1<<"  "<<y[3][k+1]/y[10][k+1]<<"  "<<y[10][k+1]<<"  "<<y[3][k+1]<<endl;
+	out20<<m->tt[k+1]/24<<"  "<<m->tt[k+1]*0.00126+1<<"  "<<m->y[3][k+1]/m->y[10][k+1]<<"  "<<m->y[10][k+1]<<"  "<<m->y[3][k+1]<<endl;
 
 	// Water pCO2
-	outpco<<tt[k+1]/24.0<<"  "<<pco2w*1.0e6<<"  "<<tt[k+1]*0.00126+1<<endl; // water pCO2 (uatm) 
-	outco3<<tt[k+1]/24.0<<"  "<<co32<<"  "<<tt[k+1]*0.00126+1<<endl;        // [CO3=] (umol C kg-1)
-	outoca<<tt[k+1]/24.0<<"  "<<o_cal<<"  "<<tt[k+1]*0.00126+1<<endl;       // omega-calcite 
-	outora<<tt[k+1]/24.0<<"  "<<o_ara<<"  "<<tt[k+1]*0.00126+1<<endl;       // omega-aragonite
-        outoph<<tt[k+1]/24.0<<"  "<<ph<<"  "<<tt[k+1]*0.00126+1<<endl;          // pH 
-        outobi<<tt[k+1]/24.0<<"  "<<bica<<"  "<<tt[k+1]*0.00126+1<<endl;        // [HCO3-] (umol C kg-1)
+	outpco<<m->tt[k+1]/24.0<<"  "<<m->pco2w*1.0e6<<"  "<<m->tt[k+1]*0.00126+1<<endl; // water pCO2 (uatm) 
+	outco3<<m->tt[k+1]/24.0<<"  "<<m->co32<<"  "<<m->tt[k+1]*0.00126+1<<endl;        // [CO3=] (umol C kg-1)
+	outoca<<m->tt[k+1]/24.0<<"  "<<m->o_cal<<"  "<<m->tt[k+1]*0.00126+1<<endl;       // omega-calcite 
+	outora<<m->tt[k+1]/24.0<<"  "<<m->o_ara<<"  "<<m->tt[k+1]*0.00126+1<<endl;       // omega-aragonite
+        outoph<<m->tt[k+1]/24.0<<"  "<<m->ph<<"  "<<m->tt[k+1]*0.00126+1<<endl;          // pH 
+        outobi<<m->tt[k+1]/24.0<<"  "<<m->bica<<"  "<<m->tt[k+1]*0.00126+1<<endl;        // [HCO3-] (umol C kg-1)
 
 
 	// ================ MAIN OUTPUT ================
 	//
-	outres<<tt[k+1]/24.0<<"  "<<tt[k+1]+HSTEP*yy<<"  "<<temp<<"  "<<mixed<<"  "<<salin<<"  "<<esurf
-               <<"  "<<wspeed<<"  "<<NTOC*chlcd*y[1][k+1]<<"  "<<NTOC*chlcf*y[2][k+1]<<"  "<<NTOC*chlcdf*y[8][k+1]
-               <<"  "<<NTOC*chlceh*y[9][k+1]<<"  "<<NTOCZ*y[7][k+1]<<"  "<<NTOCZ*y[5][k+1]<<"  "
-	       <<NTOC*(chlcd*y[1][k+1]+chlcdf*y[2][k+1]+chlcf*y[8][k+1]+chlceh*y[9][k+1])<<"  "
-               <<"  "<<y[3][k+1]<<"  "<<y[10][k+1]<<"  "<<y[4][k+1]<<"  "<<y[13][k+1]<<"  "
-               <<y[14][k+1]<<"  "<<pco2w*1.0e6<<"  "<<co32<<"  "<<o_cal<<"  "<<o_ara<<"  "
-	       <<12*y[11][k+1]<<"   "<<12*y[12][k+1]<<"  "<<co2aq<<"  "<<bica<<"  "
-	       <<NTOCZ*(y[5][k+1]+y[7][k+1])<<"  "<<grazd<<"  "<<graze<<"  "<<ph<<"  "
-	      <<ingDI<<"  "<<ingEH<<"  "<<wspeed<<"  "<<gtv<<"  "<<(y[3][k+1]+y[10][k+1])<<endl;
+	outres<<m->tt[k+1]/24.0<<"  "<<m->tt[k+1]+HSTEP*m->yy<<"  "<<temp<<"  "<<m->mixed<<"  "<<salin<<"  "<<m->esurf
+               <<"  "<<wspeed<<"  "<<NTOC*chlcd*m->y[1][k+1]<<"  "<<NTOC*chlcf*m->y[2][k+1]<<"  "<<NTOC*chlcdf*m->y[8][k+1]
+               <<"  "<<NTOC*chlceh*m->y[9][k+1]<<"  "<<NTOCZ*m->y[7][k+1]<<"  "<<NTOCZ*m->y[5][k+1]<<"  "
+	       <<NTOC*(chlcd*m->y[1][k+1]+chlcdf*m->y[2][k+1]+chlcf*m->y[8][k+1]+chlceh*m->y[9][k+1])<<"  "
+               <<"  "<<m->y[3][k+1]<<"  "<<m->y[10][k+1]<<"  "<<m->y[4][k+1]<<"  "<<m->y[13][k+1]<<"  "
+               <<m->y[14][k+1]<<"  "<<m->pco2w*1.0e6<<"  "<<m->co32<<"  "<<m->o_cal<<"  "<<m->o_ara<<"  "
+	       <<12*m->y[11][k+1]<<"   "<<12*m->y[12][k+1]<<"  "<<m->co2aq<<"  "<<m->bica<<"  "
+	       <<NTOCZ*(m->y[5][k+1]+m->y[7][k+1])<<"  "<<m->grazd<<"  "<<m->graze<<"  "<<m->ph<<"  "
+	      <<m->ingDI<<"  "<<m->ingEH<<"  "<<wspeed<<"  "<<m->gtv<<"  "<<(m->y[3][k+1]+m->y[10][k+1])<<endl;
 
 	// total phytoplankton in: ug Chl L-1 (assumed = mg Chl m-3)
 	// From:
@@ -1613,370 +1219,2072 @@ void rkdriver(double vstart[], int nvar, double t1, double t2, int nstep,
 	// nutrient growth rate (Cloern et al., 1995)
 	// Therefore to transform units from N to Chl use factor:
 	// (C:N)*(Chl:C) =  79.5*Chl:C
-        outt<<tt[k+1]/24<<"  "<<NTOC*(chlcd*y[1][k+1]+chlcdf*y[2][k+1]+chlcf*y[8][k+1]+chlceh*y[9][k+1])
-            <<"  "<<tt[k+1]*0.00126+1<<endl; 
+        outt<<m->tt[k+1]/24<<"  "<<NTOC*(chlcd*m->y[1][k+1]+chlcdf*m->y[2][k+1]+chlcf*m->y[8][k+1]+chlceh*m->y[9][k+1])
+            <<"  "<<m->tt[k+1]*0.00126+1<<endl; 
 
 	// total zooplankton in: ug C/l (assumed = mg C/m3)
-	outy<<tt[k+1]/24<<"  "<<NTOCZ*(y[5][k+1]+y[7][k+1])<<"  "<<tt[k+1]*0.00126+1<<endl;
+	outy<<m->tt[k+1]/24<<"  "<<NTOCZ*(m->y[5][k+1]+m->y[7][k+1])<<"  "<<m->tt[k+1]*0.00126+1<<endl;
 
 	//outa<<tt[k+1]/24<<"   "<<MUD0*varT*24<<endl;   // save max growth vs. time for diatoms
 	//outb<<tt[k+1]/24<<"   "<<MUDF0*varT*24<<endl;  // save max growth vs. time for flagellates
-	outa<<temp<<"   "<<MUD0*varT*24<<endl;     // save max growth vs. temperature for diatoms
-	outb<<temp<<"   "<<MUDF0*varT*24<<endl;    // save max growth vs. temperature for flagellates
+	outa<<temp<<"   "<<MUD0*m->varT*24<<endl;     // save max growth vs. temperature for diatoms
+	outb<<temp<<"   "<<MUDF0*m->varT*24<<endl;    // save max growth vs. temperature for flagellates
 	
-	outc<<tt[k+1]/24<<"   "<<tt[k+1]*0.00126+1<<"  "<<psi<<endl;    // averaged light intensity vs. time 
-	outmi<<tt[k+1]/24<<"  "<<tt[k+1]*0.00126+1<<"   "<<mixed<<endl; // mixed layer depth
+	outc<<m->tt[k+1]/24<<"   "<<m->tt[k+1]*0.00126+1<<"  "<<m->psi<<endl;    // averaged light intensity vs. time 
+	outmi<<m->tt[k+1]/24<<"  "<<m->tt[k+1]*0.00126+1<<"   "<<m->mixed<<endl; // mixed layer depth
 	//outd<<tt[k+1]/24<<"  "<<tt[k+1]*0.00126+1<<"   "<<esurf/4.17<<endl;// light at surf (W m-2)  
       
       }                               
                             
       // save multi-year results daily
-      if(fmod(k,24)==0){
+      if(m->out && fmod(k,24)==0){
 	//outd<<tt[k+1]+HSTEP*yy)/TIME<<"   "<<esurf/4.17<<endl;// light at surf (W m-2)
-	outu<<(tt[k+1]+HSTEP*yy)/TIME<<"  "<<dia+fla+din+ehu<<endl;  // save total phyto in mmol N m-3
-	out19<<(tt[k+1]+HSTEP*yy)/TIME<<"  "<<mic+mes<<endl;         // save total zoopl in mmol N m-3
-	out15<<(tt[k+1]+HSTEP*yy)/TIME<<"  "<<pco2w*1.0e6<<endl;     // save pCO2 in seawater 
-	out16<<(tt[k+1]+HSTEP*yy)/TIME<<"  "<<co32<<endl;            // save [CO32-]  
-	out17<<(tt[k+1]+HSTEP*yy)/TIME<<"  "<<o_cal<<endl;           // save omega-calcite
-	out18<<(tt[k+1]+HSTEP*yy)/TIME<<"  "<<o_ara<<endl;           // save omega-aragonite
+	outu<<(m->tt[k+1]+HSTEP*m->yy)/TIME<<"  "<<dia+fla+din+ehu<<endl;  // save total phyto in mmol N m-3
+	out19<<(m->tt[k+1]+HSTEP*m->yy)/TIME<<"  "<<mic+mes<<endl;         // save total zoopl in mmol N m-3
+	out15<<(m->tt[k+1]+HSTEP*m->yy)/TIME<<"  "<<m->pco2w*1.0e6<<endl;     // save pCO2 in seawater 
+	out16<<(m->tt[k+1]+HSTEP*m->yy)/TIME<<"  "<<m->co32<<endl;            // save [CO32-]  
+	out17<<(m->tt[k+1]+HSTEP*m->yy)/TIME<<"  "<<m->o_cal<<endl;           // save omega-calcite
+	out18<<(m->tt[k+1]+HSTEP*m->yy)/TIME<<"  "<<m->o_ara<<endl;           // save omega-aragonite
+
+	// binary results, as in rscol
+	double r[NRCOL]={m->tt[k+1]+HSTEP*m->yy,
+			 m->y[1][k+1],m->y[2][k+1],m->y[3][k+1],m->y[4][k+1],m->y[5][k+1],m->y[6][k+1],m->y[7][k+1],
+			 m->y[8][k+1],m->y[9][k+1],m->y[10][k+1],m->y[11][k+1],m->y[12][k+1],m->y[13][k+1],m->y[14][k+1],
+			 temp,m->mixed,salin,m->esurf,wspeed,
+			 NTOC*(chlcd*m->y[1][k+1]+chlcdf*m->y[2][k+1]+chlcf*m->y[8][k+1]+chlceh*m->y[9][k+1]),
+			 m->pco2w*1.0e6,m->co32,m->o_cal,m->o_ara,m->ph,m->bica,m->co2aq,m->psi,
+			 m->newphypro,m->regphypro,m->totphypro,m->totzoopro,m->totphyloss,m->totzooloss,m->totphymix,
+			 m->calcieh,m->photoeh,m->grazd,m->graze};
+	put_results_row(r);
       }
       
       // save poincare' sections
-      if(yy>IGNY && k==HOFY){
-	outv<<y[1][k+1]+y[2][k+1]<<"  "<<y[5][k+1]<<endl;  // save Z-P
+      if(m->out && m->yy>IGNY && k==HOFY){
+	outv<<m->y[1][k+1]+m->y[2][k+1]<<"  "<<m->y[5][k+1]<<endl;  // save Z-P
       }
       
       // new initial conditions
       if(k==nstep-3){
-	vstart[1]=y[1][k+1];
-	vstart[2]=y[2][k+1];
-	vstart[3]=y[3][k+1];
-	vstart[4]=y[4][k+1];
-	vstart[5]=y[5][k+1];
-	vstart[6]=y[6][k+1];
-	vstart[7]=y[7][k+1];
-	vstart[8]=y[8][k+1];
-	vstart[9]=y[9][k+1];
-	vstart[10]=y[10][k+1];
-	vstart[11]=y[11][k+1];
-	vstart[12]=y[12][k+1];
-	vstart[13]=y[13][k+1];
-	vstart[14]=y[14][k+1];
-
-	yi1=vstart[1];
-	yi2=vstart[2];
-	yi3=vstart[3];
-	yi4=vstart[4];
-	yi5=vstart[5];
-	yi6=vstart[6];
-	yi7=vstart[7];
-	yi8=vstart[8];
-	yi9=vstart[9];
-	yi10=vstart[10];
-	yi11=vstart[11];
-	yi12=vstart[12];
-	yi13=vstart[13];
-	yi14=vstart[14];
+	vstart[1]=m->y[1][k+1];
+	vstart[2]=m->y[2][k+1];
+	vstart[3]=m->y[3][k+1];
+	vstart[4]=m->y[4][k+1];
+	vstart[5]=m->y[5][k+1];
+	vstart[6]=m->y[6][k+1];
+	vstart[7]=m->y[7][k+1];
+	vstart[8]=m->y[8][k+1];
+	vstart[9]=m->y[9][k+1];
+	vstart[10]=m->y[10][k+1];
+	vstart[11]=m->y[11][k+1];
+	vstart[12]=m->y[12][k+1];
+	vstart[13]=m->y[13][k+1];
+	vstart[14]=m->y[14][k+1];
+
+	m->yi[1]=vstart[1];
+	m->yi[2]=vstart[2];
+	m->yi[3]=vstart[3];
+	m->yi[4]=vstart[4];
+	m->yi[5]=vstart[5];
+	m->yi[6]=vstart[6];
+	m->yi[7]=vstart[7];
+	m->yi[8]=vstart[8];
+	m->yi[9]=vstart[9];
+	m->yi[10]=vstart[10];
+	m->yi[11]=vstart[11];
+	m->yi[12]=vstart[12];
+	m->yi[13]=vstart[13];
+	m->yi[14]=vstart[14];
       }
       
       conta++;
       
-      chlo=NTOC*(chlcd*y[1][k+1]+chlcdf*y[2][k+1]+chlcf*y[8][k+1]+chlceh*y[9][k+1]);
+      chlo=NTOC*(chlcd*m->y[1][k+1]+chlcdf*m->y[2][k+1]+chlcf*m->y[8][k+1]+chlceh*m->y[9][k+1]);
 
-      sil=y[4][k+1];
-      amm=y[10][k+1];
-      tco2=y[13][k+1];   
-      alk=y[14][k+1];
+      sil=m->y[4][k+1];
+      amm=m->y[10][k+1];
+      tco2=m->y[13][k+1];   
+      alk=m->y[14][k+1];
 
     }
-    
-    free_dvector(dv,1,nvar);
-    free_dvector(vout,1,nvar);
-    free_dvector(v,1,nvar);
+
+    if(m->out) put_results_year(m->yy);
+
+    if(m->yy<get_spinup()){   // spin-up: stop it if the state is periodic
+      m->nspin++;
+      if(get_periodic(m,vprev,vstart)){
+	i=get_last_year(m);
+	if(m->out) cout<<"   periodic state after "<<m->nspin<<" years of spin-up, "
+		       <<i-m->yy<<" years skipped"<<endl;
+	m->yy=i;
+      }
+      for(i=1;i<=nvar;i++) vprev[i]=vstart[i];
+    }
+
+#if CHECKPOINT
+    if(m->yy<get_spinup()) put_checkpoint(m,m->yy+1,vstart,carb.ah);
+#endif
+
+    if(m->out){
+      cout<<"   [H+] iterations per step: "<<(double)hiter/(nstep-3)<<endl;
+#if NRCOUNT
+      cout<<"   heap allocations in the time loop: "<<nr_nalloc-nalloc<<endl;
+#endif
+      cout<<"   derivs evaluations: "<<m->nrhs-nrhs0<<endl;
+      if(m->nhfail>nhfail0)
+	cout<<"   [H+] not converged in "<<HITMAX<<" iterations: "<<m->nhfail-nhfail0<<" times"<<endl;
+#if INTEGRATOR>=2
+      cout<<"   steps accepted: "<<m->adapt.nacc<<", rejected: "<<m->adapt.nrej<<endl;
+#endif
+    }
   
   
   }
+  end_model(m);
 }
 
-void rk4(double y[], double dydt[], int n, double t, double h, double yout[],
-	 void (*derivs)(double, double [], double []))
+
+// set the forcing of year m->yy (and the forcing table for it),
+// the cross-thermocline mixing and the nutrients below the MLD
+void set_year(model *m)
 {
-  int i;
-  double th, hh, h6;
-  double *dym, *dyt, *yt;
+  m->diff=mm;
+
+  if(m->yy==3) m->diff=mm95;
+  if(m->yy==4) m->diff=mm96;
+  if(m->yy==5) m->diff=mm97;
+  if(m->yy==6) m->diff=mm98;
+  if(m->yy==7) m->diff=mm99;
+  if(m->yy==8) m->diff=mm00;
+  if(m->yy==9) m->diff=mm01;
+
+  m->nbo=N0;
+  m->sbo=S0;
+
+  if(m->yy==2){
+    m->nbo=N094;
+    m->sbo=S094;
+  }
 
-  dym=dvector(1,n);
-  dyt=dvector(1,n);
-  yt=dvector(1,n);
+  if(m->yy==4){
+    m->nbo=N095;
+    m->sbo=S095;
+  }
 
-  hh=h*0.5;
-  h6=h/6.0;
-  th=t+hh;
+  if(m->yy==4){
+    m->nbo=N096;
+    m->sbo=S096;
+  }
 
-  for(i=1;i<=n;i++) yt[i]=y[i]+hh*dydt[i];  // first step
-  (*derivs)(th,yt,dyt);                     // second step
-  for(i=1;i<=n;i++) yt[i]=y[i]+hh*dyt[i];
-  (*derivs)(th,yt,dym);                     // third step
-  for(i=1;i<=n;i++){
-    yt[i]=y[i]+h*dym[i];
-    dym[i]+=dyt[i];
+  if(m->yy==5){
+    m->nbo=N097;
+    m->sbo=S097;
   }
-  (*derivs)(t+h,yt,dyt);                    // fourth step 
-  // accumulate increments with proper weights
-  for(i=1;i<=n;i++) yout[i]=y[i]+h6*(dydt[i]+dyt[i]+2.0*dym[i]);
 
-  free_dvector(yt,1,n); 
-  free_dvector(dyt,1,n);
-  free_dvector(dym,1,n);
-}
+  if(m->yy==6){
+    m->nbo=N098;
+    m->sbo=S098;
+  }
 
+  if(m->yy==6){
+    m->nbo=N099;
+    m->sbo=S099;
+  }
 
-//============================= DERIVS ROUTINE ================================
+  if(m->yy==7){
+    m->nbo=N000;
+    m->sbo=S000;
+  }
 
+  if(m->yy==8){
+    m->nbo=N001;
+    m->sbo=S001;
+  }
 
-void derivs(double t, double y[], double dydt[])
-{
 
-  double phid, phif, phidf,phieh,phis;
-  double phinr, phiar; 
+  // The model is run for a number of years to stabilize it
+  // and in order to look at steady-state results. But
+  // when a transient result is needed (last year forcing
+  // different than all previous years) then the variable 
+  // 'trans' is set TRUE and different MLD and TEM forcing 
+  // functions are used for last year run. 
 
-  double sinkd=0.0;
-  double sinko=0.0;
+  // === forcing of the year, as in CATALOG ===
+  int year=get_calendar_year(m->yy);
+  if(m->out){
+    if(year) cout<<" year "<<year<<endl;
+    else cout<<" year before 1995"<<endl;
+  }
+  get_catalog_year(m,year);  // with its forcing table
+}
 
-  // grazing terms
-  double g1=0.0;
-  double g2=0.0;
-  double g3=0.0;
-  double g4=0.0;
-  double g5=0.0;
-  double g7=0.0;
-  double g8=0.0;
-  double g9=0.0;  
 
-  double varHp;
+// ===== FORCING STORE =====
+
+// The text forcing files (./input/*.in) are converted once (./a.out -convert)
+// into a single binary file, FORCING, which is then mapped in memory: the
+// forcing arrays point into it, with no parsing and no copy.
+//   header  FSMAGIC and the number of files
+//   entries for each file: its name, the size and time of modification of
+//           the text file it was made from (the entry is not used when the
+//           text file has changed since), the offset of its column and the
+//           number of values
+//   columns the values as float64, each followed by zeros up to at least
+//           FSMIN values and aligned to FSALIGN bytes
+// The text loader gives the same arrays, with the same zeros after the
+// values, so that the results do not depend on where the forcing came from.
+
+#define FSMAGIC "PBSFORC1"
+#define FSALIGN 64         // alignment of the columns [byte]
+#define FSMIN (HSTEP+2)    // min length of a column, dM/dt reads one value past the year
+
+struct forcing_header {
+  char magic[8];
+  long nfile;
+};
+
+struct forcing_entry {
+  char name[48];           // name of the text file (without its directory)
+  long size, mtime;        // size and time of modification of the text file
+  long offset;             // offset of the column from the start of the store [byte]
+  long n;                  // number of values
+};
+
+static char *fsmap=NULL;   // the store, as mapped (NULL if not mapped)
+static size_t fssize=0;    // and its size
+
+// length of a column of n values with its zeros
+static long get_forcing_length(long n)
+{
+  long l=n+2<FSMIN ? FSMIN : n+2;
+  return (l+FSALIGN/sizeof(double)-1)/(FSALIGN/sizeof(double))*(FSALIGN/sizeof(double));
+}
 
-  double calc=0.0;
-  double cocpereh=0.0;
-  double detach=0.0;
+static int is_space(char c)
+{
+  return c==' ' || c=='\n' || c=='\t' || c=='\r';
+}
 
-  double ad=0.0;
-  double af=0.0;
-  double adf=0.0;
-  double aeh=0.0;
+// the number in s..e to *v, as istream >> would read it; FALSE if it is not one
+static int get_text_value(const char *s, const char *e, double *v)
+{
+  if(s<e && *s=='+') s++;       // not taken by from_chars
+  std::from_chars_result r=std::from_chars(s,e,*v);
+  return r.ec==std::errc() && r.ptr==e;
+}
 
-  varHp=max(varH,0.0);
+// the values of a text file, with zeros after them as in the store; NULL
+// if it cannot be opened or holds something else than numbers. The file is
+// read with one read() and parsed with from_chars (no locale, no copies).
+static double *get_forcing_text(const char *file, long *n)
+{
+  struct stat st;
+  long l, r, nv=0;
+  char *buf, *p, *q, *e;
+  double *a;
+
+  int fd=open(file,O_RDONLY);
+  if(fd<0) return NULL;
+  if(fstat(fd,&st)){
+    close(fd);
+    return NULL;
+  }
+  buf=new char[st.st_size+1];
+  for(l=0;l<st.st_size && (r=read(fd,buf+l,st.st_size-l))>0;l+=r);
+  close(fd);
+  e=buf+l;
+
+  for(p=buf;p<e;p++) if(!is_space(*p) && (p==buf || is_space(p[-1]))) nv++;
+  a=dvector(0,get_forcing_length(nv)-1);
+  for(p=buf, l=0;l<nv;l++){
+    while(is_space(*p)) p++;
+    for(q=p;q<e && !is_space(*q);q++);
+    if(!get_text_value(p,q,&a[l])){
+      cout<<" "<<file<<": not a number at value "<<l+1<<": "<<std::string(p,q-p)<<endl;
+      free_dvector(a,0,0);
+      delete [] buf;
+      return NULL;
+    }
+    p=q;
+  }
+  memset(a+nv,0,(get_forcing_length(nv)-nv)*sizeof(double));
+  delete [] buf;
+  *n=nv;
+  return a;
+}
 
-  //cout<<varHp<<"  "<<varH<<endl;
+// as get_forcing_text, with istream >> as the model did before (for bench_forcing)
+static double *get_forcing_iostream(const char *file, long *n)
+{
+  long l=0, cap=HSTEP;
+  double v, *a;
+  double *buf=(double *)malloc(cap*sizeof(double));
+
+  ifstream in(file);
+  while(in>>v){
+    if(l==cap) buf=(double *)realloc(buf,(cap*=2)*sizeof(double));
+    buf[l++]=v;
+  }
 
-  //========================= AMMONIA ==========================
+  a=dvector(0,get_forcing_length(l)-1);
+  memcpy(a,buf,l*sizeof(double));
+  memset(a+l,0,(get_forcing_length(l)-l)*sizeof(double));
+  free(buf);
+  *n=l;
+  return a;
+}
 
-  //phid=min(y[3]/(y[3]+NHD),y[10]/(y[10]+PHD));
-  //phif=min(y[3]/(y[3]+NHF),y[10]/(y[10]+PHF));
-  //phidf=min(y[3]/(y[3]+NHDF),y[10]/(y[10]+PHDF));
-  //phieh=min(y[3]/(y[3]+NHEH),0.7+(0.3*y[10]/(y[10]+PHEH)));
+// map FORCING, if it is there and valid
+static void set_forcing_store(void)
+{
+  struct stat st;
+  forcing_header *hd;
+  forcing_entry *e;
+  long i;
+
+  if(fsmap) return;
+
+  int fd=open(FORCING,O_RDONLY);
+  if(fd<0) return;
+  if(fstat(fd,&st) || st.st_size<(off_t)sizeof(forcing_header)){
+    close(fd);
+    return;
+  }
+  void *p=mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+  close(fd);
+  if(p==MAP_FAILED) return;
+
+  hd=(forcing_header *)p;
+  e=(forcing_entry *)(hd+1);
+  int ok=!memcmp(hd->magic,FSMAGIC,8) && hd->nfile>=0
+    && sizeof(forcing_header)+hd->nfile*sizeof(forcing_entry)<=(size_t)st.st_size;
+  for(i=0;ok && i<hd->nfile;i++)
+    ok=e[i].offset%FSALIGN==0 && e[i].n>=0
+      && e[i].offset+get_forcing_length(e[i].n)*sizeof(double)<=(size_t)st.st_size;
+  if(!ok){
+    cout<<" "<<FORCING<<" is not a forcing store, the text files are used"<<endl;
+    munmap(p,st.st_size);
+    return;
+  }
+  fsmap=(char *)p;
+  fssize=st.st_size;
+}
 
-  double qd1=0.0;
-  double qd2=0.0;
-  double qf1=0.0;
-  double qf2=0.0;
-  double qdf1=0.0;
-  double qdf2=0.0;
-  double qeh1=0.0;
-  double qeh2=0.0;
-  
-  int i;
-  for(i=1;i<=14;i++) y[i]=fabs(y[i]);
+// unmap FORCING
+void free_forcing_store(void)
+{
+  if(fsmap) munmap(fsmap,fssize);
+  fsmap=NULL;
+  fssize=0;
+}
 
-  qd1=(y[3]/NHD)/(1.0 + y[3]/NHD + y[10]/AHD);
-  qd2=(y[10]/AHD)/(1.0 + y[3]/NHD + y[10]/AHD);
+// entry of the forcing file in the store, NULL if the store does not hold
+// it or the text file changed since
+static forcing_entry *get_forcing_entry(const char *file)
+{
+  struct stat st;
+  long i;
+  const char *name=strrchr(file,'/') ? strrchr(file,'/')+1 : file;
+
+  set_forcing_store();
+  if(!fsmap) return NULL;
+
+  forcing_header *hd=(forcing_header *)fsmap;
+  forcing_entry *e=(forcing_entry *)(hd+1);
+  int text=!stat(file,&st);
+  for(i=0;i<hd->nfile;i++){
+    if(strcmp(e[i].name,name)) continue;
+    if(text && (e[i].size!=st.st_size || e[i].mtime!=st.st_mtime)){
+      cout<<" "<<file<<" changed since "<<FORCING<<" was made, it is parsed"<<endl;
+      return NULL;
+    }
+    return &e[i];
+  }
+  return NULL;
+}
 
-  qf1=(y[3]/NHF)/(1.0 + y[3]/NHF + y[10]/AHF);
-  qf2=(y[10]/AHF)/(1.0 + y[3]/NHF + y[10]/AHF);
-  
-  qdf1=(y[3]/NHDF)/(1.0 + y[3]/NHDF + y[10]/AHDF);
-  qdf2=(y[10]/AHDF)/(1.0 + y[3]/NHDF + y[10]/AHDF);
-  
-  //if(yy<Y-6){ 
-  //  qeh1=0.0;
-  //  qeh2=0.0;
-  //}
-  //else{
-  qeh1=(y[3]/NHEH)/(1.0 + y[3]/NHEH + y[10]/AHEH);
-  qeh2=(y[10]/AHEH)/(1.0 + y[3]/NHEH + y[10]/AHEH);
-  //}
+// TRUE if the forcing file can be loaded
+int has_forcing(const char *file)
+{
+  struct stat st;
+  return !stat(file,&st) || get_forcing_entry(file);
+}
 
-  phid = qd1 + qd2;    //(y[3]/NHD + y[10]/AHD)/(1 + y[3]/NHD + y[10]/AHD);
-  phif = qf1 + qf2;    //(y[3]/NHF + y[10]/AHF)/(1 + y[3]/NHF + y[10]/AHF);
-  phidf = qdf1 + qdf2; //(y[3]/NHDF + y[10]/AHDF)/(1 + y[3]/NHDF + y[10]/AHDF);
-  phieh = qeh1 + qeh2; //(y[3]/NHEH + y[10]/AHEH)/(1 + y[3]/NHEH + y[10]/AHEH);
+// *a points to the values of the forcing file, in the store if it holds it
+// and the text file did not change since, else parsed from the text file;
+// returns the number of values, -1 if neither has the file
+long load_forcing(const char *file, double **a)
+{
+  long n;
+  forcing_entry *e=get_forcing_entry(file);
 
-  //============================================================
+  if(e){
+    *a=(double *)(fsmap+e->offset);
+    return e->n;
+  }
+  *a=get_forcing_text(file,&n);
+  return *a ? n : -1;
+}
 
+// load_forcing of nf files at once, on FLTHREADS threads; parsing the text
+// files even if the store has them if text is TRUE
+void load_forcing_files(int nf, const char *const file[], double *a[], long n[], int text)
+{
+  int j, nt=(nf<FLTHREADS) ? nf : FLTHREADS;
+  std::atomic<int> next(0);
+  std::thread *pool=new std::thread[nt];
+
+  if(!text) set_forcing_store();          // before the threads look into it
+  for(j=0;j<nt;j++){
+    pool[j]=std::thread([&](){
+      int l;
+      while((l=next++)<nf){
+	if(text) n[l]=(a[l]=get_forcing_text(file[l],&n[l])) ? n[l] : -1;
+	else n[l]=load_forcing(file[l],&a[l]);
+      }
+    });
+  }
+  for(j=0;j<nt;j++) pool[j].join();
+  delete [] pool;
+}
 
-  phis=y[4]/(y[4]+SH); 
+// free an array of load_forcing (nothing if it is in the store)
+void free_forcing(double *a)
+{
+  if(!a || (fsmap && (char *)a>=fsmap && (char *)a<fsmap+fssize)) return;
+  free_dvector(a,0,0);
+}
 
-  phid=min(phid,phis);
+// dM/dt from the MLD, as in FASH93 at pag.493 (1.0 is the time interval, 1 hour)
+double *get_mld_change(const double *mld)
+{
+  double *d=dvector(1,HSTEP);
 
-  // microzooplankton grazing 
-  // g2: on flagellates
-  // g5: on Ehuxleyi
-  // g7: on diatoms
-  // g8: on detritus
-  //g2=ZMIF*P2*y[2]*y[2]*y[7]/(KMIG*(P2*y[2]+P5*y[9]+P7*y[1])+(P2*y[2]*y[2]+P5*y[9]*y[9]+P7*y[1]*y[1])); 
-  //g5=ZMIE*P5*y[9]*y[9]*y[7]/(KMIG*(P2*y[2]+P5*y[9]+P7*y[1])+(P2*y[2]*y[2]+P5*y[9]*y[9]+P7*y[1]*y[1])); 
-  //g7=ZMID*P7*y[1]*y[1]*y[7]/(KMIG*(P2*y[2]+P5*y[9]+P7*y[1])+(P2*y[2]*y[2]+P5*y[9]*y[9]+P7*y[1]*y[1]));
-  //g7=0.0;
+  for(int h=0;h<=HSTEP;h++) d[h]=(mld[h+1]-mld[h])/1.0;
+  return d;
+}
 
-  ingDI=0.45/(tanh(y[4])+y[4]);
+// names of the text files (*.in) in dir, sorted; returns their number
+static int get_forcing_files(const char *dir, char name[][48], int nmax)
+{
+  int n=0, l;
+  struct dirent *d;
+  DIR *dp=opendir(dir);
+
+  if(!dp) return 0;
+  while((d=readdir(dp)) && n<nmax){
+    l=strlen(d->d_name);
+    if(l<4 || l>=48 || strcmp(d->d_name+l-3,".in")) continue;
+    strcpy(name[n++],d->d_name);
+  }
+  closedir(dp);
+  qsort(name,n,48,(int (*)(const void *, const void *))strcmp);
+  return n;
+}
 
-  if(yy<Y-6){ 
-    g7=0.0;//ZMID*P7d*y[1]*y[1]*y[7]/(KMIG*(P2d*y[2]+P5d*y[9]+P7d*y[1])+(P2d*y[2]*y[2]+P5d*y[9]*y[9]+P7d*y[1]*y[1]));
-    g5=ZMIE*P5d*y[9]*y[9]*y[7]/(KMIG*(P2d*y[2]+P5d*y[9]+P7d*y[1])+(P2d*y[2]*y[2]+P5d*y[9]*y[9]+P7d*y[1]*y[1]));
-    g2=ZMIF*P2d*y[2]*y[2]*y[7]/(KMIG*(P2d*y[2]+P5d*y[9]+P7d*y[1])+(P2d*y[2]*y[2]+P5d*y[9]*y[9]+P7d*y[1]*y[1]));
-  }  
-  else{
-    if(y[4]<3.0){ //If silicate is less than 3uM    
-      g7=ZMID*P7*y[1]*y[1]*y[7]/(KMIG*(P2*y[2]+P5*y[9]+P7*y[1])+(P2*y[2]*y[2]+P5*y[9]*y[9]+P7*y[1]*y[1]));  
-      g5=ZMIE*P5*y[9]*y[9]*y[7]/(KMIG*(P2*y[2]+P5*y[9]+P7*y[1])+(P2*y[2]*y[2]+P5*y[9]*y[9]+P7*y[1]*y[1])); 
-      g2=ZMIF*P2*y[2]*y[2]*y[7]/(KMIG*(P2*y[2]+P5*y[9]+P7*y[1])+(P2*y[2]*y[2]+P5*y[9]*y[9]+P7*y[1]*y[1])); 
-    }
-    else{
-      g7=0.0;//ZMID*P7d*y[1]*y[1]*y[7]/(KMIG*(P2d*y[2]+P5d*y[9]+P7d*y[1])+(P2d*y[2]*y[2]+P5d*y[9]*y[9]+P7d*y[1]*y[1]));
-      g2=ZMIF*P2d*y[2]*y[2]*y[7]/(KMIG*(P2d*y[2]+P5d*y[9]+P7d*y[1])+(P2d*y[2]*y[2]+P5d*y[9]*y[9]+P7d*y[1]*y[1])); 
-      g5=ZMIE*P5d*y[9]*y[9]*y[7]/(KMIG*(P2d*y[2]+P5d*y[9]+P7d*y[1])+(P2d*y[2]*y[2]+P5d*y[9]*y[9]+P7d*y[1]*y[1])); 
+// convert the text files in dir to the store 'file'; returns 0 if done
+int convert_forcing(const char *dir, const char *file)
+{
+  char name[256][48], path[256][300], tmp[300];
+  int i, n=get_forcing_files(dir,name,256);
+  long off, l;
+  struct stat st;
+  forcing_header hd;
+  forcing_entry *e=new forcing_entry[n];
+  double **a=new double*[n];
+  long *nv=new long[n];
+  const char **in=new const char*[n];
+  static const char zero[FSALIGN]={0};
+
+  for(i=0;i<n;i++){
+    sprintf(path[i],"%s/%s",dir,name[i]);
+    in[i]=path[i];
+  }
+  load_forcing_files(n,in,a,nv,TRUE);
+
+  memcpy(hd.magic,FSMAGIC,8);
+  hd.nfile=n;
+  off=sizeof(hd)+n*sizeof(forcing_entry);
+  for(i=0;i<n;i++){
+    if(!a[i]){
+      cout<<" Impossible to convert "<<path[i]<<"\n";
+      return 1;
     }
+    stat(path[i],&st);
+    memset(&e[i],0,sizeof(e[i]));
+    strcpy(e[i].name,name[i]);
+    e[i].size=st.st_size;
+    e[i].mtime=st.st_mtime;
+    e[i].n=nv[i];
+    e[i].offset=off=(off+FSALIGN-1)/FSALIGN*FSALIGN;
+    off+=get_forcing_length(e[i].n)*sizeof(double);
+    cout<<" "<<path[i]<<": "<<e[i].n<<" values"<<endl;
   }
 
-  // mesozooplankton grazing
-  // g1: on diatoms
-  // g3: on dinoflagellates
-  // g4: on microzzoplankton
-  // g9: on detritus
-  g1=ZMED*P1*y[1]*y[1]*y[5]/(KMEG*(P1*y[1]+P3*y[8]+P4*y[7])+(P1*y[1]*y[1]+P3*y[8]*y[8]+P4*y[7]*y[7])); 
-  g3=ZMEDF*P3*y[8]*y[8]*y[5]/(KMEG*(P1*y[1]+P3*y[8]+P4*y[7])+(P1*y[1]*y[1]+P3*y[8]*y[8]+P4*y[7]*y[7])); 
-  g4=ZMEMI*P4*y[7]*y[7]*y[5]/(KMEG*(P1*y[1]+P3*y[8]+P4*y[7])+(P1*y[1]*y[1]+P3*y[8]*y[8]+P4*y[7]*y[7]));
+  free_forcing_store();
+  sprintf(tmp,"%s.tmp",file);
+  ofstream out(tmp,ios::binary);
+  out.write((const char *)&hd,sizeof(hd));
+  out.write((const char *)e,n*sizeof(forcing_entry));
+  off=sizeof(hd)+n*sizeof(forcing_entry);
+  for(i=0;i<n;i++){
+    out.write(zero,e[i].offset-off);
+    l=get_forcing_length(e[i].n);
+    out.write((const char *)a[i],l*sizeof(double));
+    off=e[i].offset+l*sizeof(double);
+    free_dvector(a[i],0,l-1);
+  }
+  out.close();
+  delete [] e;
+  delete [] a;
+  delete [] nv;
+  delete [] in;
+
+  if(!out || rename(tmp,file)){
+    cout<<" cannot write "<<file<<endl;
+    remove(tmp);
+    return 1;
+  }
+  cout<<" "<<n<<" forcing files converted to "<<file<<" ("<<off<<" bytes)"<<endl;
+  return 0;
+}
 
-  // diatoms sinking accelerates as silicate is depleted
-  
-  // Fasham style  (Rosa's upgrade)
-  //sink=VD*(SH/(y[4] + SH));
-       
-  // Toby's style (TYRR96)
-  // diatoms
-  sinkd=VD;
-  if(y[4]<2.0){
-    sinkd=VD*(1.0+(7.0*(2.0-y[4])/2.0));
+// time nrep loads of all the forcing files in dir: parsed with istream >>
+// one after another (as the model did before), parsed with from_chars on
+// FLTHREADS threads, and from the store (mapping it again every time);
+// returns 0 if done
+int bench_forcing(const char *dir, int nrep)
+{
+  char name[256][48], path[256][300];
+  int i, r, n=get_forcing_files(dir,name,256);
+  long k, *nv=new long[n];
+  double **a=new double*[n], s[3]={0.0,0.0,0.0}, dt[3];
+  const char **file=new const char*[n];
+
+  set_forcing_store();
+  if(!fsmap){
+    cout<<" no "<<FORCING<<", make it with ./a.out -convert"<<endl;
+    return 1;
   }
-  // others
-  sinko=VDO;
+  for(i=0;i<n;i++){
+    sprintf(path[i],"%s/%s",dir,name[i]);
+    file[i]=path[i];
+  }
+  for(int st=0;st<3;st++){
+    auto t0=std::chrono::steady_clock::now();
+    for(r=0;r<nrep;r++){
+      free_forcing_store();
+      if(st==0) for(i=0;i<n;i++) a[i]=get_forcing_iostream(file[i],&nv[i]);
+      else load_forcing_files(n,file,a,nv,st==1);
+      for(i=0;i<n;i++){
+	for(k=0;k<nv[i];k++) s[st]+=a[i][k];     // every value is read once
+	free_forcing(a[i]);
+      }
+    }
+    dt[st]=std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count()/nrep;
+  }
+  cout<<" loading "<<n<<" forcing files ("<<nrep<<" times): istream "<<dt[0]*1000.0<<" ms, from_chars on "
+      <<FLTHREADS<<" threads "<<dt[1]*1000.0<<" ms, store "<<dt[2]*1000.0<<" ms"
+      <<(s[0]==s[1] && s[0]==s[2] ? "" : " (VALUES DIFFER)")<<endl;
+  delete [] nv;
+  delete [] a;
+  delete [] file;
+  return 0;
+}
 
-  // Eslinger's style (ESLI01)
-  //sink=5.0*(1.0-tanh(0.1375*y[4]));
 
-  // Pondaven's style (POND99)
-  //if(y[3]>NHD && y[4]>SH) sink=0.0/24.0;
-  //if(y[3]<NHD || y[4]<SH) sink=5.0/24.0;
-  if(yy<Y-6) calc=0.0;
-  else calc=CALMAX*varT*psica; // CALMAX in: mmol cal-C (mmol org-C)-1 h-1 = mg cal-C (mg org-C)-1 h-1
+// ===== FORCING STREAMS =====
 
-  // transfer from attached (coccosphere) liths to free liths is
-  // governed by the average number of liths usually found per cell
-  // = ((y[11]/COCCAR) / (y[9]/EHOCAR)).
-  // The ratio of liths in the coccosphere to E.hux cells should not
-  // exceed this number.  It is assumed that there will always be
-  // some (perhaps small) detachment of free liths
-  // y[11]  must be in: mmol cal-C m-3 
-  // y[9]   must be in: mmol org-C m-3
-  // COCCAR must be in: mmol cal-C coccolith-1
-  // EHOCAR must be in: mmol org-C cell-1
-  
-   if(yy<Y-6){
-     cocpereh=0.0;
-     detach=0.0;
-   }
-   else{
-     //cocpereh=(y[11]/(CTON*y[9]))/(COCCAR/EHOCAR);
-     //detach=((cocpereh-COCMAX)*((CTON*y[9])/EHOCAR)*COCCAR)+(MEH*y[11]);
-     //if(detach<(DETMIN*y[11])) detach=DETMIN*y[11];
-     detach=max(DET*(y[11]-(COCMAX*COCCAR*(CTON*y[9]/EHOCAR))), (DETMIN*y[11]));
-   }
-  // detachment of coccoliths (number of cocco. getting detached from the cell as in Eq. 10 in TYRR96)
-  // in mmol calcite C m-3 day-1
-  // using CTON* instead of ICOC*
-  // double detach=max((y[11]-(COCMAX*COCCAR*(6.0/30.0)*(CTON*y[9]/EHOCAR))),(DETMIN*y[11]));
+// A forcing file can hold several consecutive years (as mld9501n.in), and
+// runs of any length can be driven by one. When it is not in the store, a
+// reader thread parses it from the start, and holds FSAHEAD years at a time:
+// the one asked for last and the next ones, read while the run integrates.
+// A year before the ones held restarts the reading from the start of the
+// file. The memory is the same for any number of years.
 
-  // growth terms
-  ad = MUD0*varT*psi*phid;      // diatoms
-  af = MUF0*varT*psi*phif;      // flagellates
-  adf = MUDF0*varT*psi*phidf;   // dinoflagellates
+struct text_reader {       // a text file read FLCHUNK bytes at a time
+  int fd;
+  int eof;
+  long pos, len;           // the unread part of buf
+  char buf[FLCHUNK];
+};
 
-  //if(yy<Y-6) aeh = 0.0;
-  //else 
-  aeh = MUEH0*varTeh*psieh*phieh; // Ehuxleyi
+// (re)open the reader at the start of file; FALSE if it cannot be opened
+static int open_text_reader(text_reader *r, const char *file)
+{
+  if(r->fd>=0) close(r->fd);
+  r->fd=open(file,O_RDONLY);
+  r->eof=(r->fd<0);
+  r->pos=r->len=0;
+  return r->fd>=0;
+}
 
+// next value of the reader to *v; FALSE at the end of the file, or at
+// something else than a number
+static int get_text_reader_value(text_reader *r, double *v)
+{
+  long l, k;
+
+  for(;;){
+    while(r->pos<r->len && is_space(r->buf[r->pos])) r->pos++;
+    for(l=r->pos;l<r->len && !is_space(r->buf[l]);l++);
+    if(l<r->len || (r->eof && l>r->pos)) break;  // a whole value
+    if(r->eof) return FALSE;
+    memmove(r->buf,r->buf+r->pos,l-r->pos);     // it may go on in the next chunk
+    r->len=l-r->pos;
+    r->pos=0;
+    k=read(r->fd,r->buf+r->len,FLCHUNK-r->len);
+    if(k<=0) r->eof=TRUE;
+    else r->len+=k;
+  }
+  k=r->pos;
+  r->pos=l;
+  return get_text_value(r->buf+k,r->buf+l,v);
+}
 
-  // -- [1] -- ODE FOR DIATOMS -- in: mmol N m-3
-  
-  dydt[1] = ad*y[1] - g1 - g7 - MD*y[1] - ((sinkd+diff+varHp)/mixed)*y[1]; 
+struct forcing_stream {
+  char file[128];
+  double *ring;            // FSAHEAD years of HSTEP+1 values (the first hour of the
+                           // next year, for dM/dt), year j in slot j%FSAHEAD
+  int lo, hi;              // the years lo..hi-1 of the file are in the ring
+  int want;                // year asked for: the ones before it are dropped
+  int end;                 // number of years in the file, when its end is reached (else -1)
+  int stop;                // TRUE to end the reader
+  std::mutex mx;
+  std::condition_variable cv;
+  std::thread th;
+};
+
+// the reader of stream s
+static void read_forcing_stream(forcing_stream *s)
+{
+  int i, start=TRUE;
+  double next=0.0, *a;
+  text_reader *in=new text_reader;
+  std::unique_lock<std::mutex> lock(s->mx);
+
+  in->fd=-1;
+  for(;;){
+    if(s->want<s->lo || start){             // from the start of the file
+      open_text_reader(in,s->file);
+      s->lo=s->hi=0;
+      s->end=-1;
+      if(!get_text_reader_value(in,&next)) s->end=0;
+      s->cv.notify_all();
+      start=FALSE;
+    }
+    s->cv.wait(lock,[s]{ return s->stop || s->want<s->lo || (s->end<0 && s->hi<s->want+FSAHEAD); });
+    if(s->stop) break;
+    if(s->want<s->lo) continue;
+
+    if(s->lo<s->want) s->lo=(s->want<s->hi) ? s->want : s->hi;  // drop the years before it
+    a=s->ring+(s->hi%FSAHEAD)*(HSTEP+1);
+    lock.unlock();
+    a[0]=next;
+    for(i=1;i<=HSTEP && get_text_reader_value(in,&a[i]);i++);
+    lock.lock();
+
+    if(i<HSTEP){                            // incomplete year
+      cout<<" "<<s->file<<": "<<s->hi*HSTEP+i<<" values, not a whole number of years of "<<HSTEP<<endl;
+      s->end=s->hi;
+    }
+    else{
+      if(i==HSTEP) a[HSTEP]=0.0;            // last year, as in a one-year file
+      next=a[HSTEP];
+      if(s->hi++<s->want) s->lo=s->hi;
+      if(i==HSTEP) s->end=s->hi;
+    }
+    s->cv.notify_all();
+  }
+  if(in->fd>=0) close(in->fd);
+  delete in;
+}
 
+// stream of the file, not yet started
+static forcing_stream *new_forcing_stream(const char *file)
+{
+  forcing_stream *s=new forcing_stream;
+
+  strcpy(s->file,file);
+  s->ring=new double[FSAHEAD*(HSTEP+1)];
+  s->lo=s->hi=s->want=0;
+  s->end=-1;
+  s->stop=FALSE;
+  return s;
+}
 
-  // -- [2] -- ODE FOR FLAGELLATES -- in: mmol N m-3
-  
-  dydt[2] = af*y[2] - g2 - MF*y[2] - ((sinko+diff+varHp)/mixed)*y[2];  
+// year k of the stream (the HSTEP values and the first one of the next
+// year) to a; FALSE if the file does not have it
+static int get_forcing_stream(forcing_stream *s, int k, double *a)
+{
+  if(!s->th.joinable()) s->th=std::thread(read_forcing_stream,s);
 
-  
-  // -- [3] -- ODE FOR NITRATE -- in: mmol N m-3
-  
-  dydt[3] = - MUD0*varT*psi*(qd1/(qd1+qd2))*phid*y[1] - MUF0*varT*psi*qf1*y[2] - MUDF0*varT*psi*qdf1*y[8] - 
-              MUEH0*varTeh*psieh*qeh1*y[9] + NIT*y[10] + ((diff+varHp)/mixed)*(nbo-y[3]); 
+  std::unique_lock<std::mutex> lock(s->mx);
+  s->want=k;
+  s->cv.notify_all();
+  s->cv.wait(lock,[s,k]{ return (k>=s->lo && k<s->hi) || (s->end>=0 && k>=s->end && k>=s->lo); });
+  if(k>=s->hi) return FALSE;
 
+  memcpy(a,s->ring+(k%FSAHEAD)*(HSTEP+1),(HSTEP+1)*sizeof(double));
+  return TRUE;
+}
 
-  // -- [4] -- ODE FOR SILICATE -- in: mmol Si m-3
+static void free_forcing_stream(forcing_stream *s)
+{
+  if(s->th.joinable()){
+    {
+      std::lock_guard<std::mutex> lock(s->mx);
+      s->stop=TRUE;
+      s->cv.notify_all();
+    }
+    s->th.join();
+  }
+  delete [] s->ring;
+  delete s;
+}
 
-  dydt[4] = - ad*y[1] + ((diff+varHp)/mixed)*(sbo-y[4]);  
 
-  
-  // -- [5] -- ODE FOR MESOZOOPLANKTON -- in: mmol N m-3 (graze on: diatom, dinofla, microzoo, detritus)
+// ===== FORCING CATALOG =====
+
+// CATALOG lists the file of each variable of each calendar year of forcing
+// (0 for the spin-up); a file can hold several consecutive years. A year is
+// loaded the first time a run needs it, and the least recently used ones
+// are dropped when more than FCMAX are held. The forcing table of a year
+// is built when the year is loaded (or read from FTDIR, with FTCACHE), so
+// once for all the runs and all the members of an ensemble. The models of
+// the runs point to the forcing of their year and to its table (set_year),
+// which are not dropped while a model uses them: more than FCMAX years
+// are held when the runs use more.
+
+#define NFVAR 5            // variables of a year, as in fcvar
+
+static const char *fcvar[NFVAR]={"mld","tem","par","win","sal"};
+
+struct catalog_year {
+  int year;                // calendar year, 0 for the spin-up
+  char file[NFVAR][128];   // file of each variable ("" if not in the catalog)
+  int k[NFVAR];            // year of the file that is this one (0 if it holds one year)
+  forcing_stream *fs[NFVAR]; // reader of the file, if it holds several years
+  double *f[NFVAR];        // the values, NULL if not loaded
+  double *mld;             // dM/dt
+  forcing_table *ft;       // its forcing table
+  long used;               // time of the last use, for the eviction
+  int nuse;                // models using it (get_catalog_year), not dropped while >0
+};
+
+static catalog_year *fcyear=NULL;  // the years of the catalog
+static int nfcyear=0, fccap=0;
+static long fctime=0;              // number of uses so far
+static forcing_stream **fcfs=NULL; // the readers of the files with several years
+static int nfcfs=0;
+static std::mutex fcmutex;
+
+// calendar year of the forcing of year yy, 0 for the spin-up (before 1995)
+int get_calendar_year(int yy)
+{
+  if(yy<get_spinup()) return 0;
+  return trans ? 1995+yy-(Y-NTY+1) : 1996;
+}
 
-  dydt[5] = B1*g1 + B3*g3 + B4*g4 + B9*g9 - EXME*y[5] - MZME*y[5]*y[5] - (varH/mixed)*y[5];    
+// entry of the catalog for a calendar year, added if not there
+static catalog_year *get_catalog_entry(int year)
+{
+  int n;
 
+  for(n=0;n<nfcyear && fcyear[n].year!=year;n++);
+  if(n<nfcyear) return &fcyear[n];
 
-  // -- [6] -- ODE FOR DETRITUS -- in: mmol N m-3
+  if(n==fccap){
+    catalog_year *c=new catalog_year[fccap=2*fccap+8];
+    if(n) memcpy(c,fcyear,n*sizeof(catalog_year));
+    delete [] fcyear;
+    fcyear=c;
+  }
+  memset(&fcyear[n],0,sizeof(catalog_year));
+  fcyear[n].year=year;
+  nfcyear++;
+  return &fcyear[n];
+}
 
-  dydt[6] = (1-B1)*g1 + (1-B2)*g2 + (1-B3)*g3 + (1-B4)*g4 + (1-B5)*g5 + (1-B7)*g7 + (1-B8)*g8 + (1-B9)*g9 +
-            MD*y[1] + MF*y[2] + MDF*y[8] + MEH*y[9] - g8 - g9 - MDE*y[6] - ((diff+varHp+VDT)/mixed)*y[6];  
-           
+// read the catalog 'file'; returns 0 if it has all the years of the run
+// and all their files are there
+int set_catalog(const char *file)
+{
+  char line[256], ys[32], var[32], name[64], dir[64], path[128];
+  char all[NFVAR][128];                     // files of all the years
+  int n, v, yy, y1, y2;
+  forcing_stream *fs;
+  catalog_year *c;
+  const char *sl=strrchr(file,'/');
+
+  ifstream in(file);
+  if(!in){
+    cout<<" Impossible to open forcing catalog "<<file<<"\n";
+    return 1;
+  }
+  sprintf(dir,"%.*s",sl ? (int)(sl-file) : 1,sl ? file : ".");
+  memset(all,0,sizeof(all));
+
+  while(in.getline(line,sizeof(line))){
+    if(sscanf(line,"%31s %31s %63s",ys,var,name)!=3 || ys[0]=='#') continue;
+    sprintf(path,"%s/%s",dir,name);
+    for(v=0;v<NFVAR && strcmp(var,fcvar[v]);v++);
+    if(v==NFVAR){
+      cout<<" "<<file<<": unknown variable in: "<<line<<"\n";
+      return 1;
+    }
+    if(!has_forcing(path)){
+      cout<<" Impossible to open "<<path<<" ("<<ys<<" "<<var<<")\n";
+      return 1;
+    }
+    if(!strcmp(ys,"all")){
+      strcpy(all[v],path);
+      continue;
+    }
+    if(!strcmp(ys,"spinup")) y1=y2=0;
+    else if(sscanf(ys,"%d-%d",&y1,&y2)<2) y2=y1;
+    fs=NULL;
+    if(y2>y1){
+      forcing_stream **f=new forcing_stream*[nfcfs+1];
+      if(nfcfs) memcpy(f,fcfs,nfcfs*sizeof(forcing_stream *));
+      delete [] fcfs;
+      fcfs=f;
+      fs=fcfs[nfcfs++]=new_forcing_stream(path);
+    }
+    for(yy=y1;yy<=y2;yy++){
+      c=get_catalog_entry(yy);
+      strcpy(c->file[v],path);
+      c->k[v]=yy-y1;
+      c->fs[v]=fs;
+    }
+  }
 
-  // -- [7] -- ODE FOR MICROZOOPLANKTON -- in: mmol N m-3 (graze on: flage, Ehux, free cocco, detritus) 
+  for(yy=0;yy<=Y;yy++) get_catalog_entry(get_calendar_year(yy));
+  for(n=0;n<nfcyear;n++){
+    for(v=0;v<NFVAR;v++){
+      if(!fcyear[n].file[v][0] && all[v][0]) strcpy(fcyear[n].file[v],all[v]);
+      if(!fcyear[n].file[v][0]){
+	cout<<" no "<<fcvar[v]<<" for "<<fcyear[n].year<<" in "<<file<<"\n";
+	return 1;
+      }
+    }
+  }
+  return 0;
+}
 
-  dydt[7] = B2*g2 + B5*g5 + B7*g7 + B8*g8 - EXMI*y[7] - MZMI*y[7]*y[7] - g4 - (varH/mixed)*y[7];
+// values of variable v of the year, from a file with several years, with
+// the first hour of the year after; NULL if they cannot be loaded
+static double *load_catalog_var(catalog_year *c, int v)
+{
+  double *a;
+  forcing_entry *e;
 
+  if((e=get_forcing_entry(c->file[v]))){  // several years in the store
+    if(e->n%HSTEP) cout<<" "<<c->file[v]<<": "<<e->n<<" values, not a whole number of years of "<<HSTEP<<endl;
+    return e->n>=(c->k[v]+1)*HSTEP ? (double *)(fsmap+e->offset)+c->k[v]*HSTEP : NULL;
+  }
 
-  // -- [8] -- ODE FOR DINOFLAGELLATES -- in: mmol N m-3
-  
-  dydt[8] = adf*y[8] - g3 - MDF*y[8] - ((sinko+diff+varHp)/mixed)*y[8];  
+  a=dvector(0,get_forcing_length(HSTEP)-1);
+  memset(a,0,get_forcing_length(HSTEP)*sizeof(double));
+  if(!get_forcing_stream(c->fs[v],c->k[v],a)){
+    free_dvector(a,0,0);
+    return NULL;
+  }
+  return a;
+}
+
+// forcing table of a loaded year, from FTDIR if it was saved there for the
+// same forcing and the same constants of the model, otherwise built (and saved)
+static forcing_table *get_catalog_table(catalog_year *c)
+{
+  forcing_table *t=new forcing_table;
+
+#if FTCACHE
+  unsigned long key=get_build_hash(14695981039346656037UL), k=0;
+  long size=sizeof(forcing_table);
+  char name[256], tmp[300];
+
+  key=get_hash(key,&size,sizeof(size));
+  key=get_hash(key,c->mld,HSTEP*sizeof(double));
+  for(int v=0;v<NFVAR;v++) key=get_hash(key,c->f[v],HSTEP*sizeof(double));
+  sprintf(name,"%s/%016lx.tab",FTDIR,key);
+
+  ifstream in(name,ios::binary);
+  if(in){
+    in.read((char *)&k,sizeof(k));
+    in.read((char *)t,sizeof(forcing_table));
+    if(in && k==key){
+      utime(name,NULL);                        // used now, kept by clean_directory
+      return t;
+    }
+  }
+#endif
+
+  set_forcing_table(t,c->mld,c->f[0],c->f[1],c->f[2],c->f[3],c->f[4]);
+
+#if FTCACHE
+  mkdir(FTDIR,0755);
+  sprintf(tmp,"%s.%p",name,(void *)t);
+  ofstream out(tmp,ios::binary);
+  out.write((const char *)&key,sizeof(key));
+  out.write((const char *)t,sizeof(forcing_table));
+  out.close();
+  if(!out || rename(tmp,name)){
+    cout<<" cannot write "<<name<<endl;
+    remove(tmp);
+  }
+  clean_directory(FTDIR,FTMAX);
+#endif
+  return t;
+}
+
+static void free_catalog_year(catalog_year *c)
+{
+  for(int v=0;v<NFVAR;v++){
+    free_forcing(c->f[v]);
+    c->f[v]=NULL;
+  }
+  if(c->mld) free_dvector(c->mld,1,HSTEP);
+  c->mld=NULL;
+  delete c->ft;
+  c->ft=NULL;
+}
+
+// the year used by m before, if any, is no longer used by it
+static void release_catalog_year(model *m)
+{
+  for(int n=0;n<nfcyear && m->ftab;n++)
+    if(fcyear[n].ft==m->ftab){
+      fcyear[n].nuse--;
+      m->ftab=NULL;
+    }
+}
+
+// the forcing of a calendar year and its table for m, loading it if needed
+void get_catalog_year(model *m, int year)
+{
+  int i, n, l, v;
+  std::lock_guard<std::mutex> lock(fcmutex);
+
+  release_catalog_year(m);
+  for(n=0;n<nfcyear && fcyear[n].year!=year;n++);  // there, as checked by set_catalog
+  catalog_year *c=&fcyear[n];
+
+  if(!c->f[0]){
+    const char *file[NFVAR];
+    double *a[NFVAR];
+    long nv[NFVAR];
+    int fv[NFVAR], nf=0;
+
+    for(v=0;v<NFVAR;v++){                     // the one-year files, at the same time
+      if(c->fs[v]) continue;
+      fv[nf]=v;
+      file[nf++]=c->file[v];
+    }
+    load_forcing_files(nf,file,a,nv,FALSE);
+    for(l=0;l<nf;l++){
+      c->f[fv[l]]=a[l];
+      if(nv[l]>=0 && nv[l]!=HSTEP){
+	cout<<" "<<file[l]<<": "<<nv[l]<<" values, not "<<HSTEP<<"\n";
+	exit(1);
+      }
+    }
+    for(v=0;v<NFVAR;v++){
+      if(c->fs[v]) c->f[v]=load_catalog_var(c,v);
+      if(!c->f[v]){
+	cout<<" Impossible to load "<<fcvar[v]<<" of "<<year<<" from "<<c->file[v]<<"\n";
+	exit(1);
+      }
+    }
+    c->mld=get_mld_change(c->f[0]);
+    c->ft=get_catalog_table(c);
+
+    for(;;){                                  // drop the least recently used years
+      for(i=0, v=0, l=-1;i<nfcyear;i++){
+	if(!fcyear[i].f[0] || i==n) continue;
+	v++;
+	if(!fcyear[i].nuse && (l<0 || fcyear[i].used<fcyear[l].used)) l=i;
+      }
+      if(v<FCMAX || l<0) break;
+      free_catalog_year(&fcyear[l]);
+    }
+  }
+  c->used=++fctime;
+  c->nuse++;
+
+  m->mld=c->mld;
+  m->mldo=c->f[0];
+  m->tem=c->f[1];
+  m->sir=c->f[2];
+  m->wsp=c->f[3];
+  m->sal=c->f[4];
+  m->ftab=c->ft;
+}
+
+// end of a run of m: the year of the catalog it used can be dropped
+void end_model(model *m)
+{
+  std::lock_guard<std::mutex> lock(fcmutex);
+  release_catalog_year(m);
+}
+
+// drop all the years and end the readers
+void free_catalog(void)
+{
+  int n;
+
+  for(n=0;n<nfcyear;n++) free_catalog_year(&fcyear[n]);
+  for(n=0;n<nfcfs;n++) free_forcing_stream(fcfs[n]);
+  delete [] fcyear;
+  delete [] fcfs;
+  fcyear=NULL;
+  fcfs=NULL;
+  nfcyear=fccap=nfcfs=0;
+}
+
+
+// ===== SPIN-UP CHECKPOINTS =====
+
+// The state at the start of year yy depends only on the parameters, the
+// initial conditions and the forcing of years 0..yy-1, so an earlier run
+// with the same inputs can be resumed from it. The file of year yy is
+// named after a hash of all of them (cpkey[yy]), then a run with different
+// parameters or forcing never reads it.
+
+// number of spin-up years (the ones whose results are not looked at)
+int get_spinup(void)
+{
+  return trans ? Y-NTY+1 : Y;
+}
+
+// TRUE if the state vnew at the start of a year is within the tolerances
+// from the periodic state of the forcing. The distance is estimated from the
+// change over the year and the one over the year before (m->ssd), as the
+// tail of a geometric series: the slowest variables (TCO2) move little from
+// a year to the next but for many years.
+int get_periodic(model *m, const double vold[], const double vnew[])
+{
+  int i;
+  double d=0.0;     // change over the year, relative to the tolerances
+  double dprev=m->ssd;
+
+  for(i=1;i<=NEQ;i++) d=max(d,fabs(vnew[i]-vold[i])/(SSRTOL*fabs(vold[i])+SSATOL));
+  m->ssd=d;
+
+  if(SSRTOL<=0.0 || d>1.0 || d>=dprev) return FALSE;
+  return d*d/(dprev-d)<=1.0;
+}
+
+// last spin-up year with the same forcing as year m->yy, whose periodic
+// state is then the same; the forcing of m->yy is the one loaded, and it
+// is loaded again on return
+int get_last_year(model *m)
+{
+  unsigned long h=get_year_hash(0,m);
+  int yy=m->yy;
+  int out=m->out;
+
+  int last;
+
+  m->out=FALSE;
+  for(last=yy;last+1<get_spinup();last++){
+    m->yy=last+1;
+    set_year(m);
+    if(get_year_hash(0,m)!=h) break;
+  }
+  m->yy=yy;
+  if(yy+1<get_spinup()) set_year(m);
+  m->out=out;
+  return last;
+}
+
+// hash of the forcing of the year loaded by set_year, continuing from h
+unsigned long get_year_hash(unsigned long h, model *m)
+{
+  int pre=(m->yy<Y-NTY+1);   // no E. huxleyi and calcification before 1995 (derivs)
+
+  h=get_hash(h,&pre,sizeof(int));
+  h=get_hash(h,&m->diff,sizeof(double));
+  h=get_hash(h,&m->nbo,sizeof(double));
+  h=get_hash(h,&m->sbo,sizeof(double));
+  h=get_hash(h,m->mld,HSTEP*sizeof(double));
+  h=get_hash(h,m->mldo,HSTEP*sizeof(double));
+  h=get_hash(h,m->tem,HSTEP*sizeof(double));
+  h=get_hash(h,m->sir,HSTEP*sizeof(double));
+  h=get_hash(h,m->wsp,HSTEP*sizeof(double));
+  h=get_hash(h,m->sal,HSTEP*sizeof(double));
+  return h;
+}
+
+// FNV-1a hash of n bytes, continuing from h
+unsigned long get_hash(unsigned long h, const void *p, size_t n)
+{
+  const unsigned char *c=(const unsigned char *)p;
+  size_t i;
+
+  for(i=0;i<n;i++){
+    h^=c[i];
+    h*=1099511628211UL;
+  }
+  return h;
+}
+
+// hash of the constants of param.h and of the options of the model,
+// continuing from h: a change to any of them gives other checkpoints (and
+// forcing tables), while a build with the same values finds the old ones.
+// A new constant has to be added here; a change to the equations
+// themselves is not seen, and CPDIR and FTDIR have to be emptied then.
+unsigned long get_build_hash(unsigned long h)
+{
+  static const double pconf[]={PI,MD,MF,MDF,MEH,MZMI,MZME,EXMI,EXME,MDE,KZMI,KZME,B1,B3,B4,B9,B2,B5,
+                               B7,B8,P1,P3,P4,P2,P5,P7,P2d,P5d,P7d,KMIG,KMEG,ZMID,ZMIF,ZMIE,ZMIAC,
+                               ZMED,ZMEDF,ZMEMI,FZRME,FZRMI,FZRNOEH,ED,EF,EDE,GGD,GGF,GGDE,CALMAX,
+                               DISSOL,COCMAX,COCCAR,EHOCAR,DETMIN,DET,GAL,ICOC,TMAX,TMIN,ISAT,
+                               ISATEH,KRE,KGR,KSS,KW,IHD,IHEH,IHCA,G,LIGHT_PROFILE,LIGHT_RESPONSE,
+                               LIGHT_INTEGRATION,LIGHT_TABLE,LTNI,LTNC,LTND,LTIMAX,LTCMAX,LTDMIN,
+                               LTDMAX,H,MUD0,MUF0,MUDF0,MUEH0,MUD0_NOEH,MUF0_NOEH,MUDF0_NOEH,R,RD,
+                               RF,RDF,REH,NTOC,NTOCZ,CTOCHL,CHLTOC,CTONZ,CTON,PCO2A,DIC0,ALK0,CRI,
+                               WD,GTV,NIT,A0,N0,N094,N095,N096,N097,N098,N099,N000,N001,S0,S094,
+                               S095,S096,S097,S098,S099,S000,S001,D0,NHD,NHF,NHDF,NHEH,AHD,AHF,AHDF,
+                               AHEH,SH,VD,VDO,VDT,mm,mm95,mm96,mm97,mm98,mm99,mm00,mm01,TSTEP_FLAG,
+                               HSOLVER,HTOL,HITMAX};
+  static const double conf[]={INTEGRATOR,ADATOL,ADRTOL,ADH0,ADHMAX,ADHMIN,NEQ,HSTEP,SSRTOL,SSATOL,
+			      SHOOTING,SHMAXY,SHDEPTH};
+
+  h=get_hash(h,pconf,sizeof(pconf));
+  return get_hash(h,conf,sizeof(conf));
+}
+
+void set_checkpoint_keys(model *m, const double vstart[])
+{
+  unsigned long h=get_build_hash(14695981039346656037UL);
+  int out=m->out;
+  int yy;
+
+  h=get_hash(h,&m->par,sizeof(params));
+  h=get_hash(h,vstart+1,NEQ*sizeof(double));
+  m->cpkey[0]=h;
+
+  m->out=FALSE;
+  for(yy=0;yy<get_spinup();yy++){
+    m->yy=yy;
+    set_year(m);
+    h=get_hash(h,&yy,sizeof(int));
+    h=get_year_hash(h,m);
+    m->cpkey[yy+1]=h;
+  }
+  m->out=out;
+}
+
+static void get_checkpoint_name(char *name, unsigned long key, int yy)
+{
+  sprintf(name,"%s/%016lx.%d",CPDIR,key,yy);
+}
+
+// checkpoint of m at the start of year yy from CPDIR, FALSE if it was
+// never saved; m is not changed
+int get_checkpoint(model *m, int yy, checkpoint *c)
+{
+  char name[256];
+  unsigned long key;
+  int y;
+  double a[3];
+
+  get_checkpoint_name(name,m->cpkey[yy],yy);
+  ifstream in(name,ios::binary);
+  if(!in) return FALSE;
+
+  in.read((char *)&key,sizeof(key));
+  in.read((char *)&y,sizeof(y));
+  in.read((char *)(c->v+1),NEQ*sizeof(double));
+  in.read((char *)a,sizeof(a));
+  in.read((char *)&c->nspin,sizeof(int));
+  if(!in || key!=m->cpkey[yy] || y!=yy) return FALSE;
+
+  utime(name,NULL);                       // used now, kept by clean_directory
+  c->ah=a[0];
+  c->ahf=a[1];
+  c->ssd=a[2];
+  return TRUE;
+}
+
+// m resumes from the checkpoint c, with its state in vstart and the [H+]
+// guess of rkdriver in *ah
+void set_checkpoint(model *m, const checkpoint *c, double vstart[], double *ah)
+{
+  for(int i=1;i<=NEQ;i++) m->yi[i]=vstart[i]=c->v[i];
+  *ah=c->ah;
+  m->carb.ah=c->ahf;
+  m->ssd=c->ssd;
+  m->nspin=c->nspin;
+}
+
+// save the state at the start of year yy in CPDIR, with what m carries
+// to it (checkpoint)
+void put_checkpoint(model *m, int yy, const double vstart[], double ah)
+{
+  char name[256], tmp[300];
+  double a[3];
+
+  a[0]=ah;
+  a[1]=m->carb.ah;
+  a[2]=m->ssd;
+
+  mkdir(CPDIR,0755);
+  get_checkpoint_name(name,m->cpkey[yy],yy);
+  sprintf(tmp,"%s.%p",name,(void *)m);    // then concurrent runs never share a file
+
+  ofstream out(tmp,ios::binary);
+  out.write((const char *)&m->cpkey[yy],sizeof(unsigned long));
+  out.write((const char *)&yy,sizeof(int));
+  out.write((const char *)(vstart+1),NEQ*sizeof(double));
+  out.write((const char *)a,sizeof(a));
+  out.write((const char *)&m->nspin,sizeof(int));
+  out.close();
+
+  if(!out || rename(tmp,name)) {
+    cout<<" cannot write "<<name<<endl;
+    remove(tmp);
+  }
+  clean_directory(CPDIR,CPMAX);
+}
+
+// remove the files of dir modified least recently until at most n are left
+void clean_directory(const char *dir, int n)
+{
+  static std::mutex mx;     // runs of an ensemble save checkpoints at the same time
+  std::lock_guard<std::mutex> lock(mx);
+  char name[512], old[512];
+  struct dirent *e;
+  struct stat st;
+  time_t t;
+  int nf;
+  DIR *d;
+
+  for(;;){
+    if(!(d=opendir(dir))) return;
+    nf=0;
+    t=0;
+    while((e=readdir(d))){
+      snprintf(name,sizeof(name),"%s/%s",dir,e->d_name);
+      if(stat(name,&st) || !S_ISREG(st.st_mode)) continue;
+      if(!nf++ || st.st_mtime<t){
+	t=st.st_mtime;
+	strcpy(old,name);
+      }
+    }
+    closedir(d);
+    if(nf<=n || remove(old)) return;
+  }
+}
+
+
+// ===== SHOOTING =====
+
+// The periodic state of a forcing repeated every year is the fixed point
+// x=P(x) of the map P from the state at the start of a year to the one at
+// its end. Spin-up finds it by iterating P, which converges slowly along the
+// slow variables (TCO2, alkalinity): shoot solves F(x)=P(x)-x=0 by Anderson
+// mixing of the last iterates of P, one year each. Newton-Krylov, with each
+// product of the Jacobian and a vector one more year, needed more years than
+// the spin-up itself. All the norms are relative to SSRTOL, SSATOL as in
+// get_periodic.
+
+// one year with the forcing loaded, from the state x to xout, with no output;
+// every year starts from the same [H+] guess, carb
+void get_annual_map(model *m, const double x[], double xout[], const carbonate *carb,
+		    void (*derivs)(model *, double, double [], double []))
+{
+  int i,k;
+  double t=TI, h=(double)(TH-TI)/HSTEP;
+  double v[NEQ+1],vout[NEQ+1];
+  carbonate c=*carb;
+
+  for(i=1;i<=NEQ;i++) v[i]=x[i];
+
+#if INTEGRATOR==1
+  double dv[NEQ+1];
+  double chlo=NTOC*(CHLTOC*v[1]+CHLTOC*v[2]+CHLTOC*v[8]+CHLTOC*v[9]);   // as in rkdriver
+#else
+  m->carb=c;
+  adapt_start(m,t,v,NEQ,derivs_forced);
+#endif
+
+  for(k=1;k<=HSTEP-3;k++){
+#if INTEGRATOR==1
+    set_forcing(m,k,0.0,chlo,v[14],v[13],v[4],&c);
+    (*derivs)(m,t,v,dv);
+    rk4(m,v,dv,NEQ,t,h,vout,derivs);
+#else
+    adapt_dense(m,t+h,vout,NEQ,derivs_forced);
+#endif
+    t+=h;
+    for(i=1;i<=NEQ;i++) v[i]=fabs(vout[i]);
+#if INTEGRATOR==1
+    chlo=NTOC*(CHLTOC*v[1]+CHLTOC*v[2]+CHLTOC*v[8]+CHLTOC*v[9]);
+#endif
+  }
+
+  for(i=1;i<=NEQ;i++) xout[i]=v[i];
+}
+
+// max norm of f relative to the weights w
+double get_shoot_norm(const double f[], const double w[])
+{
+  int i;
+  double r=0.0;
+
+  for(i=1;i<=NEQ;i++) r=max(r,fabs(f[i])/w[i]);
+  return r;
+}
+
+// x is moved to the periodic state of the forcing loaded (or to the best
+// state found); returns TRUE if it is within the tolerances, with the
+// years integrated in *ny
+int shoot(model *m, double x[], const carbonate *carb, int *ny,
+	  void (*derivs)(model *, double, double [], double []))
+{
+  int i,j,l,it;
+  double p[NEQ+1], f[NEQ+1], w[NEQ+1], xn[NEQ+1];
+  double r;
+
+  // Anderson mixing: the last SHDEPTH iterates of P and their residuals
+  double xa[SHDEPTH+1][NEQ+1], fa[SHDEPTH+1][NEQ+1];
+  double a[NEQ+1][NEQ+1], b[NEQ+1], gam[NEQ+1];
+  int indx[NEQ+1];
+  int na=0;
+
+  get_annual_map(m,x,p,carb,derivs);
+  *ny=1;
+
+  for(it=0;*ny<SHMAXY;it++){
+    for(i=1;i<=NEQ;i++){
+      f[i]=p[i]-x[i];
+      w[i]=SSRTOL*max(fabs(x[i]),p[i])+SSATOL;   // the scale of a variable from 0 is the one it reaches
+    }
+    r=get_shoot_norm(f,w);
+    if(m->out) cout<<"   shooting: |F| "<<r<<" after "<<*ny<<" years"<<endl;
+    if(r<=1.0) return TRUE;
+
+    // Anderson mixing: the combination of the last iterates of P whose
+    // residual is the least, with the weights of the norm
+    if(na==SHDEPTH){
+      for(l=1;l<SHDEPTH;l++)
+	for(i=1;i<=NEQ;i++){
+	  xa[l][i]=xa[l+1][i];
+	  fa[l][i]=fa[l+1][i];
+	}
+      na--;
+    }
+    na++;
+    for(i=1;i<=NEQ;i++){
+      xa[na][i]=x[i];
+      fa[na][i]=f[i];
+    }
+    for(i=1;i<=NEQ;i++) xn[i]=p[i];
+    if(na>1){
+      // least squares for the differences of the residuals, with a little damping
+      for(j=1;j<na;j++){
+	b[j]=0.0;
+	for(i=1;i<=NEQ;i++) b[j]+=(fa[j+1][i]-fa[j][i])*f[i]/(w[i]*w[i]);
+	for(l=1;l<na;l++){
+	  a[j][l]=0.0;
+	  for(i=1;i<=NEQ;i++) a[j][l]+=(fa[j+1][i]-fa[j][i])*(fa[l+1][i]-fa[l][i])/(w[i]*w[i]);
+	}
+      }
+      for(j=1;j<na;j++) a[j][j]*=1.0+1.0e-10;
+      ludcmp(a,na-1,indx);
+      lubksb(a,na-1,indx,b);
+      for(j=1;j<na;j++) gam[j]=b[j];
+      for(j=1;j<na;j++)
+	for(i=1;i<=NEQ;i++)
+	  xn[i]-=gam[j]*(xa[j+1][i]+fa[j+1][i]-xa[j][i]-fa[j][i]);
+    }
+    for(i=1;i<=NEQ;i++) x[i]=fabs(xn[i]);
+    get_annual_map(m,x,p,carb,derivs);
+    (*ny)++;
+  }
+
+  return FALSE;
+}
+
+
+void rk4(model *m, double y[], double dydt[], int n, double t, double h, double yout[],
+	 void (*derivs)(model *, double, double [], double []))
+{
+  int i;
+  double th, hh, h6;
+  double dym[NEQ+1], dyt[NEQ+1], yt[NEQ+1];  // on the stack, n must not exceed NEQ
+
+  hh=h*0.5;
+  h6=h/6.0;
+  th=t+hh;
+
+  for(i=1;i<=n;i++) yt[i]=y[i]+hh*dydt[i];  // first step
+  (*derivs)(m,th,yt,dyt);                     // second step
+  for(i=1;i<=n;i++) yt[i]=y[i]+hh*dyt[i];
+  (*derivs)(m,th,yt,dym);                     // third step
+  for(i=1;i<=n;i++){
+    yt[i]=y[i]+h*dym[i];
+    dym[i]+=dyt[i];
+  }
+  (*derivs)(m,t+h,yt,dyt);                    // fourth step 
+  // accumulate increments with proper weights
+  for(i=1;i<=n;i++) yout[i]=y[i]+h6*(dydt[i]+dyt[i]+2.0*dym[i]);
+}
+
+
+// Dormand-Prince 5(4) step from t to t+h, y and dydt given at t. 
+// Returns the 5th order solution in yout, its derivative at t+h in 
+// dydtout (first same as last) and the error estimate in yerr.
+// The dense output coefficients of the step are left in adapt.r1-r5.
+void dopri5(model *m, double y[], double dydt[], int n, double t, double h, double yout[], 
+	    double dydtout[], double yerr[], void (*derivs)(model *, double, double [], double []))
+{
+  static const double 
+    c2=1.0/5.0, c3=3.0/10.0, c4=4.0/5.0, c5=8.0/9.0,
+    a21=1.0/5.0,
+    a31=3.0/40.0, a32=9.0/40.0,
+    a41=44.0/45.0, a42=-56.0/15.0, a43=32.0/9.0,
+    a51=19372.0/6561.0, a52=-25360.0/2187.0, a53=64448.0/6561.0, a54=-212.0/729.0,
+    a61=9017.0/3168.0, a62=-355.0/33.0, a63=46732.0/5247.0, a64=49.0/176.0, a65=-5103.0/18656.0,
+    a71=35.0/384.0, a73=500.0/1113.0, a74=125.0/192.0, a75=-2187.0/6784.0, a76=11.0/84.0,
+    e1=71.0/57600.0, e3=-71.0/16695.0, e4=71.0/1920.0, e5=-17253.0/339200.0, e6=22.0/525.0, e7=-1.0/40.0,
+    d1=-12715105075.0/11282082432.0, d3=87487479700.0/32700410799.0, d4=-10690763975.0/1880347072.0,
+    d5=701980252875.0/199316789632.0, d6=-1453857185.0/822651844.0, d7=69997945.0/29380423.0;
+  int i;
+  double k2[NEQ+1], k3[NEQ+1], k4[NEQ+1], k5[NEQ+1], k6[NEQ+1], yt[NEQ+1]; // n must not exceed NEQ
+
+  for(i=1;i<=n;i++) yt[i]=y[i]+h*a21*dydt[i];
+  (*derivs)(m,t+c2*h,yt,k2);
+  for(i=1;i<=n;i++) yt[i]=y[i]+h*(a31*dydt[i]+a32*k2[i]);
+  (*derivs)(m,t+c3*h,yt,k3);
+  for(i=1;i<=n;i++) yt[i]=y[i]+h*(a41*dydt[i]+a42*k2[i]+a43*k3[i]);
+  (*derivs)(m,t+c4*h,yt,k4);
+  for(i=1;i<=n;i++) yt[i]=y[i]+h*(a51*dydt[i]+a52*k2[i]+a53*k3[i]+a54*k4[i]);
+  (*derivs)(m,t+c5*h,yt,k5);
+  for(i=1;i<=n;i++) yt[i]=y[i]+h*(a61*dydt[i]+a62*k2[i]+a63*k3[i]+a64*k4[i]+a65*k5[i]);
+  (*derivs)(m,t+h,yt,k6);
+  for(i=1;i<=n;i++) yout[i]=y[i]+h*(a71*dydt[i]+a73*k3[i]+a74*k4[i]+a75*k5[i]+a76*k6[i]);
+  (*derivs)(m,t+h,yout,dydtout);
+  for(i=1;i<=n;i++){
+    yerr[i]=h*(e1*dydt[i]+e3*k3[i]+e4*k4[i]+e5*k5[i]+e6*k6[i]+e7*dydtout[i]);
+    m->adapt.r5[i]=h*(d1*dydt[i]+d3*k3[i]+d4*k4[i]+d5*k5[i]+d6*k6[i]+d7*dydtout[i]);
+  }
+}
+
+
+// Rosenbrock 4(3) step from t to t+h with Shampine's coefficients, as in
+// routine stiff of Numerical Recipes, y and dydt given at t. The Jacobian
+// is computed at the first attempt from t and kept for the retries with
+// smaller steps. Returns the solution in yout, its derivative at t+h in
+// dydtout and the error estimate in yerr. The dense output of the step 
+// is the cubic Hermite polynomial, so adapt.r5 is zero.
+void rosenbrock(model *m, double y[], double dydt[], int n, double t, double h, double yout[], 
+		double dydtout[], double yerr[], void (*derivs)(model *, double, double [], double []))
+{
+  static const double 
+    gam=1.0/2.0, a21=2.0, a31=48.0/25.0, a32=6.0/25.0, 
+    c21=-8.0, c31=372.0/25.0, c32=12.0/5.0, c41=-112.0/125.0, c42=-54.0/125.0, c43=-2.0/5.0,
+    b1=19.0/9.0, b2=1.0/2.0, b3=25.0/108.0, b4=125.0/108.0,
+    e1=17.0/54.0, e2=7.0/36.0, e3=0.0, e4=125.0/108.0,
+    c1x=1.0/2.0, c2x=-3.0/2.0, c3x=121.0/50.0, c4x=29.0/250.0,
+    a2x=1.0, a3x=3.0/5.0;
+  int i, j;
+  int indx[NEQ+1];
+  double a[NEQ+1][NEQ+1];                                         // n must not exceed NEQ
+  double g1[NEQ+1], g2[NEQ+1], g3[NEQ+1], g4[NEQ+1], yt[NEQ+1], dyt[NEQ+1];
+
+  if(!m->adapt.jac){
+    jacobian(m,t,y,dydt,n,derivs);
+    m->adapt.jac=TRUE;
+  }
+
+  for(i=1;i<=n;i++){                 // matrix 1/(gam*h) - J, LU decomposed
+    for(j=1;j<=n;j++) a[i][j]=-m->adapt.dfdy[i][j];
+    a[i][i]+=1.0/(gam*h);
+  }
+  ludcmp(a,n,indx);
+
+  for(i=1;i<=n;i++) g1[i]=dydt[i]+h*c1x*m->adapt.dfdt[i];
+  lubksb(a,n,indx,g1);
+  for(i=1;i<=n;i++) yt[i]=y[i]+a21*g1[i];
+  (*derivs)(m,t+a2x*h,yt,dyt);
+  for(i=1;i<=n;i++) g2[i]=dyt[i]+h*c2x*m->adapt.dfdt[i]+c21*g1[i]/h;
+  lubksb(a,n,indx,g2);
+  for(i=1;i<=n;i++) yt[i]=y[i]+a31*g1[i]+a32*g2[i];
+  (*derivs)(m,t+a3x*h,yt,dyt);
+  for(i=1;i<=n;i++) g3[i]=dyt[i]+h*c3x*m->adapt.dfdt[i]+(c31*g1[i]+c32*g2[i])/h;
+  lubksb(a,n,indx,g3);
+  for(i=1;i<=n;i++) g4[i]=dyt[i]+h*c4x*m->adapt.dfdt[i]+(c41*g1[i]+c42*g2[i]+c43*g3[i])/h;
+  lubksb(a,n,indx,g4);
+  for(i=1;i<=n;i++){
+    yout[i]=y[i]+b1*g1[i]+b2*g2[i]+b3*g3[i]+b4*g4[i];
+    yerr[i]=e1*g1[i]+e2*g2[i]+e3*g3[i]+e4*g4[i];
+    m->adapt.r5[i]=0.0;
+  }
+  (*derivs)(m,t+h,yout,dydtout);
+}
+
+
+// Jacobian dfdy and time derivative dfdt of derivs at (t,y), into adapt,
+// by forward differences (n+1 evaluations of derivs, dydt given at t)
+void jacobian(model *m, double t, double y[], double dydt[], int n, void (*derivs)(model *, double, double [], double []))
+{
+  int i, j;
+  double d, yt[NEQ+1], dyt[NEQ+1];   // n must not exceed NEQ
+
+  for(j=1;j<=n;j++) yt[j]=y[j];
+  for(j=1;j<=n;j++){
+    d=1.0e-7*max(fabs(y[j]),1.0e-3);  // perturbation of y[j], small but well above round-off
+    yt[j]=y[j]+d;
+    (*derivs)(m,t,yt,dyt);
+    for(i=1;i<=n;i++) m->adapt.dfdy[i][j]=(dyt[i]-dydt[i])/d;
+    yt[j]=y[j];
+  }
+  d=1.0e-4;                          // time derivative across the interpolated forcing
+  (*derivs)(m,t+d,yt,dyt);
+  for(i=1;i<=n;i++) m->adapt.dfdt[i]=(dyt[i]-dydt[i])/d;
+}
+
+
+// LU decomposition with partial pivoting of a[1..n][1..n], in place, as
+// in Numerical Recipes (the row permutation is returned in indx)
+void ludcmp(double a[][NEQ+1], int n, int indx[])
+{
+  int i, imax=1, j, k;
+  double big, dum, sum, temp;
+  double vv[NEQ+1];                  // implicit scaling of each row
+
+  for(i=1;i<=n;i++){
+    big=0.0;
+    for(j=1;j<=n;j++) if((temp=fabs(a[i][j])) > big) big=temp;
+    if(big == 0.0) nrerror(" Singular matrix in routine ludcmp ");
+    vv[i]=1.0/big;
+  }
+  for(j=1;j<=n;j++){
+    for(i=1;i<j;i++){
+      sum=a[i][j];
+      for(k=1;k<i;k++) sum-=a[i][k]*a[k][j];
+      a[i][j]=sum;
+    }
+    big=0.0;
+    for(i=j;i<=n;i++){
+      sum=a[i][j];
+      for(k=1;k<j;k++) sum-=a[i][k]*a[k][j];
+      a[i][j]=sum;
+      if((dum=vv[i]*fabs(sum)) >= big){
+	big=dum;
+	imax=i;
+      }
+    }
+    if(j != imax){
+      for(k=1;k<=n;k++){
+	dum=a[imax][k];
+	a[imax][k]=a[j][k];
+	a[j][k]=dum;
+      }
+      vv[imax]=vv[j];
+    }
+    indx[j]=imax;
+    if(a[j][j] == 0.0) a[j][j]=1.0e-20;
+    dum=1.0/a[j][j];
+    for(i=j+1;i<=n;i++) a[i][j]*=dum;
+  }
+}
+
+
+// solve a x = b with a decomposed by ludcmp, x returned in b
+void lubksb(double a[][NEQ+1], int n, int indx[], double b[])
+{
+  int i, ii=0, ip, j;
+  double sum;
+
+  for(i=1;i<=n;i++){
+    ip=indx[i];
+    sum=b[ip];
+    b[ip]=b[i];
+    if(ii)
+      for(j=ii;j<=i-1;j++) sum-=a[i][j]*b[j];
+    else if(sum) ii=i;
+    b[i]=sum;
+  }
+  for(i=n;i>=1;i--){
+    sum=b[i];
+    for(j=i+1;j<=n;j++) sum-=a[i][j]*b[j];
+    b[i]=sum/a[i][i];
+  }
+}
+
+
+// start the adaptive integrator from y at time t
+void adapt_start(model *m, double t, double y[], int n, void (*derivs)(model *, double, double [], double []))
+{
+  int i;
+
+  for(i=1;i<=n;i++) m->adapt.y[i]=y[i];
+  (*derivs)(m,t,m->adapt.y,m->adapt.dydt);
+  m->adapt.t=m->adapt.told=t;
+  m->adapt.h=ADH0;
+  m->adapt.hold=0.0;
+  m->adapt.jac=FALSE;
+  m->adapt.nacc=m->adapt.nrej=0;
+}
+
+
+// advance the adaptive integrator until it passes time t and return 
+// the state at t from the dense output of the last step
+void adapt_dense(model *m, double t, double yout[], int n, void (*derivs)(model *, double, double [], double []))
+{
+  int i;
+  double h, err, sk, fac, th, th1;
+  double pw=(INTEGRATOR==3) ? 0.25 : 0.2;           // 1/(order of the error estimate + 1)
+  double ynew[NEQ+1], dydtnew[NEQ+1], yerr[NEQ+1];  // n must not exceed NEQ
+
+  while(m->adapt.t<t){
+    h=m->adapt.h;
+    for(;;){
+#if INTEGRATOR==3
+      rosenbrock(m,m->adapt.y,m->adapt.dydt,n,m->adapt.t,h,ynew,dydtnew,yerr,derivs);
+#else
+      dopri5(m,m->adapt.y,m->adapt.dydt,n,m->adapt.t,h,ynew,dydtnew,yerr,derivs);
+#endif
+      err=0.0;                                       // scaled RMS norm of the error
+      for(i=1;i<=n;i++){
+	sk=ADATOL+ADRTOL*max(fabs(m->adapt.y[i]),fabs(ynew[i]));
+	err+=(yerr[i]/sk)*(yerr[i]/sk);
+      }
+      err=sqrt(err/n);
+      if(err<=1.0) break;
+      m->adapt.nrej++;
+      h*=max(0.9*pow(err,-pw),0.2);                 // retry with a smaller step
+      if(h<ADHMIN) nrerror(" Step size too small in routine adapt_dense ");
+    }
+    m->adapt.nacc++;
+
+    for(i=1;i<=n;i++){                               // dense output of the accepted step
+      m->adapt.r1[i]=m->adapt.y[i];
+      m->adapt.r2[i]=ynew[i]-m->adapt.y[i];
+      m->adapt.r3[i]=h*m->adapt.dydt[i]-m->adapt.r2[i];
+      m->adapt.r4[i]=m->adapt.r2[i]-h*dydtnew[i]-m->adapt.r3[i];
+    }
+    m->adapt.told=m->adapt.t;
+    m->adapt.hold=h;
+    m->adapt.jac=FALSE;
+
+    m->adapt.t+=h;
+    for(i=1;i<=n;i++){
+      m->adapt.y[i]=fabs(ynew[i]);
+      m->adapt.dydt[i]=dydtnew[i];
+    }
+
+    fac=(err>0.0) ? 0.9*pow(err,-pw) : 5.0;         // next trial step
+    m->adapt.h=min(h*min(fac,5.0),ADHMAX);
+  }
+
+  th=(t-m->adapt.told)/m->adapt.hold;
+  th1=1.0-th;
+  for(i=1;i<=n;i++) 
+    yout[i]=m->adapt.r1[i]+th*(m->adapt.r2[i]+th1*(m->adapt.r3[i]+th*(m->adapt.r4[i]+th1*m->adapt.r5[i])));
+}
+
+
+//============================== FORCING TABLE ===============================
+
+
+// fill the table t from the forcing of a year (as in the model)
+void set_forcing_table(forcing_table *t, const double mld[], const double mldo[], const double tem[],
+		       const double sir[], const double wsp[], const double sal[])
+{
+  int i, j;
+  carbconst kk;
+
+  for(i=0;i<HSTEP;i++){
+    get_carbonate_constants(sal[i],tem[i],&kk);
+    t->kc1[i]=kk.kc1;
+    t->kc2[i]=kk.kc2;
+    t->kb[i]=kk.kb;
+    t->kp2[i]=kk.kp2;
+    t->kp3[i]=kk.kp3;
+    t->kw[i]=kk.kw;
+    t->fh[i]=kk.fh;
+    t->bo[i]=kk.bo;
+    t->kh[i]=kk.kh;
+    t->kcal[i]=kk.kcal;
+    t->karag[i]=kk.karag;
+
+    t->gtv[i]=get_gas_transfer_velocity(wsp[i],tem[i]);
+    t->co2sol[i]=get_co2_solubility(sal[i],tem[i]);
+
+    t->varT[i]=exp(0.063*tem[i]);
+
+    j=min(i+1,HSTEP-1);      // the start of hour i is the forcing at i+1, as in set_forcing
+    t->varH[i]=mld[j];
+    t->varHp[i]=max(mld[j],0.0);
+    t->mixed[i]=mldo[j];
+    t->esurf[i]=sir[j];
+  }
+}
+
+
+// get the carbonate constants at hour k from the forcing table
+void get_carbonate_table(model *m, int k, carbconst *kk)
+{
+  kk->kc1=m->ftab->kc1[k];
+  kk->kc2=m->ftab->kc2[k];
+  kk->kb=m->ftab->kb[k];
+  kk->kp2=m->ftab->kp2[k];
+  kk->kp3=m->ftab->kp3[k];
+  kk->kw=m->ftab->kw[k];
+  kk->fh=m->ftab->fh[k];
+  kk->bo=m->ftab->bo[k];
+  kk->kh=m->ftab->kh[k];
+  kk->kcal=m->ftab->kcal[k];
+  kk->karag=m->ftab->karag[k];
+}
+
+
+//================================ FORCING ===================================
+
+
+// set the globals read by derivs for hour k of the year: light and 
+// carbonate systems are computed with the given total chlorophyll, 
+// alkalinity, TCO2 and silicate. MLD and surface light are linearly 
+// interpolated towards hour k+1 by the fraction f of the hour elapsed.
+void set_forcing(model *m, int k, double f, double chlo, double alk, double tco2, double sil, carbonate *carb)
+{
+  light lt;
+  carbconst kk;
+
+  // ================= light system ==================
+
+  if(f==0.0){           // at the start of the hour, from the forcing table
+    m->varH=m->ftab->varH[k];
+    m->varHp=m->ftab->varHp[k];
+    m->mixed=m->ftab->mixed[k];
+    m->esurf=m->ftab->esurf[k];
+    m->exch=(m->diff+m->varHp)/m->mixed;
+  }
+  else{
+    m->varH=m->mld[k+1]+f*(m->mld[k+2]-m->mld[k+1]);     // mixed layer depth variation, h(t)=dM/dt as in FASH93
+    m->mixed=m->mldo[k+1]+f*(m->mldo[k+2]-m->mldo[k+1]);  // mixed layer depth, M(t) in FASH93
+
+    //esurf=get_light_at_surface(k+1);        // CALCULATED light at surface at time k of the year
+    m->esurf=m->sir[k+1]+f*(m->sir[k+2]-m->sir[k+1]);     // MEASURED   light at surface at time k of the year
+
+    m->varHp=max(m->varH,0.0);
+    m->exch=(m->diff+m->varHp)/m->mixed;
+  }
+
+#if LIGHT_TABLE
+  if(m->par.isat==ISAT && m->par.isateh==ISATEH)
+    get_light_table(m->esurf,chlo,m->mixed,&lt);      // interpolated from the light table
+  else                                                // (built with ISAT and ISATEH)
+    get_light_limitation(m->esurf,chlo,m->mixed,m->par.isat,m->par.isateh,&lt);
+#else
+  get_light_limitation(m->esurf,chlo,m->mixed,m->par.isat,m->par.isateh,&lt);   // light profile through the MLD
+#endif
+
+  m->psi=lt.psi;        // light limitation for all phytopl either than Ehux
+  m->psieh=lt.psieh;    // light limitation for E. huxleyi
+  m->psica=lt.psica;    // light limitation for Calcification
+
+  m->li=lt.li;          // light at a given depth (5 m)
+
+  // ================ carbonate system ================
+
+  m->gtv=m->ftab->gtv[k];                                   // get gas transfer velocity
+  m->co2sol=m->ftab->co2sol[k];                             // get CO2 solubility 
+
+  get_carbonate_table(m,k,&kk);                        // get the constants for hour k
+  get_carbonate_species(alk,tco2,sil,&kk,carb);      // solve the carbonate system once
+  m->nhfail+=carb->hfail;
+
+  m->pco2w=carb->pco2;   // pCO2 in water
+  m->co32=carb->co3;     // [CO3=] 
+  m->o_cal=carb->ocal;   // omega-calcite
+  m->o_ara=carb->oara;   // omega-aragonite
+  m->ph=carb->ph;        // pH
+  m->bica=carb->hco3;    // [HCO3-]
+  m->co2aq=carb->co2;    // [CO2(aq)]
+
+  //ingEH=90.0/exp(o_cal*o_cal);
+  m->ingEH=10.0/(m->o_cal*m->o_cal*m->o_cal*m->o_cal); //16.45
+  //MEH=1.2/(1.3*o_cal*o_cal*o_cal);//f(x)=1.2/(1.3*x*x*x)
+
+  // =============== temperature system ===============
+
+  m->varT=m->ftab->varT[k];          // growth limitation with temperature (EPPL72)
+  m->varTeh=m->ftab->varT[k];
+}
+
+
+// derivs with the forcing at time t, computed from the state y itself 
+// rather than from the state at the start of the hour (used by the 
+// adaptive integrator, whose steps span several hours)
+void derivs_forced(model *m, double t, double y[], double dydt[])
+{
+  int k;
+
+  k=(int)t;                     // hour of the year, starting from TI
+  if(k<1) k=1;
+  if(k>HSTEP-3) k=HSTEP-3;
+
+  // constant Chl:C ratio, as in rkdriver
+  set_forcing(m,k,min(max(t-k,0.0),1.0),NTOC*CHLTOC*(fabs(y[1])+fabs(y[2])+fabs(y[8])+fabs(y[9])),
+	      fabs(y[14]),fabs(y[13]),fabs(y[4]),&m->carb);
+
+  derivs(m,t,y,dydt);
+}
+
+
+//============================= DERIVS ROUTINE ================================
+
+
+// terms of the right-hand side at state y (nutrient limitation, grazing,
+// sinking, calcification and growth), shared by derivs and set_diagnostics
+struct rates {
+  double qd1, qd2, qf1, qf2, qdf1, qdf2, qeh1, qeh2;  // uptake of nitrate (1) and ammonium (2)
+  double phid, phif, phidf, phieh;                  // nutrient limitation
+  double g1, g2, g3, g4, g5, g7, g8, g9;            // grazing
+  double sinkd, sinko;                              // sinking of diatoms and of the others
+  double calc, detach;                              // calcification and detachment of coccoliths
+  double ad, af, adf, aeh;                          // growth
+};
+
+// the lane of the model m
+static inline void get_lane(const model *m, lanes<1> *l)
+{
+  l->md[0]=m->par.md;
+  l->mf[0]=m->par.mf;
+  l->mdf[0]=m->par.mdf;
+  l->meh[0]=m->par.meh;
+  l->mzmi[0]=m->par.mzmi;
+  l->mzme[0]=m->par.mzme;
+  l->zmid[0]=m->par.zmid;
+  l->zmif[0]=m->par.zmif;
+  l->zmie[0]=m->par.zmie;
+  l->zmed[0]=m->par.zmed;
+  l->zmedf[0]=m->par.zmedf;
+  l->zmemi[0]=m->par.zmemi;
+  l->kmig[0]=m->par.kmig;
+  l->kmeg[0]=m->par.kmeg;
+  l->vdt[0]=m->par.vdt;
+  l->psi[0]=m->psi;
+  l->psieh[0]=m->psieh;
+  l->psica[0]=m->psica;
+  l->pco2w[0]=m->pco2w;
+}
+
+// The branches on the state are written as selects between values that
+// are both computed, and min and max inline, so that the loop over the
+// lanes of derivs_batch can be vectorised.
+template<int N> static inline void get_rates(const model *m, const lanes<N> *l, const double y[][N], int w, rates *r)
+{
+  double yy=m->yy;   // before 1995 (yy<Y-NTY+1) no microzoo grazing on diatoms and no coccoliths,
+                     // compared in each lane so that the selects can be vectorised
+  double phis;
+  double gl, gh, g7l, g5l, g5h, g2l, g2h, ge, sinkl, da, db;
+  int low;
+
+  r->g8=r->g9=0.0;
+
+  //========================= AMMONIA ==========================
+
+  //phid=min(y[3]/(y[3]+NHD),y[10]/(y[10]+PHD));
+  //phif=min(y[3]/(y[3]+NHF),y[10]/(y[10]+PHF));
+  //phidf=min(y[3]/(y[3]+NHDF),y[10]/(y[10]+PHDF));
+  //phieh=min(y[3]/(y[3]+NHEH),0.7+(0.3*y[10]/(y[10]+PHEH)));
+
+  r->qd1=(y[3][w]/NHD)/(1.0 + y[3][w]/NHD + y[10][w]/AHD);
+  r->qd2=(y[10][w]/AHD)/(1.0 + y[3][w]/NHD + y[10][w]/AHD);
+
+  r->qf1=(y[3][w]/NHF)/(1.0 + y[3][w]/NHF + y[10][w]/AHF);
+  r->qf2=(y[10][w]/AHF)/(1.0 + y[3][w]/NHF + y[10][w]/AHF);
+  
+  r->qdf1=(y[3][w]/NHDF)/(1.0 + y[3][w]/NHDF + y[10][w]/AHDF);
+  r->qdf2=(y[10][w]/AHDF)/(1.0 + y[3][w]/NHDF + y[10][w]/AHDF);
+  
+  //if(yy<Y-NTY+1){ 
+  //  qeh1=0.0;
+  //  qeh2=0.0;
+  //}
+  //else{
+  r->qeh1=(y[3][w]/NHEH)/(1.0 + y[3][w]/NHEH + y[10][w]/AHEH);
+  r->qeh2=(y[10][w]/AHEH)/(1.0 + y[3][w]/NHEH + y[10][w]/AHEH);
+  //}
+
+  r->phid = r->qd1 + r->qd2;    //(y[3]/NHD + y[10]/AHD)/(1 + y[3]/NHD + y[10]/AHD);
+  r->phif = r->qf1 + r->qf2;    //(y[3]/NHF + y[10]/AHF)/(1 + y[3]/NHF + y[10]/AHF);
+  r->phidf = r->qdf1 + r->qdf2; //(y[3]/NHDF + y[10]/AHDF)/(1 + y[3]/NHDF + y[10]/AHDF);
+  r->phieh = r->qeh1 + r->qeh2; //(y[3]/NHEH + y[10]/AHEH)/(1 + y[3]/NHEH + y[10]/AHEH);
+
+  //============================================================
+
+
+  phis=y[4][w]/(y[4][w]+SH); 
+
+  r->phid=(r->phid<=phis) ? r->phid : phis;
+
+  // microzooplankton grazing 
+  // g2: on flagellates
+  // g5: on Ehuxleyi
+  // g7: on diatoms
+  // g8: on detritus
+  //g2=ZMIF*P2*y[2]*y[2]*y[7]/(KMIG*(P2*y[2]+P5*y[9]+P7*y[1])+(P2*y[2]*y[2]+P5*y[9]*y[9]+P7*y[1]*y[1])); 
+  //g5=ZMIE*P5*y[9]*y[9]*y[7]/(KMIG*(P2*y[2]+P5*y[9]+P7*y[1])+(P2*y[2]*y[2]+P5*y[9]*y[9]+P7*y[1]*y[1])); 
+  //g7=ZMID*P7*y[1]*y[1]*y[7]/(KMIG*(P2*y[2]+P5*y[9]+P7*y[1])+(P2*y[2]*y[2]+P5*y[9]*y[9]+P7*y[1]*y[1]));
+  //g7=0.0;
+
+  // with the preferences for silicate below (l, after 1995 only) and above (h) 3 uM
+  gl=l->kmig[w]*(P2*y[2][w]+P5*y[9][w]+P7*y[1][w])+(P2*y[2][w]*y[2][w]+P5*y[9][w]*y[9][w]+P7*y[1][w]*y[1][w]);
+  gh=l->kmig[w]*(P2d*y[2][w]+P5d*y[9][w]+P7d*y[1][w])+(P2d*y[2][w]*y[2][w]+P5d*y[9][w]*y[9][w]+P7d*y[1][w]*y[1][w]);
+  g7l=l->zmid[w]/24.0*P7*y[1][w]*y[1][w]*y[7][w]/gl;
+  g5l=l->zmie[w]/24.0*P5*y[9][w]*y[9][w]*y[7][w]/gl;
+  g5h=l->zmie[w]/24.0*P5d*y[9][w]*y[9][w]*y[7][w]/gh;
+  g2l=l->zmif[w]/24.0*P2*y[2][w]*y[2][w]*y[7][w]/gl;
+  g2h=l->zmif[w]/24.0*P2d*y[2][w]*y[2][w]*y[7][w]/gh;
+  low=(yy>=Y-NTY+1 && y[4][w]<3.0);    // if silicate is less than 3uM
+  r->g7=low ? g7l : 0.0;
+  r->g5=low ? g5l : g5h;
+  r->g2=low ? g2l : g2h;
+
+  // mesozooplankton grazing
+  // g1: on diatoms
+  // g3: on dinoflagellates
+  // g4: on microzzoplankton
+  // g9: on detritus
+  ge=l->kmeg[w]*(P1*y[1][w]+P3*y[8][w]+P4*y[7][w])+(P1*y[1][w]*y[1][w]+P3*y[8][w]*y[8][w]+P4*y[7][w]*y[7][w]);
+  r->g1=l->zmed[w]/24.0*P1*y[1][w]*y[1][w]*y[5][w]/ge; 
+  r->g3=l->zmedf[w]/24.0*P3*y[8][w]*y[8][w]*y[5][w]/ge; 
+  r->g4=l->zmemi[w]/24.0*P4*y[7][w]*y[7][w]*y[5][w]/ge;
+
+  // diatoms sinking accelerates as silicate is depleted
+  
+  // Fasham style  (Rosa's upgrade)
+  //sink=VD*(SH/(y[4] + SH));
+       
+  // Toby's style (TYRR96)
+  // diatoms
+  sinkl=VD*(1.0+(7.0*(2.0-y[4][w])/2.0));
+  r->sinkd=(y[4][w]<2.0) ? sinkl : VD;
+  // others
+  r->sinko=VDO;
+
+  // Eslinger's style (ESLI01)
+  //sink=5.0*(1.0-tanh(0.1375*y[4]));
+
+  // Pondaven's style (POND99)
+  //if(y[3]>NHD && y[4]>SH) sink=0.0/24.0;
+  //if(y[3]<NHD || y[4]<SH) sink=5.0/24.0;
+  r->calc=(yy<Y-NTY+1) ? 0.0 : CALMAX*m->varT*l->psica[w]; // CALMAX in: mmol cal-C (mmol org-C)-1 h-1 = mg cal-C (mg org-C)-1 h-1
+
+  // transfer from attached (coccosphere) liths to free liths is
+  // governed by the average number of liths usually found per cell
+  // = ((y[11]/COCCAR) / (y[9]/EHOCAR)).
+  // The ratio of liths in the coccosphere to E.hux cells should not
+  // exceed this number.  It is assumed that there will always be
+  // some (perhaps small) detachment of free liths
+  // y[11]  must be in: mmol cal-C m-3 
+  // y[9]   must be in: mmol org-C m-3
+  // COCCAR must be in: mmol cal-C coccolith-1
+  // EHOCAR must be in: mmol org-C cell-1
+  
+  //cocpereh=(y[11]/(CTON*y[9]))/(COCCAR/EHOCAR);
+  //detach=((cocpereh-COCMAX)*((CTON*y[9])/EHOCAR)*COCCAR)+(MEH*y[11]);
+  //if(detach<(DETMIN*y[11])) detach=DETMIN*y[11];
+  da=DET*(y[11][w]-(COCMAX*COCCAR*(CTON*y[9][w]/EHOCAR)));
+  db=DETMIN*y[11][w];
+  r->detach=(yy<Y-NTY+1) ? 0.0 : ((da>=db) ? da : db);
+  // detachment of coccoliths (number of cocco. getting detached from the cell as in Eq. 10 in TYRR96)
+  // in mmol calcite C m-3 day-1
+  // using CTON* instead of ICOC*
+  // double detach=max((y[11]-(COCMAX*COCCAR*(6.0/30.0)*(CTON*y[9]/EHOCAR))),(DETMIN*y[11]));
+
+  // growth terms
+  r->ad = MUD0*m->varT*l->psi[w]*r->phid;      // diatoms
+  r->af = MUF0*m->varT*l->psi[w]*r->phif;      // flagellates
+  r->adf = MUDF0*m->varT*l->psi[w]*r->phidf;   // dinoflagellates
+
+  //if(yy<Y-NTY+1) aeh = 0.0;
+  //else 
+  r->aeh = MUEH0*m->varTeh*l->psieh[w]*r->phieh; // Ehuxleyi
+}
+
+
+// right-hand side of the ODEs at the state y of lane w, written once for
+// derivs (a model, one lane) and derivs_batch (LANES)
+template<int N> static inline void get_rhs(const model *m, const lanes<N> *l, const double y[][N], int w, double dydt[][N])
+{
+  rates r;
+  double varHp=m->varHp;
+  double dac, dfc;   // attached and free coccoliths, 0 before 1995
+  double yy=m->yy;   // compared in each lane, as in get_rates
+
+  get_rates(m,l,y,w,&r);
+
+
+  // -- [1] -- ODE FOR DIATOMS -- in: mmol N m-3
+  
+  dydt[1][w] = r.ad*y[1][w] - r.g1 - r.g7 - l->md[w]/24.0*y[1][w] - ((r.sinkd+m->diff+varHp)/m->mixed)*y[1][w]; 
+
+
+  // -- [2] -- ODE FOR FLAGELLATES -- in: mmol N m-3
+  
+  dydt[2][w] = r.af*y[2][w] - r.g2 - l->mf[w]/24.0*y[2][w] - ((r.sinko+m->diff+varHp)/m->mixed)*y[2][w];  
+
+  
+  // -- [3] -- ODE FOR NITRATE -- in: mmol N m-3
+  
+  dydt[3][w] = - MUD0*m->varT*l->psi[w]*(r.qd1/(r.qd1+r.qd2))*r.phid*y[1][w] - MUF0*m->varT*l->psi[w]*r.qf1*y[2][w] - MUDF0*m->varT*l->psi[w]*r.qdf1*y[8][w] - 
+              MUEH0*m->varTeh*l->psieh[w]*r.qeh1*y[9][w] + NIT*y[10][w] + m->exch*(m->nbo-y[3][w]); 
+
+
+  // -- [4] -- ODE FOR SILICATE -- in: mmol Si m-3
+
+  dydt[4][w] = - r.ad*y[1][w] + m->exch*(m->sbo-y[4][w]);  
+
+  
+  // -- [5] -- ODE FOR MESOZOOPLANKTON -- in: mmol N m-3 (graze on: diatom, dinofla, microzoo, detritus)
+
+  dydt[5][w] = B1*r.g1 + B3*r.g3 + B4*r.g4 + B9*r.g9 - EXME*y[5][w] - l->mzme[w]/24.0*y[5][w]*y[5][w] - (m->varH/m->mixed)*y[5][w];    
+
+
+  // -- [6] -- ODE FOR DETRITUS -- in: mmol N m-3
+
+  dydt[6][w] = (1-B1)*r.g1 + (1-B2)*r.g2 + (1-B3)*r.g3 + (1-B4)*r.g4 + (1-B5)*r.g5 + (1-B7)*r.g7 + (1-B8)*r.g8 + (1-B9)*r.g9 +
+            l->md[w]/24.0*y[1][w] + l->mf[w]/24.0*y[2][w] + l->mdf[w]/24.0*y[8][w] + l->meh[w]/24.0*y[9][w] - r.g8 - r.g9 - MDE*y[6][w] - ((m->diff+varHp+l->vdt[w]/24.0)/m->mixed)*y[6][w];  
+           
+
+  // -- [7] -- ODE FOR MICROZOOPLANKTON -- in: mmol N m-3 (graze on: flage, Ehux, free cocco, detritus) 
+
+  dydt[7][w] = B2*r.g2 + B5*r.g5 + B7*r.g7 + B8*r.g8 - EXMI*y[7][w] - l->mzmi[w]/24.0*y[7][w]*y[7][w] - r.g4 - (m->varH/m->mixed)*y[7][w];
+
+
+  // -- [8] -- ODE FOR DINOFLAGELLATES -- in: mmol N m-3
+  
+  dydt[8][w] = r.adf*y[8][w] - r.g3 - l->mdf[w]/24.0*y[8][w] - ((r.sinko+m->diff+varHp)/m->mixed)*y[8][w];  
 
 
   // -- [9] -- ODE FOR EMILIANIA HUXLEYI -- in: mmol N m-3 here, in output file also in mmol C m-3
 
-  //if(yy<Y-6) dydt[9] = 0.0;
+  //if(yy<Y-NTY+1) dydt[9] = 0.0;
   //else 
-  dydt[9] = aeh*y[9] - g5 - MEH*y[9] - ((sinko+diff+varHp)/mixed)*y[9];  
+  dydt[9][w] = r.aeh*y[9][w] - r.g5 - l->meh[w]/24.0*y[9][w] - ((r.sinko+m->diff+varHp)/m->mixed)*y[9][w];  
 
   // -- [10] -- ODE FOR AMMONIUM -- in: mmol N m-3
 
-  dydt[10] = - MUD0*varT*psi*(qd2/(qd1+qd2))*phid*y[1] - MUF0*varT*psi*qf2*y[2] - 
-               MUDF0*varT*psi*qdf2*y[8] - MUEH0*varTeh*psieh*qeh2*y[9] +
-               (EXME*y[5] + EXMI*y[7] + FZRME*MZME*y[5]*y[5] + FZRMI*MZMI*y[7]*y[7] + MDE*y[6]) - 
-               NIT*y[10] - ((diff+varHp)/mixed)*y[10]; 
+  dydt[10][w] = - MUD0*m->varT*l->psi[w]*(r.qd2/(r.qd1+r.qd2))*r.phid*y[1][w] - MUF0*m->varT*l->psi[w]*r.qf2*y[2][w] - 
+               MUDF0*m->varT*l->psi[w]*r.qdf2*y[8][w] - MUEH0*m->varTeh*l->psieh[w]*r.qeh2*y[9][w] +
+               (EXME*y[5][w] + EXMI*y[7][w] + FZRME*l->mzme[w]/24.0*y[5][w]*y[5][w] + FZRMI*l->mzmi[w]/24.0*y[7][w]*y[7][w] + MDE*y[6][w]) - 
+               NIT*y[10][w] - m->exch*y[10][w]; 
 
 
   // -- [11] -- ODE FOR ATTACHED COCCOLITHS -- in: mmol calcite-C m-3 here
   //
   // Attached coccoliths: calcification (i.e. newly produced coccoliths, attached) - grazing - 
   //                      cell mortality - detachment - mixing
-  if(yy<Y-6) dydt[11] = 0.0;
-  else dydt[11] = calc*CTON*y[9] - (g5/y[9])*y[11] - MEH*y[11] - detach - ((diff+varHp)/mixed)*y[11]; 
+  dac = r.calc*CTON*y[9][w] - (r.g5/y[9][w])*y[11][w] - l->meh[w]/24.0*y[11][w] - r.detach - m->exch*y[11][w]; 
+  dydt[11][w] = (yy<Y-NTY+1) ? 0.0 : dac;
 
 
   // -- [12] -- ODE FOR FREE COCCOLITHS -- in: mmol calcite-C m-3 here
@@ -1985,15 +3293,15 @@ void derivs(double t, double y[], double dydt[])
   //                  fraction of cocco not ingested during grazing -
   //                  grazing on free coccoliths - dissolution - mixing 
 
-  if(yy<Y-6) dydt[12] = 0.0;
-  else dydt[12] = detach + MEH*y[11] + 0.1*(g5/y[9])*y[11] - DISSOL*y[12] - ((diff+varHp)/mixed)*y[12];
+  dfc = r.detach + l->meh[w]/24.0*y[11][w] + 0.1*(r.g5/y[9][w])*y[11][w] - DISSOL*y[12][w] - m->exch*y[12][w];
+  dydt[12][w] = (yy<Y-NTY+1) ? 0.0 : dfc;
   //0.5*(g5/y[9])*y[12]
 
   // -- [13] -- ODE FOR DISSOLVED INORGANIC CARBON -- in: umol C m-3
   //
-  dydt[13] = - CTON*(ad*y[1] + af*y[2] + adf*y[8] + aeh*y[9] + calc*y[9]) + CTON*MDE*y[6] + 
-               CTON*(EXME*y[5] + EXMI*y[7] + FZRMI*MZMI*y[7]*y[7] + FZRME*MZME*y[5]*y[5]) + 
-               DISSOL*y[12] + gtv*co2sol*(PCO2A-pco2w)/mixed + ((diff+varHp)/mixed)*(DIC0-y[13]); 
+  dydt[13][w] = - CTON*(r.ad*y[1][w] + r.af*y[2][w] + r.adf*y[8][w] + r.aeh*y[9][w] + r.calc*y[9][w]) + CTON*MDE*y[6][w] + 
+               CTON*(EXME*y[5][w] + EXMI*y[7][w] + FZRMI*l->mzmi[w]/24.0*y[7][w]*y[7][w] + FZRME*l->mzme[w]/24.0*y[5][w]*y[5][w]) + 
+               DISSOL*y[12][w] + m->gtv*m->co2sol*(PCO2A-l->pco2w[w])/m->mixed + m->exch*(DIC0-y[13][w]); 
   
   //                                NOTE:
   // 
@@ -2016,7 +3324,7 @@ void derivs(double t, double y[], double dydt[])
   //
   // ALL THE REST: nitrate upake, ammonium uptake, ammonification, etc. is negligible!
   //
-  dydt[14] = - 2.0*calc*CTON*y[9] + 2.0*DISSOL*y[12] + ((diff+varHp)/mixed)*(ALK0-y[14]);
+  dydt[14][w] = - 2.0*r.calc*CTON*y[9][w] + 2.0*DISSOL*y[12][w] + m->exch*(ALK0-y[14][w]);
     //           MUD0*varT*psi*(qd1/(qd1+qd2))*phid*y[1] + MUF0*varT*psi*qf1*y[2] + 
     //           MUDF0*varT*psi*qdf1*y[8] + MUEH0*varTeh*psieh*qeh1*y[9] -
     //           (MUD0*varT*psi*(qd2/(qd1+qd2))*phid*y[1] + MUF0*varT*psi*qf2*y[2] + 
@@ -2025,95 +3333,915 @@ void derivs(double t, double y[], double dydt[])
     //           ((diff+varHp)/mixed)*(ALK0-y[14]);
 
 
-  // =========== DIAGNOSTIC VARIABLES ============
+  // ============ MASS BALANCE CHECK =============
+
 
-  grazd=g7/y[1];         // microzoo grazing on diatoms
-  if(yy<Y-6) graze=0.0;  // microzoo grazing on Ehux before 1995
-  else graze=g5/y[9];    // microzoo grazing on Ehux after 1995
+  //double mbs=0.0;    
+  //double mbn=0.0;
+  //double diff=0.0;
 
-  regphypro = MUD0*varT*psi*(qd2/(qd1+qd2))*phid*y[1] + MUF0*varT*psi*qf2*y[2] + 
-              MUDF0*varT*psi*qdf2*y[8] + MUEH0*varT*psieh*qeh2*y[9]; 
+  //diff=(mm+varHp)/mixed;
 
-  regdiapro = (y[10]/AHF)/(1.0 + y[3]/NHF + y[10]/AHF);//MUD0*varT*psi*(qd2/(qd1+qd2))*phid*y[1];
-  regdinpro = y[10]/AHF;//MUDF0*varT*psi*qdf2*y[8];
-  regflapro = 1.0 + y[3]/NHF + y[10]/AHF;//MUF0*varT*psi*qf2*y[2];
-  regehupro = y[3];//MUEH0*varT*psieh*qeh2*y[9];
-  regtest = y[10];
+  // -- silicate cycle --
+  //dydt[7] = 0.5*ZDG*y[5]*y[1] + 0.8*MDMAX*y[1]*y[1]/(KD+y[1]) + (VD/mixed)*y[1] + diff*y[1] - diff*(S0-y[4]);
+  //mbs = yi1 + yi4 - (y[1] + y[4] + y[7]);  // silicate mass balance
 
-  newphypro = MUD0*varT*psi*(qd1/(qd1+qd2))*phid*y[1] + MUF0*varT*psi*qf1*y[2] + 
-              MUDF0*varT*psi*qdf1*y[8] + MUEH0*varT*psieh*qeh1*y[9]; 
+  // -- nitrogen cycle --
+  //dydt[8] = (VD/mixed)*y[1] + (VDF/mixed)*y[2] + (VDT/mixed)*y[6] + 
+  //          diff*y[1] + diff*y[2] + (varH/mixed)*y[5] + diff*y[6] - diff*(N0-y[3]);
 
-  totphypro = ad*y[1] + af*y[2] + adf*y[8] + aeh*y[9];
+  //mbn = yi1 + yi2 + yi3 + yi5 + yi6 - (y[1] + y[2] + y[3] + y[5] + y[6] + y[8]); // nitrogen mass balance
+  
+  //if(mbs>1.0e-12) cout<<" - warning! - mass balance violation in the silicate cycle "<<"\n";
+  //if(mbn>1.0e-12) cout<<" - warning! - mass balance violation in the nitrogen cycle "<<"\n";          
 
-  totphyloss = g1+g7+MD*y[1]+((sinkd+diff+varHp)/mixed)*y[1] + g2+MF*y[2]+((sinko+diff+varHp)/mixed)*y[2] +
-               g3+MDF*y[8]+((sinko+diff+varHp)/mixed)*y[8]+g5 + MEH*y[9]+((sinko+diff+varHp)/mixed)*y[9];
 
-  totphymix = ((sinkd+diff+varHp)/mixed)*y[1]+((sinko+diff+varHp)/mixed)*y[2]+
-              ((sinko+diff+varHp)/mixed)*y[8]+((sinko+diff+varHp)/mixed)*y[9];
+  // =============================================
+}
 
-  pon = y[1]+y[2]+y[8]+y[9]+y[7]+y[5]+y[6]; // phy + zoo + det 
 
-  calcieh = calc*CTON*y[9];   // PIC in: mmol inorganic C m-3 h-1
+// right-hand side of the ODEs at state y; the diagnostic variables are
+// not set here but by set_diagnostics, at the output instants only
+void derivs(model *m, double t, double y[], double dydt[])
+{
+  int i;
+  lanes<1> l;
 
-  photoeh = aeh*CTON*y[9];    // POC in: mmol organic C m-3 h-1
+  m->nrhs++;
 
-  totzoopro = B1*g1 + B2*g2 + B3*g3 + B4*g4 + B5*g5 + B7*g7;
+  for(i=1;i<=14;i++) y[i]=fabs(y[i]);
+  get_lane(m,&l);
+  get_rhs(m,&l,(double (*)[1])y,0,(double (*)[1])dydt);   // y[i] is y[i][0] of one lane
+}
 
-  totzooloss = EXME*y[5]+MZME*y[5]*y[5]+(varH/mixed)*y[5] + EXMI*y[7]+MZMI*y[7]*y[7]+g4+(varH/mixed)*y[7];
 
-  dianutgro=MUD0*varT*phid;
-  dinnutgro=MUDF0*varT*phidf;
-  flanutgro=MUF0*varT*phif;
-  ehunutgro=MUEH0*varT*phieh;
+// diagnostic variables at state y, only the groups in m->diag
+void set_diagnostics(model *m, const double y[])
+{
+  lanes<1> l;
+  rates r;
+  double varHp=m->varHp;
+
+  get_lane(m,&l);
+  get_rates(m,&l,(const double (*)[1])y,0,&r);
+
+  if(m->diag&DGRAZ){
+    m->grazd=r.g7/y[1];         // microzoo grazing on diatoms
+    if(m->yy<Y-NTY+1) m->graze=0.0;  // microzoo grazing on Ehux before 1995
+    else m->graze=r.g5/y[9];    // microzoo grazing on Ehux after 1995
+
+    m->diagra=(r.g1+r.g7)/y[1];
+    m->dingra=r.g3/y[8];
+    m->flagra=r.g2/y[2];
+    m->ehugra=r.g5/y[9];
+    m->micgra=r.g4/y[7];
+  }
 
-  dialightgro=MUD0*varT*psi;
-  dinlightgro=MUDF0*varT*psi;
-  flalightgro=MUF0*varT*psi;
-  ehulightgro=MUEH0*varT*psieh;
+  if(m->diag&DPROD){
+    m->regphypro = MUD0*m->varT*m->psi*(r.qd2/(r.qd1+r.qd2))*r.phid*y[1] + MUF0*m->varT*m->psi*r.qf2*y[2] + 
+                MUDF0*m->varT*m->psi*r.qdf2*y[8] + MUEH0*m->varT*m->psieh*r.qeh2*y[9]; 
 
-  diagra=(g1+g7)/y[1];
-  dingra=g3/y[8];
-  flagra=g2/y[2];
-  ehugra=g5/y[9];
-  micgra=g4/y[7];
+    m->regdiapro = (y[10]/AHF)/(1.0 + y[3]/NHF + y[10]/AHF);//MUD0*varT*psi*(qd2/(qd1+qd2))*phid*y[1];
+    m->regdinpro = y[10]/AHF;//MUDF0*varT*psi*qdf2*y[8];
+    m->regflapro = 1.0 + y[3]/NHF + y[10]/AHF;//MUF0*varT*psi*qf2*y[2];
+    m->regehupro = y[3];//MUEH0*varT*psieh*qeh2*y[9];
+    m->regtest = y[10];
 
-  callightgro=CTON*calc;
-  caltemgro=(detach+MEH*y[11]+0.1*(g5/y[9])*y[11]);
+    m->newphypro = MUD0*m->varT*m->psi*(r.qd1/(r.qd1+r.qd2))*r.phid*y[1] + MUF0*m->varT*m->psi*r.qf1*y[2] + 
+                MUDF0*m->varT*m->psi*r.qdf1*y[8] + MUEH0*m->varT*m->psieh*r.qeh1*y[9]; 
 
-  // ============ MASS BALANCE CHECK =============
+    m->totphypro = r.ad*y[1] + r.af*y[2] + r.adf*y[8] + r.aeh*y[9];
 
+    m->totzoopro = B1*r.g1 + B2*r.g2 + B3*r.g3 + B4*r.g4 + B5*r.g5 + B7*r.g7;
 
-  //double mbs=0.0;    
-  //double mbn=0.0;
-  //double diff=0.0;
+    m->pon = y[1]+y[2]+y[8]+y[9]+y[7]+y[5]+y[6]; // phy + zoo + det 
+  }
 
-  //diff=(mm+varHp)/mixed;
+  if(m->diag&DLOSS){
+    m->totphyloss = r.g1+r.g7+m->par.md/24.0*y[1]+((r.sinkd+m->diff+varHp)/m->mixed)*y[1] + r.g2+m->par.mf/24.0*y[2]+((r.sinko+m->diff+varHp)/m->mixed)*y[2] +
+                 r.g3+m->par.mdf/24.0*y[8]+((r.sinko+m->diff+varHp)/m->mixed)*y[8]+r.g5 + m->par.meh/24.0*y[9]+((r.sinko+m->diff+varHp)/m->mixed)*y[9];
 
-  // -- silicate cycle --
-  //dydt[7] = 0.5*ZDG*y[5]*y[1] + 0.8*MDMAX*y[1]*y[1]/(KD+y[1]) + (VD/mixed)*y[1] + diff*y[1] - diff*(S0-y[4]);
-  //mbs = yi1 + yi4 - (y[1] + y[4] + y[7]);  // silicate mass balance
+    m->totphymix = ((r.sinkd+m->diff+varHp)/m->mixed)*y[1]+((r.sinko+m->diff+varHp)/m->mixed)*y[2]+
+                ((r.sinko+m->diff+varHp)/m->mixed)*y[8]+((r.sinko+m->diff+varHp)/m->mixed)*y[9];
 
-  // -- nitrogen cycle --
-  //dydt[8] = (VD/mixed)*y[1] + (VDF/mixed)*y[2] + (VDT/mixed)*y[6] + 
-  //          diff*y[1] + diff*y[2] + (varH/mixed)*y[5] + diff*y[6] - diff*(N0-y[3]);
+    m->totzooloss = EXME*y[5]+m->par.mzme/24.0*y[5]*y[5]+(m->varH/m->mixed)*y[5] + EXMI*y[7]+m->par.mzmi/24.0*y[7]*y[7]+r.g4+(m->varH/m->mixed)*y[7];
+  }
 
-  //mbn = yi1 + yi2 + yi3 + yi5 + yi6 - (y[1] + y[2] + y[3] + y[5] + y[6] + y[8]); // nitrogen mass balance
-  
-  //if(mbs>1.0e-12) cout<<" - warning! - mass balance violation in the silicate cycle "<<"\n";
-  //if(mbn>1.0e-12) cout<<" - warning! - mass balance violation in the nitrogen cycle "<<"\n";          
+  if(m->diag&DGROW){
+    m->dianutgro=MUD0*m->varT*r.phid;
+    m->dinnutgro=MUDF0*m->varT*r.phidf;
+    m->flanutgro=MUF0*m->varT*r.phif;
+    m->ehunutgro=MUEH0*m->varT*r.phieh;
 
+    m->dialightgro=MUD0*m->varT*m->psi;
+    m->dinlightgro=MUDF0*m->varT*m->psi;
+    m->flalightgro=MUF0*m->varT*m->psi;
+    m->ehulightgro=MUEH0*m->varT*m->psieh;
+
+    m->callightgro=CTON*r.calc;
+    m->caltemgro=(r.detach+m->par.meh/24.0*y[11]+0.1*(r.g5/y[9])*y[11]);
+  }
+
+  if(m->diag&DCALC){
+    m->calcieh = r.calc*CTON*y[9];   // PIC in: mmol inorganic C m-3 h-1
+    m->photoeh = r.aeh*CTON*y[9];    // POC in: mmol organic C m-3 h-1
+    m->ingDI=0.45/(tanh(y[4])+y[4]);
+  }
+}
+
+
+//============================== BATCHED ENGINE ===============================
+//
+// The same RK4 integration as rkdriver (INTEGRATOR 1), for the LANES members
+// of a batch at once. Each lane gives exactly the results of rkdriver for
+// its member. The results files are not written, and the diagnostic
+// variables are not computed. derivs_batch evaluates the right-hand side
+// of derivs (get_rhs) for all the lanes in one loop. The light and
+// carbonate systems are still solved lane by lane, once per hour, but what
+// they share (MLD, temperature, surface light, constants) is computed once. Compile with -O3 -march=native for the vector units.
+
+
+// fill a batch with the models m[0..LANES-1] and the n parameter sets
+// par[0..n-1]; the lanes after n repeat the last set
+void set_batch(batch *b, model *m[], const params par[], int n)
+{
+  int w;
+  const params *p;
+
+  for(w=0;w<LANES;w++){
+    p=&par[w<n ? w : n-1];
+    b->m[w]=m[w];
+    b->m[w]->par=*p;
+    b->md[w]=p->md;
+    b->mf[w]=p->mf;
+    b->mdf[w]=p->mdf;
+    b->meh[w]=p->meh;
+    b->mzmi[w]=p->mzmi;
+    b->mzme[w]=p->mzme;
+    b->zmid[w]=p->zmid;
+    b->zmif[w]=p->zmif;
+    b->zmie[w]=p->zmie;
+    b->zmed[w]=p->zmed;
+    b->zmedf[w]=p->zmedf;
+    b->zmemi[w]=p->zmemi;
+    b->kmig[w]=p->kmig;
+    b->kmeg[w]=p->kmeg;
+    b->vdt[w]=p->vdt;
+    b->carb[w].ah=0.0;     // no previous [H+] to start from
+  }
+}
+
+
+// as rkdriver, for all the years and all the lanes
+void rkdriver_batch(batch *b, double vstart[][LANES])
+{
+  int i,k,w;
+  model *m=b->m[0];
+  double t,h;
+  double v[NEQ+1][LANES],vout[NEQ+1][LANES],dv[NEQ+1][LANES];
+
+  double chlo[LANES];  // total chlorophyll (constant Chl:C ratio, as in rkdriver)
+  double sil[LANES];
+  double tco2[LANES];
+  double alk[LANES];
+
+  int y0=0;            // first year to integrate
+  double vprev[NEQ+1][LANES];  // state at the start of the previous year
+  double vw[NEQ+1], vp[NEQ+1];
+  int np;              // lanes with a periodic state
+
+  // A lane whose state is periodic before the others keeps it, with its
+  // [H+] guess and its counts (derivs, [H+] not converged), up to the last
+  // year with the same forcing, as rkdriver skips to it; it is integrated
+  // with the others meanwhile, but the years it would skip are discarded.
+  int last[LANES];     // last year of the forcing of a periodic lane (-1 if not periodic)
+  carbonate cfix[LANES]; // carbonate system of a periodic lane when it became periodic
+  long nrhs[LANES];    // derivs evaluations of each lane at the start of the year
+  long nhfail[LANES];  // [H+] not converged in each lane at the start of the year
+
+  for(w=0;w<LANES;w++){
+    b->m[w]->nspin=0;
+    b->m[w]->ssd=HUGE_VAL;
+    last[w]=-1;
+  }
+
+#if CHECKPOINT
+  checkpoint cp[LANES];
+  for(w=0;w<LANES;w++){
+    for(i=1;i<=NEQ;i++) vw[i]=vstart[i][w];
+    set_checkpoint_keys(b->m[w],vw);
+  }
+  for(y0=get_spinup();y0>0;y0--){   // last year saved for all the lanes
+    for(w=0;w<LANES && get_checkpoint(b->m[w],y0,&cp[w]);w++);
+    if(w==LANES) break;
+  }
+  if(y0>0){
+    for(w=0;w<LANES;w++){
+      set_checkpoint(b->m[w],&cp[w],vw,&b->carb[w].ah);
+      for(i=1;i<=NEQ;i++) vstart[i][w]=vw[i];
+    }
+  }
+#endif
+
+  for(i=1;i<=NEQ;i++)
+    for(w=0;w<LANES;w++) vprev[i][w]=vstart[i][w];
+
+  for(m->yy=y0;m->yy<=Y;m->yy++){
+
+    set_year(m);
+    for(w=1;w<LANES;w++) b->m[w]->yy=m->yy;
+
+    for(i=1;i<=NEQ;i++){
+      for(w=0;w<LANES;w++){
+	v[i][w]=vstart[i][w];
+	b->m[w]->y[i][1]=v[i][w];
+      }
+    }
+    for(w=0;w<LANES;w++){
+      b->m[w]->tt[1]=TI;
+      nrhs[w]=b->m[w]->nrhs;
+      nhfail[w]=b->m[w]->nhfail;
+    }
+    t=TI;
+    h=(double)(TH-TI)/HSTEP;
+
+    for(w=0;w<LANES;w++){
+      chlo[w]=NTOC*(CHLTOC*v[1][w]+CHLTOC*v[2][w]+CHLTOC*v[8][w]+CHLTOC*v[9][w]);
+      sil[w]=v[4][w];
+      tco2[w]=v[13][w];
+      alk[w]=v[14][w];
+    }
+
+    for(k=1;k<=HSTEP-3;k++){
+
+      set_forcing_batch(b,k,chlo,alk,tco2,sil);   // light and carbonate systems at the start of hour k
+      derivs_batch(b,v,dv);
+      rk4_batch(b,v,dv,t,h,vout);
+      t+=h;
+
+      for(i=1;i<=NEQ;i++){
+	for(w=0;w<LANES;w++){
+	  v[i][w]=fabs(vout[i][w]);
+	  b->m[w]->y[i][k+1]=v[i][w];
+	}
+      }
+      for(w=0;w<LANES;w++){
+	b->m[w]->tt[k+1]=t;
+	chlo[w]=NTOC*(CHLTOC*v[1][w]+CHLTOC*v[2][w]+CHLTOC*v[8][w]+CHLTOC*v[9][w]);
+	sil[w]=v[4][w];
+	tco2[w]=v[13][w];
+	alk[w]=v[14][w];
+      }
+    }
+
+    for(w=0;w<LANES;w++){   // new initial conditions, but of the periodic lanes
+      if(m->yy<=last[w]){
+	b->carb[w]=cfix[w];
+	b->m[w]->nrhs=nrhs[w];
+	b->m[w]->nhfail=nhfail[w];
+	continue;
+      }
+      for(i=1;i<=NEQ;i++){
+	vstart[i][w]=v[i][w];
+	b->m[w]->yi[i]=v[i][w];
+      }
+    }
+
+    if(m->yy<get_spinup()){   // spin-up: a lane stops it when its state is periodic
+      np=0;
+      for(w=0;w<LANES;w++){
+	if(m->yy<=last[w]){
+	  np++;
+	  continue;
+	}
+	b->m[w]->nspin++;
+	for(i=1;i<=NEQ;i++){
+	  vw[i]=vstart[i][w];
+	  vp[i]=vprev[i][w];
+	  vprev[i][w]=vstart[i][w];
+	}
+	if(get_periodic(b->m[w],vp,vw)){
+	  last[w]=get_last_year(m);
+	  cfix[w]=b->carb[w];
+#if CHECKPOINT
+	  put_checkpoint(b->m[w],last[w]+1,vw,b->carb[w].ah);
+#endif
+	  np++;
+	}
+      }
+      if(np==LANES) m->yy=get_last_year(m);   // all periodic: skip the years left
+    }
+
+#if CHECKPOINT
+    if(m->yy<get_spinup()){
+      for(w=0;w<LANES;w++){
+	if(m->yy<=last[w]) continue;   // saved at last[w]+1 when it became periodic
+	for(i=1;i<=NEQ;i++) vw[i]=vstart[i][w];
+	put_checkpoint(b->m[w],m->yy+1,vw,b->carb[w].ah);
+      }
+    }
+#endif
+  }
+  for(w=0;w<LANES;w++) end_model(b->m[w]);
+}
+
+
+// as rk4, for all the lanes
+void rk4_batch(batch *b, double y[][LANES], double dydt[][LANES], double t, double h, double yout[][LANES])
+{
+  int i,w;
+  double hh, h6;
+  double dym[NEQ+1][LANES], dyt[NEQ+1][LANES], yt[NEQ+1][LANES];
+
+  hh=h*0.5;
+  h6=h/6.0;
+
+  for(i=1;i<=NEQ;i++) for(w=0;w<LANES;w++) yt[i][w]=y[i][w]+hh*dydt[i][w];  // first step
+  derivs_batch(b,yt,dyt);                                                    // second step
+  for(i=1;i<=NEQ;i++) for(w=0;w<LANES;w++) yt[i][w]=y[i][w]+hh*dyt[i][w];
+  derivs_batch(b,yt,dym);                                                    // third step
+  for(i=1;i<=NEQ;i++){
+    for(w=0;w<LANES;w++){
+      yt[i][w]=y[i][w]+h*dym[i][w];
+      dym[i][w]+=dyt[i][w];
+    }
+  }
+  derivs_batch(b,yt,dyt);                                                    // fourth step 
+  // accumulate increments with proper weights
+  for(i=1;i<=NEQ;i++) for(w=0;w<LANES;w++) yout[i][w]=y[i][w]+h6*(dydt[i][w]+dyt[i][w]+2.0*dym[i][w]);
+}
+
+
+// as set_forcing (with f=0), for all the lanes
+void set_forcing_batch(batch *b, int k, const double chlo[], const double alk[], const double tco2[], const double sil[])
+{
+  int w;
+  light lt;
+  carbconst kk;
+  model *m=b->m[0];
+
+  // ========== the same for all the lanes ===========
+
+  m->varH=m->ftab->varH[k];     // mixed layer depth variation, h(t)=dM/dt as in FASH93
+  m->varHp=m->ftab->varHp[k];
+  m->mixed=m->ftab->mixed[k];   // mixed layer depth, M(t) in FASH93
+  m->esurf=m->ftab->esurf[k];   // MEASURED light at surface at time k of the year
+  m->exch=(m->diff+m->varHp)/m->mixed;
+
+  m->gtv=m->ftab->gtv[k];
+  m->co2sol=m->ftab->co2sol[k];
+  get_carbonate_table(m,k,&kk);
+
+  m->varT=m->ftab->varT[k];
+  m->varTeh=m->ftab->varT[k];
+
+  // ============== different in each lane ============
+
+  for(w=0;w<LANES;w++){
+#if LIGHT_TABLE
+    if(b->m[w]->par.isat==ISAT && b->m[w]->par.isateh==ISATEH)
+      get_light_table(m->esurf,chlo[w],m->mixed,&lt);
+    else
+      get_light_limitation(m->esurf,chlo[w],m->mixed,b->m[w]->par.isat,b->m[w]->par.isateh,&lt);
+#else
+    get_light_limitation(m->esurf,chlo[w],m->mixed,b->m[w]->par.isat,b->m[w]->par.isateh,&lt);
+#endif
+    b->psi[w]=lt.psi;
+    b->psieh[w]=lt.psieh;
+    b->psica[w]=lt.psica;
+
+    get_carbonate_species(alk[w],tco2[w],sil[w],&kk,&b->carb[w]);
+    b->m[w]->nhfail+=b->carb[w].hfail;
+    b->pco2w[w]=b->carb[w].pco2;
+  }
+}
+
+
+// as derivs, for all the lanes (without the diagnostic variables)
+void derivs_batch(batch *b, double y[][LANES], double dydt[][LANES])
+{
+  int i,w;
+  model *m=b->m[0];
+  double d[NEQ+1][LANES];   // dydt, local so that it cannot alias y and b in the loop over the lanes
+
+  for(w=0;w<LANES;w++) b->m[w]->nrhs++;
+
+  for(i=1;i<=NEQ;i++) for(w=0;w<LANES;w++) y[i][w]=fabs(y[i][w]);
+
+  for(w=0;w<LANES;w++) get_rhs(m,b,y,w,d);
+
+  for(i=1;i<=NEQ;i++) for(w=0;w<LANES;w++) dydt[i][w]=d[i][w];
+}
+
+
+//================================ ENSEMBLE ==================================
+//
+// An ensemble is given as a table of parameter sets, one member per line.
+// The first line names the columns (any of the params, in lower case, as
+// they are called in param.h) and it starts with '#':
+//
+//   # md    mzme  zmif  kmig  isat   vdt
+//     0.04  0.2   0.7   1.0   100.0  1.0
+//     0.05  0.2   0.7   1.0   120.0  0.4
+//
+// The parameters that are not in the table keep the values of param.h.
+// The members run on nthr threads, each with its own model; the forcing
+// loaded by main is shared and only read. No results files are written by
+// the members: the summary of each one (see get_summary) goes to
+// ./results/ensemble.dat, in the order of the table.
+
+
+// parameters as in param.h, in d-1
+void set_default_params(params *p)
+{
+  p->md=MD*24.0;
+  p->mf=MF*24.0;
+  p->mdf=MDF*24.0;
+  p->meh=MEH*24.0;
+  p->mzmi=MZMI*24.0;
+  p->mzme=MZME*24.0;
+  p->zmid=ZMID*24.0;
+  p->zmif=ZMIF*24.0;
+  p->zmie=ZMIE*24.0;
+  p->zmed=ZMED*24.0;
+  p->zmedf=ZMEDF*24.0;
+  p->zmemi=ZMEMI*24.0;
+  p->kmig=KMIG;
+  p->kmeg=KMEG;
+  p->isat=ISAT;
+  p->isateh=ISATEH;
+  p->vdt=VDT*24.0;
+}
+
+
+// the parameter called name, NULL if there is none
+double *get_param(params *p, const char *name)
+{
+  if(!strcmp(name,"md")) return &p->md;
+  if(!strcmp(name,"mf")) return &p->mf;
+  if(!strcmp(name,"mdf")) return &p->mdf;
+  if(!strcmp(name,"meh")) return &p->meh;
+  if(!strcmp(name,"mzmi")) return &p->mzmi;
+  if(!strcmp(name,"mzme")) return &p->mzme;
+  if(!strcmp(name,"zmid")) return &p->zmid;
+  if(!strcmp(name,"zmif")) return &p->zmif;
+  if(!strcmp(name,"zmie")) return &p->zmie;
+  if(!strcmp(name,"zmed")) return &p->zmed;
+  if(!strcmp(name,"zmedf")) return &p->zmedf;
+  if(!strcmp(name,"zmemi")) return &p->zmemi;
+  if(!strcmp(name,"kmig")) return &p->kmig;
+  if(!strcmp(name,"kmeg")) return &p->kmeg;
+  if(!strcmp(name,"isat")) return &p->isat;
+  if(!strcmp(name,"isateh")) return &p->isateh;
+  if(!strcmp(name,"vdt")) return &p->vdt;
+  return NULL;
+}
+
+
+// summary of the last year of a run: annual mean of the 14 variables,
+// then max of E. huxleyi and the day it is reached, the evaluations of derivs
+// and the spin-up years integrated
+void get_summary(model *m, double s[])
+{
+  int i,k,n=0;
+  double ehmax=-1.0;
+  double dmax=0.0;
+
+  for(i=1;i<=NSUM;i++) s[i]=0.0;
+
+  for(k=2;k<=HSTEP-2;k++){  // hours saved by rkdriver
+    for(i=1;i<=NEQ;i++) s[i]+=m->y[i][k];
+    if(m->y[9][k]>ehmax){
+      ehmax=m->y[9][k];
+      dmax=m->tt[k]/24.0;
+    }
+    n++;
+  }
+  for(i=1;i<=NEQ;i++) s[i]/=n;
+  s[NEQ+1]=ehmax;
+  s[NEQ+2]=dmax;
+  s[NEQ+3]=m->nrhs;
+  s[NEQ+4]=m->nspin;
+}
+
+
+// run the members of the ensemble in file on nthr threads, all starting
+// from vstart
+int run_ensemble(const char *file, const double vstart[], int nthr)
+{
+  int i,j,l;
+  int nmem=0;        // number of members
+  int ncol=0;        // number of columns of the table
+  char name[NPAR][20];
+  char line[1024];
+
+  ifstream in(file);
+  if(!in){
+    cout<<" Impossible to open ensemble file "<<file<<"\n";
+    return 1;
+  }
+
+  // == names of the columns ==
+  in.getline(line,sizeof(line));
+  std::istringstream hd(line);
+  std::string w;
+  hd>>w;
+  if(w!="#"){
+    cout<<" The first line of "<<file<<" must be # followed by the parameter names\n";
+    return 1;
+  }
+  params def;
+  set_default_params(&def);
+  while(hd>>w){
+    if(ncol==NPAR || w.size()>=20 || !get_param(&def,w.c_str())){
+      cout<<" Unknown parameter "<<w<<" in "<<file<<"\n";
+      return 1;
+    }
+    strcpy(name[ncol++],w.c_str());
+  }
+
+  // == members ==
+  while(in.getline(line,sizeof(line))){
+    std::istringstream ln(line);
+    if(ln>>w) nmem++;
+  }
+  in.clear();
+  in.seekg(0);
+  in.getline(line,sizeof(line));
+  if(nmem==0){
+    cout<<" No members in "<<file<<"\n";
+    return 1;
+  }
+
+  params *par=new params[nmem];
+  for(j=0;j<nmem;j++){
+    par[j]=def;
+    for(l=0;l<ncol;l++){
+      if(!(in>>*get_param(&par[j],name[l]))){
+	cout<<" Missing value in line "<<j+2<<" of "<<file<<"\n";
+	delete [] par;
+	return 1;
+      }
+    }
+  }
+  in.close();
+
+  if(nthr<1) nthr=std::thread::hardware_concurrency();
+  if(nthr<1) nthr=1;
+#if LANES>1 && INTEGRATOR==1 && !SHOOTING
+  const int nlane=LANES;   // members run together by each thread (rkdriver_batch)
+#else
+  const int nlane=1;
+#endif
+  if(nthr>(nmem+nlane-1)/nlane) nthr=(nmem+nlane-1)/nlane;
+
+  cout<<endl;
+  cout<<"running "<<nmem<<" members on "<<nthr<<" threads, "<<nlane<<" at a time on each"<<endl;
+
+  // == nlane models and trajectories per thread, allocated here ==
+  double **sum=dmatrix(0,nmem-1,1,NSUM);
+  model *mod=new model[nthr*nlane]();   // zero initialised
+  for(i=0;i<nthr*nlane;i++){
+    mod[i].tt=dvector(1,HSTEP);
+    mod[i].y=dmatrix(1,NEQ,1,HSTEP);
+  }
+
+  // == run, each thread takes the next member (or batch of members) left ==
+  std::atomic<int> next(0);
+  std::atomic<long> nhfail(0);   // [H+] not converged, all the members
+  std::chrono::steady_clock::time_point t0=std::chrono::steady_clock::now();
+
+  std::thread *pool=new std::thread[nthr];
+  for(i=0;i<nthr;i++){
+    pool[i]=std::thread([&,i](){
+      int j,l,w;
+      model *m[LANES];
+      for(w=0;w<nlane;w++) m[w]=&mod[i*nlane+w];
+#if LANES>1 && INTEGRATOR==1 && !SHOOTING
+      batch b;
+      double v[NEQ+1][LANES];
+      while((j=next.fetch_add(LANES))<nmem){
+	for(w=0;w<LANES;w++){
+	  double **y=m[w]->y, *tt=m[w]->tt;
+	  end_model(m[w]);
+	  memset(m[w],0,sizeof(model));  // nothing left from the previous members
+	  m[w]->y=y;
+	  m[w]->tt=tt;
+	  for(l=1;l<=NEQ;l++) m[w]->yi[l]=v[l][w]=vstart[l];
+	}
+	set_batch(&b,m,&par[j],nmem-j<LANES ? nmem-j : LANES);
+	rkdriver_batch(&b,v);
+	for(w=0;w<LANES && j+w<nmem;w++){
+	  get_summary(m[w],sum[j+w]);
+	  nhfail+=m[w]->nhfail;
+	}
+      }
+#else
+      double v[NEQ+1];
+      while((j=next++)<nmem){
+	double **y=m[0]->y, *tt=m[0]->tt;
+	end_model(m[0]);
+	memset(m[0],0,sizeof(model));  // nothing left from the previous member
+	m[0]->y=y;
+	m[0]->tt=tt;
+	m[0]->par=par[j];
+	m[0]->out=FALSE;
+	for(l=1;l<=NEQ;l++) m[0]->yi[l]=v[l]=vstart[l];
+	rkdriver(m[0],v,NEQ,TI,TH,HSTEP,derivs);
+	get_summary(m[0],sum[j]);
+	nhfail+=m[0]->nhfail;
+      }
+#endif
+    });
+  }
+  for(i=0;i<nthr;i++) pool[i].join();
+  delete [] pool;
+
+  double sec=std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+  cout<<"   "<<sec<<" s, "<<nmem/sec<<" members per second"<<endl;
+  if(nhfail>0) cout<<"   [H+] not converged in "<<HITMAX<<" iterations: "<<nhfail<<" times"<<endl;
+
+  // == summaries ==
+  ofstream outens("./results/ensemble.dat");
+  outens<<"#member ";
+  for(l=0;l<ncol;l++) outens<<name[l]<<" ";
+  outens<<"diato flage nitra silic mesoz detri micro dinof ehuxl ammon acocc fcocc tdic talk "
+	<<"ehuxmax ehuxday nderivs nspinup"<<endl;
+  for(j=0;j<nmem;j++){
+    outens<<j+1<<" ";
+    for(l=0;l<ncol;l++) outens<<*get_param(&par[j],name[l])<<" ";
+    for(i=1;i<=NSUM;i++) outens<<sum[j][i]<<" ";
+    outens<<"\n";
+  }
+  outens.close();
+
+  for(i=0;i<nthr*nlane;i++){
+    free_dmatrix(mod[i].y,1,NEQ,1,HSTEP);
+    free_dvector(mod[i].tt,1,HSTEP);
+  }
+  delete [] mod;
+  delete [] par;
+  free_dmatrix(sum,0,nmem-1,1,NSUM);
+
+  return 0;
+}
 
-  // =============================================
 
+//============================== RESULTS FILES ================================
+
+
+// columns of the binary results file, the rows are set by rkdriver
+static const results_column rscol[NRCOL]={
+  {"time","h",8,0},
+  {"diato","mmol N m-3",8,0}, {"flage","mmol N m-3",8,0}, {"nitra","mmol N m-3",8,0}, {"silic","mmol Si m-3",8,0},
+  {"mesoz","mmol N m-3",8,0}, {"detri","mmol N m-3",8,0}, {"micro","mmol N m-3",8,0}, {"dinof","mmol N m-3",8,0},
+  {"ehuxl","mmol N m-3",8,0}, {"ammon","mmol N m-3",8,0}, {"acocc","mmol C m-3",8,0}, {"fcocc","mmol C m-3",8,0},
+  {"tdic","umol C kg-1",8,0}, {"talk","ueq kg-1",8,0},
+  {"temp","degC",4,0}, {"mixed","m",4,0}, {"salin","psu",4,0}, {"esurf","W m-2",4,0}, {"wspeed","m s-1",4,0},
+  {"chl","mg Chl m-3",4,0},
+  {"pco2","uatm",4,0}, {"co3","umol C kg-1",4,0}, {"ocal","-",4,0}, {"oara","-",4,0}, {"ph","-",4,0},
+  {"hco3","umol C kg-1",4,0}, {"co2aq","umol C kg-1",4,0}, {"psi","-",4,0},
+  {"newpp","mmol N m-3 h-1",4,0}, {"regpp","mmol N m-3 h-1",4,0}, {"totpp","mmol N m-3 h-1",4,0},
+  {"zoopro","mmol N m-3 h-1",4,0}, {"phyloss","mmol N m-3 h-1",4,0}, {"zooloss","mmol N m-3 h-1",4,0},
+  {"phymix","mmol N m-3 h-1",4,0}, {"calc","mmol C m-3 h-1",4,0}, {"photo","mmol C m-3 h-1",4,0},
+  {"grazd","h-1",4,0}, {"graze","h-1",4,0}};
+
+static double rsbuf[NRCOL][DSTEP+1];   // the rows of the current year
+static int rsnrec=0;
+static results_year rsyear[Y+1];       // the years written
+static int rsnyear=0;
+static long rsoff=0;                   // bytes written
+
+static void put_results(const void *p, long n)
+{
+  outbin.write((const char *)p,n);
+  rsoff+=n;
+}
+
+static void put_results_header(void)
+{
+  results_header h;
+
+  memset(&h,0,sizeof(h));
+  memcpy(h.magic,RSMAGIC,8);
+  h.ncol=NRCOL;
+  h.hstep=HSTEP;
+  put_results(&h,sizeof(h));
+  put_results(rscol,sizeof(rscol));
+}
+
+// add a row to the current year
+void put_results_row(const double r[])
+{
+  if(rsnrec>DSTEP) return;
+  for(int c=0;c<NRCOL;c++) rsbuf[c][rsnrec]=r[c];
+  rsnrec++;
+}
+
+// write the columns of the current year yy
+void put_results_year(int yy)
+{
+  static const char zero[8]={0};
+  float f[DSTEP+1];
+  int c, j;
+  long n;
+
+  if(!rsoff) put_results_header();
+  if(rsnyear<=Y){
+    rsyear[rsnyear].yy=yy;
+    rsyear[rsnyear].nrec=rsnrec;
+    rsyear[rsnyear++].offset=rsoff;
+  }
+
+  for(c=0;c<NRCOL;c++){
+    n=get_results_size(&rscol[c],rsnrec);
+    if(rscol[c].size==4){
+      for(j=0;j<rsnrec;j++) f[j]=rsbuf[c][j];
+      put_results(f,4*rsnrec);
+    }
+    else put_results(rsbuf[c],8*rsnrec);
+    put_results(zero,n-(long)rscol[c].size*rsnrec);
+  }
+  rsnrec=0;
+}
+
+// write the index of the years, at the end of the file
+void put_results_index(void)
+{
+  results_trailer t;
+
+  if(!rsoff) put_results_header();
+  memset(&t,0,sizeof(t));
+  t.index=rsoff;
+  t.nyear=rsnyear;
+  memcpy(t.magic,RSMAGIC,8);
+  put_results(rsyear,rsnyear*sizeof(results_year));
+  put_results(&t,sizeof(t));
+}
+
+
+
+// write the queued buffers until free_output_writer, then the ones left
+static void write_output(out_writer *w)
+{
+  unsigned h=w->head.load(std::memory_order_relaxed), t;
+  ssize_t l;
+  size_t n;
+  out_chunk *c;
+
+  for(;;){
+    int stop=w->stop.load();
+    if(h==w->tail.load(std::memory_order_acquire)){
+      if(stop) break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    c=&w->q[h%OBQUEUE];
+    for(n=0;n<c->n;n+=l)
+      if((l=write(c->fd,c->b+n,c->n-n))<=0) break;
+    if(c->last) ::close(c->fd);
+    t=w->stail.load(std::memory_order_relaxed);
+    if(t-w->shead.load(std::memory_order_acquire)<OBQUEUE){   // a spare again
+      w->spare[t%OBQUEUE]=c->b;
+      w->stail.store(t+1,std::memory_order_release);
+    }
+    else delete [] c->b;                      // the last one of a file, not needed
+    w->head.store(++h,std::memory_order_release);
+  }
+}
+
+// groups of diagnostic variables read by the results files that are open
+int get_output_diagnostics(void)
+{
+  int d=0;
+
+  for(size_t i=0;i<sizeof(outdiag)/sizeof(outdiag[0]);i++)
+    if(outdiag[i].f->is_open()) d|=outdiag[i].diag;
+  return d;
+}
+
+// queue a buffer, waiting if the queue is full
+static void put_output(const out_chunk *c)
+{
+  out_writer *w=&obw;
+  unsigned t=w->tail.load(std::memory_order_relaxed);
 
+  while(t-w->head.load(std::memory_order_acquire)>=OBQUEUE)
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  w->q[t%OBQUEUE]=*c;
+  w->tail.store(t+1,std::memory_order_release);
 }
 
+// a spare buffer, waiting until the writer gives one back if there is none
+static char *get_output_buffer(void)
+{
+  out_writer *w=&obw;
+  unsigned h=w->shead.load(std::memory_order_relaxed);
+  char *b;
+
+  while(h==w->stail.load(std::memory_order_acquire))
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  b=w->spare[h%OBQUEUE];
+  w->shead.store(h+1,std::memory_order_release);
+  return b;
+}
+
+// open all the results files, truncating them
+void open_output(void)
+{
+  for(outbuf *b=outfiles;b;b=b->next) b->open();
+}
+
+// end the writer thread once all the queued buffers are written
+void free_output_writer(void)
+{
+  unsigned h;
+
+  obw.stop=TRUE;
+  if(obw.th.joinable()) obw.th.join();
+  for(h=obw.shead;h!=obw.stail;h++) delete [] obw.spare[h%OBQUEUE];
+  obw.shead=obw.stail.load();
+}
+
+out_writer::~out_writer()
+{
+  free_output_writer();
+}
 
+outbuf::outbuf(const char *name) : name(name), fd(-1)
+{
+  next=outfiles;
+  outfiles=this;
+}
 
+void outbuf::open()
+{
+  char *b;
 
+  if(pbase()) return;                          // already open
+  if(!obw.th.joinable()){                      // the first file: the spares and the writer
+    for(int i=0;i<OBQUEUE;i++) obw.spare[i]=new char[OBSIZE];
+    obw.stail=OBQUEUE;
+    obw.th=std::thread(write_output,&obw);
+  }
+  b=new char[OBSIZE];
+  fd=::open(name,O_WRONLY|O_CREAT|O_TRUNC,0644);
+  setp(b,b+OBSIZE);
+}
 
+outbuf::~outbuf()
+{
+  close();
+}
 
+// queue the buffer, then write into a spare one
+void outbuf::put(int last)
+{
+  out_chunk c;
+
+  c.fd=fd;
+  c.last=last;
+  c.n=pptr()-pbase();
+  c.b=pbase();
+  if(fd<0){                                    // the file could not be opened
+    if(last){
+      delete [] c.b;
+      setp(NULL,NULL);
+    }
+    else setp(c.b,c.b+OBSIZE);
+    return;
+  }
+  put_output(&c);
 
+  if(last) setp(NULL,NULL);
+  else{
+    c.b=get_output_buffer();
+    setp(c.b,c.b+OBSIZE);
+  }
+}
 
+// the buffer is full
+int outbuf::overflow(int c)
+{
+  if(!pbase()) return EOF;                     // closed
+  put(FALSE);
+  if(c!=EOF){
+    *pptr()=c;
+    pbump(1);
+  }
+  return c==EOF ? 0 : c;
+}
 
+// endl and flush: the buffer is written when full
+int outbuf::sync()
+{
+  return 0;
+}
 
+// queue the last buffer, the file is closed once it is written
+void outbuf::close()
+{
+  if(!pbase()) return;
+  put(TRUE);
+  fd=-1;
+}